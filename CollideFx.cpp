@@ -13,6 +13,8 @@
 #include <iostream>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
  #include <libgen.h>
 #include "UGenChain.h"
@@ -21,10 +23,8 @@
 #include "Graphics.h"
 #include "Physics.h"
 #include "Menu.h"
+#include "Session.h"
 /*
-Known Bugs/Issues-- 
-  Can't change buffer size without crash
-
 Things to add: 
   Better distortion algorithm! // This is started
 
@@ -34,20 +34,120 @@ Things to add:
   
 */
 
+// Changes the audio settings while running
+//   b - next buffer size, r - next sample rate
+void audio_settings_key(void *data, unsigned char key){
+  UGenChain *chain = (UGenChain *) data;
+  if (key == 'b') chain->cycle_buffer_size();
+  else if (key == 'r') chain->cycle_sample_rate();
+}
+
 int main(int argc, char *argv[]) {
   srand (time(NULL));
 
   // Makes sure we are running from the right directory
   chdir(dirname(argv[0]));
 
+  // Resolution of the spectrum display, zero keeps the defaults
+  //   --fft-size N   length of the transform in samples
+  //   --fft-hop N    samples between successive transforms
+  int fft_size = 0, fft_hop = 0;
+  // Audio settings
+  //   --buffer N     frames per buffer (32, 64, 128, 256 or 512)
+  //   --rate N       sample rate (44100, 48000 or 96000)
+  //   --no-optimize  runs every disc on its own, for comparison
+  //   --input-channels N  opens N input channels, each input disc picks one
+  //   --limit        softly limits the mix before it reaches the speakers
+  unsigned int buffer_frames = UGenChain::kDefaultBufferFrames;
+  unsigned int sample_rate = UGenChain::kSampleRate;
+  bool optimize = true, frozen = false, limit = false;
+  // Diagnostics, these run instead of the program
+  //   --latency-test [impulse|mls]   measures round trip latency and jitter
+  //   --loopback                     uses a software loopback device
+  bool latency_test = false, loopback = false;
+  LatencyProbe::Signal probe_signal = LatencyProbe::kMLS;
+  // Effects
+  //   --ir FILE      impulse response for the reverb, a WAV file
+  //   --loop-dir DIR streams long loops to files in DIR
+  //   --frozen       starts with an input feeding the preset chain
+  // Scenes
+  //   --scene-dir DIR keeps the scenes saved with alt and a number in DIR
+  // Scheduling, reported once the audio has started
+  //   --rt-priority N     realtime priority for the audio thread
+  //   --mlock             locks the program's memory into RAM
+  //   --audio-cores LIST  pins the audio thread, e.g. 2 or 1,3 or 2-3
+  //   --worker-cores LIST pins the DSP and physics worker threads
+  // Physics
+  //   --physics-rate N    ticks per second of the physics thread, 0 moves
+  //                       the discs once a frame instead
+  //   --physics-threads N threads that share each tick, 1 by default.
+  //                       Keep them off the audio cores
+  double physics_rate = Physics::kTickRate;
+  int physics_threads = 1;
+  const char *ir_path = NULL;
+  for (int i = 1; i < argc; ++i){
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--fft-size") == 0 && has_value) fft_size = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--fft-hop") == 0 && has_value) fft_hop = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--buffer") == 0 && has_value) buffer_frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--rate") == 0 && has_value) sample_rate = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--input-channels") == 0 && has_value) UGenChain::set_input_channels(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--no-optimize") == 0) optimize = false;
+    else if (strcmp(argv[i], "--limit") == 0) limit = true;
+    else if (strcmp(argv[i], "--ir") == 0 && has_value) ir_path = argv[++i];
+    else if (strcmp(argv[i], "--loop-dir") == 0 && has_value) LoopStorage::set_directory(argv[++i]);
+    else if (strcmp(argv[i], "--scene-dir") == 0 && has_value) Session::set_directory(argv[++i]);
+    else if (strcmp(argv[i], "--frozen") == 0) frozen = true;
+    else if (strcmp(argv[i], "--loopback") == 0) loopback = true;
+    else if (strcmp(argv[i], "--rt-priority") == 0 && has_value) Scheduling::set_realtime_priority(atoi(argv[++i]));
+    else if (strcmp(argv[i], "--mlock") == 0) Scheduling::set_lock_memory(true);
+    else if (strcmp(argv[i], "--audio-cores") == 0 && has_value) Scheduling::set_audio_cores(argv[++i]);
+    else if (strcmp(argv[i], "--worker-cores") == 0 && has_value) Scheduling::set_worker_cores(argv[++i]);
+    else if (strcmp(argv[i], "--physics-rate") == 0 && has_value) physics_rate = atof(argv[++i]);
+    else if (strcmp(argv[i], "--physics-threads") == 0 && has_value) physics_threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--latency-test") == 0){
+      latency_test = true;
+      if (has_value && strcmp(argv[i + 1], "impulse") == 0){
+        probe_signal = LatencyProbe::kImpulse;
+        ++i;
+      }
+      else if (has_value && strcmp(argv[i + 1], "mls") == 0) ++i;
+    }
+  }
+  if (!UGenChain::is_valid_buffer_size(buffer_frames)){
+    printf("Unsupported buffer size %d, using %d\n", buffer_frames, UGenChain::kDefaultBufferFrames);
+    buffer_frames = UGenChain::kDefaultBufferFrames;
+  }
+  if (!UGenChain::is_valid_sample_rate(sample_rate)){
+    printf("Unsupported sample rate %d, using %d\n", sample_rate, UGenChain::kSampleRate);
+    sample_rate = UGenChain::kSampleRate;
+  }
+
+  if (ir_path != NULL && !ConvolutionReverb::load_impulse_response(ir_path)){
+    printf("Using the algorithmic reverb instead\n");
+  }
+  // Locks what is mapped so far, and what comes later where allowed
+  Scheduling::lock_memory();
+
+  if (latency_test){
+    UGenChain *probeChain = new UGenChain();
+    return probeChain->run_latency_test(probe_signal, loopback, buffer_frames, sample_rate);
+  }
+
   Graphics *myGraphics = new Graphics(1100, 600);
   myGraphics->initialize(argc, argv);
 
   myGraphics->show_splash_screen();
 
   UGenChain *myChain = new UGenChain();
-  myChain->initialize_audio();
+  myChain->initialize_audio(buffer_frames, sample_rate);
+  Scheduling::report();
   myChain->initialize_midi();
+  Graphics::add_key_listener('b', audio_settings_key, myChain);
+  Graphics::add_key_listener('r', audio_settings_key, myChain);
+  myChain->get_signal_graph()->configure_analyzer(fft_size, fft_hop);
+  myChain->get_signal_graph()->set_optimize(optimize);
+  if (limit) myChain->get_signal_graph()->output_stage()->set_limit(UGenChain::kMaxOutput);
 
   Menu *myMenu = new Menu();
   World *myWorld = new World(30, 30, 9, 0);
@@ -56,12 +156,28 @@ int main(int argc, char *argv[]) {
   Graphics::add_drawable(myMenu, 1);
   Graphics::add_moveable(myMenu);
   myMenu->link_ugen_graph(myChain->get_signal_graph());
+  // The two discs touch, so all of the input goes through the chain
+  if (frozen){
+    myMenu->place_disc(100, -2.3, 0);
+    myMenu->place_disc(Menu::kPresetChainType, 0, 0);
+  }
+
+  // The number keys recall scenes, alt and a number key saves them
+  Session *mySession = new Session(myChain->get_signal_graph());
+  myMenu->link_session(mySession);
+  for (int i = 1; i <= Session::kNumScenes; ++i){
+    Graphics::add_key_listener('0' + i, Session::scene_key, mySession);
+  }
   if (UGenChain::has_midi()){ 
     myMenu->enable_midi(); 
   }
 
   Graphics::add_drawable(myWorld, 2);
   Physics::set_bounds(30*(1-2*World::kWallThickness), 30*(1-2*World::kWallThickness), 9, 0);
+  // The physics workers go on the worker cores, away from the audio
+  WorkerPool::set_thread_hook(Scheduling::enter_worker_thread);
+  if (physics_threads > 1) Physics::set_threads(physics_threads);
+  if (physics_rate > 0) Physics::start_thread(physics_rate);
   myGraphics->start_graphics();
 
   return 1;
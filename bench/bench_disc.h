@@ -0,0 +1,35 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  bench_disc.h
+  A stand in for Disc in the physics benchmarks. It has the same mass,
+  drag and spin damping as a disc, without the graphics or the sound, so
+  it can be built without a window.
+*/
+
+#ifndef _BENCH_DISC_H_
+#define _BENCH_DISC_H_
+
+#include "Physical.h"
+
+class BenchDisc : public Physical {
+public:
+  BenchDisc(double x, double y, double vx, double vy, double radius){
+    r_ = radius;
+    pos_ = Vector3d(x, y, 0);
+    vel_ = Vector3d(vx, vy, 0);
+    m_ = radius * radius;
+    I_ = 0.5 * m_ * m_;
+  }
+  bool has_collisions(){ return true; }
+  bool uses_friction(){ return true; }
+  double intersection_distance(){ return r_; }
+  bool rotates(){ return false; }
+  Vector3d external_forces(){ return -vel_ * vel_.length() * .05 * r_; }
+  Vector3d external_torques(){ return -ang_vel_ * .006 * 180.0 / 3.1415926535; }
+private:
+  double r_;
+};
+
+#endif
@@ -0,0 +1,21 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  bench_time.h
+  The clock the benchmarks time themselves with.
+*/
+
+#ifndef _BENCH_TIME_H_
+#define _BENCH_TIME_H_
+
+#include <time.h>
+
+// Monotonic time in nanoseconds
+static inline double now_ns(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+#endif
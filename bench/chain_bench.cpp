@@ -0,0 +1,107 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  chain_bench.cpp
+  Runs the preset chain of distortion, filter, delay and reverb two ways:
+  as a FrozenChain and as discs in the signal graph, a little apart so that
+  each is partly dry. The chain is given the mix levels the graph finds
+  for the discs. Reports the cost of a block for each and the largest
+  difference between their outputs, which should be down at the rounding
+  of the parameters being copied across. Exits with 1 if it is more than
+  kTolerance.
+
+  make bench
+  ./chain_bench [seconds] [gap]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include "FrozenChain.h"
+#include "UGenGraphBuilder.h"
+#include "Denormals.h"
+#include "bench_time.h"
+
+static const int kBufferLength = 256;
+static const int kSampleRate = 44100;
+static const double kRadius = 1.15;
+static const double kTolerance = 1e-9;
+
+int main(int argc, char *argv[]){
+  double seconds = argc > 1 ? atof(argv[1]) : 20;
+  double gap = argc > 2 ? atof(argv[2]) : 0.5;
+  int num_blocks = static_cast<int>(seconds * kSampleRate / kBufferLength);
+  if (num_blocks <= 0 || gap < 0 || 2 * kRadius + gap >= UGenGraphBuilder::kMaxDist){
+    printf("Usage: chain_bench [seconds] [gap]\n");
+    return 2;
+  }
+  enable_flush_to_zero();
+
+  UGenGraphBuilder graph;
+  graph.initialize(kBufferLength, kSampleRate);
+  PresetChain frozen;
+
+  // The same effects with the same parameters, each disc gap away from the
+  // next. The wet level is worked out as UGenGraphBuilder does it
+  double wet_level = 1 - gap / (UGenGraphBuilder::kMaxDist - 2 * kRadius);
+  Disc *input = new Disc(new Input(), kRadius, false);
+  input->set_location(0, 0);
+  graph.add_input(input);
+  Physics::give_physics(input);
+  Disc *last = NULL;
+  for (int i = 0; i < frozen.num_stages(); ++i){
+    UnitGenerator *u;
+    if (i == 0) u = new Distortion();
+    else if (i == 1) u = new Filter();
+    else if (i == 2) u = new Delay();
+    else u = new Reverb();
+    UnitGenerator *s = frozen.stage(i);
+    u->set_normalized_param(s->get_normalized_param(1), s->get_normalized_param(2));
+    frozen.set_mix(i, wet_level);
+    last = new Disc(u, kRadius, false);
+    last->set_location((2 * kRadius + gap) * (i + 1), 0);
+    graph.add_effect(last);
+    Physics::give_physics(last);
+  }
+  // The graph reads where the discs are from the physics, which publishes
+  // them once it has ticked
+  Physics::update(0);
+  graph.rebuild();
+
+  double in[kBufferLength], out[kBufferLength];
+  double graph_ns = 0, frozen_ns = 0, max_diff = 0, start;
+  srand(1);
+  for (int b = 0; b < num_blocks; ++b){
+    for (int i = 0; i < kBufferLength; ++i) in[i] = 0.5 * (rand() / (1.0 * RAND_MAX) - 0.5);
+
+    // Only the render is timed. The chain never rewires, so the rebuild
+    // the GUI would run between blocks is left out
+    graph.handoff_audio_buffer(in, kBufferLength);
+    start = now_ns();
+    graph.load_buffer(out, kBufferLength);
+    graph_ns += now_ns() - start;
+    graph.rebuild();
+    // The graph filters its final mix, so the last disc is compared
+    double *graph_out = last->get_ugen()->current_buffer();
+
+    start = now_ns();
+    double *frozen_out = frozen.process_buffer(in, kBufferLength);
+    frozen_ns += now_ns() - start;
+
+    for (int i = 0; i < kBufferLength; ++i){
+      max_diff = fmax(max_diff, fabs(graph_out[i] - frozen_out[i]));
+    }
+  }
+
+  printf("%d blocks of %d samples\n", num_blocks, kBufferLength);
+  printf("  graph   %8.2f us/block\n", graph_ns / num_blocks / 1000);
+  printf("  frozen  %8.2f us/block\n", frozen_ns / num_blocks / 1000);
+  printf("  speedup %8.2fx\n", graph_ns / frozen_ns);
+  printf("  wet level %g\n", wet_level);
+  printf("  largest difference %g\n", max_diff);
+  if (max_diff > kTolerance){
+    printf("The frozen chain doesn't sound like the graph\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,90 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  denormal_bench.cpp
+  Feeds an impulse into the feedback effects followed by minutes of
+  silence and reports the cost of each block as the tails decay into the
+  subnormal range. Runs once with gradual underflow and once with
+  flush-to-zero. Build with -DUSE_DENORMAL_GUARD to measure the software
+  guard instead.
+
+  make bench
+  ./denormal_bench [minutes]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include "UnitGenerator.h"
+#include "Denormals.h"
+#include "bench_time.h"
+
+static const int kBufferLength = 512;
+static const int kSampleRate = 44100;
+// Length of each line of the report
+static const double kWindow = 10.0; // s
+
+// Runs the effects over an impulse and then silence, printing the mean and
+// worst block time of every window
+void run(int minutes, bool flush){
+  if (flush) enable_flush_to_zero();
+  else disable_flush_to_zero();
+  printf("\nFTZ/DAZ %s\n", flush ? "on" : "off");
+  printf("  %8s %10s %10s\n", "time(s)", "mean(us)", "max(us)");
+
+  UnitGenerator *chain[] = { new Reverb(0.9, 0.2), new Delay(0.3, 0.8),
+                             new Chorus(0.5, 0.5), new Filter(800, 4),
+                             new Bandpass(1200, 2) };
+  int num_ugens = sizeof(chain) / sizeof(chain[0]);
+
+  double block[kBufferLength];
+  int blocks_per_window = static_cast<int>(kWindow * kSampleRate / kBufferLength);
+  int num_blocks = static_cast<int>(60.0 * minutes * kSampleRate / kBufferLength);
+  double window_sum = 0, window_max = 0, first_mean = 0, last_mean = 0;
+  double start, elapsed, *out;
+
+  for (int b = 0; b < num_blocks; ++b){
+    for (int i = 0; i < kBufferLength; ++i) block[i] = 0;
+    if (b == 0) block[0] = 1;
+
+    start = now_ns();
+    out = block;
+    for (int u = 0; u < num_ugens; ++u){
+      out = chain[u]->process_buffer(out, kBufferLength);
+    }
+    elapsed = (now_ns() - start) / 1000.0;
+
+    window_sum += elapsed;
+    window_max = fmax(window_max, elapsed);
+    if ((b + 1) % blocks_per_window == 0){
+      double mean = window_sum / blocks_per_window;
+      if (first_mean == 0) first_mean = mean;
+      last_mean = mean;
+      printf("  %8.0f %10.2f %10.2f\n", (b + 1.0) * kBufferLength / kSampleRate,
+             mean, window_max);
+      window_sum = 0;
+      window_max = 0;
+    }
+  }
+  printf("  last/first window: %.2fx\n", last_mean / first_mean);
+
+  for (int u = 0; u < num_ugens; ++u) delete chain[u];
+}
+
+int main(int argc, char *argv[]){
+  int minutes = argc > 1 ? atoi(argv[1]) : 5;
+  if (minutes < 1) minutes = 1;
+  UnitGenerator::set_audio_settings(kBufferLength, kSampleRate);
+
+  printf("Denormal benchmark: %d frames at %d Hz, %d min of silence after an impulse\n",
+         kBufferLength, kSampleRate, minutes);
+#ifdef USE_DENORMAL_GUARD
+  printf("Software guard: on\n");
+#else
+  printf("Software guard: off\n");
+#endif
+
+  run(minutes, false);
+  run(minutes, true);
+  return 0;
+}
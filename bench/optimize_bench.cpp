@@ -0,0 +1,156 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  optimize_bench.cpp
+  Renders the same graph twice, once as optimize() plans it and once with
+  set_optimize(false). The graph has a chain of filters that touch, so
+  they run fused and fully wet, and a chain a little apart, so each filter
+  is partly dry. A third of the way in one filter's cutoff moves, and its
+  chain comes apart while the coefficients glide. Halfway through the delay
+  at the end of the first chain is pulled away, and rings out bypassed with
+  no input. Reports the cost of a block each way and the largest difference
+  between the two renders, over every disc's buffer and the output. Exits
+  with 1 if it is more than kTolerance.
+
+  make bench
+  ./optimize_bench [seconds]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "UGenGraphBuilder.h"
+#include "Denormals.h"
+#include "bench_time.h"
+
+static const int kBufferLength = 256;
+static const int kSampleRate = 44100;
+static const double kRadius = 1.15;
+// The two renders round differently. The delay keeps its line in floats,
+// where that can come out as a float's last bit, so this is -120 dB
+static const double kTolerance = 1e-6;
+// The second copy sits this far up, out of reach of the first
+static const double kOffset = 50;
+
+// One copy of the graph and its discs, in the order they were placed
+struct Scene {
+  UGenGraphBuilder graph;
+  std::vector<Disc *> discs;
+  double y;
+};
+
+// Puts a disc in the scene and gives it physics, which tells the graph
+// where it is
+static Disc *place(Scene &s, UnitGenerator *u, double x, double y){
+  Disc *d = new Disc(u, kRadius, false);
+  d->set_location(x, s.y + y);
+  if (u->is_input()) s.graph.add_input(d);
+  else s.graph.add_effect(d);
+  Physics::give_physics(d);
+  s.discs.push_back(d);
+  return d;
+}
+
+// A lowpass into a bandpass into a highpass, each gap from the last
+static void place_chain(Scene &s, double y, double gap){
+  double step = 2 * kRadius + gap;
+  place(s, new Input(), 0, y);
+  place(s, new Filter(3000, 1), step, y);
+  place(s, new Bandpass(800, 2), 2 * step, y);
+  Filter *highpass = new Filter(200, 1);
+  highpass->set_lowpass(false);
+  place(s, highpass, 3 * step, y);
+}
+
+// Both chains, and the delay at the end of the first
+static void build(Scene &s){
+  place_chain(s, 0, 0);
+  place_chain(s, 10, 0.5);
+  place(s, new Delay(0.2, 0.6), 4 * 2 * kRadius, 0);
+  s.graph.rebuild();
+}
+
+int main(int argc, char *argv[]){
+  double seconds = argc > 1 ? atof(argv[1]) : 20;
+  int num_blocks = static_cast<int>(seconds * kSampleRate / kBufferLength);
+  if (num_blocks <= 0){
+    printf("Usage: optimize_bench [seconds]\n");
+    return 2;
+  }
+  enable_flush_to_zero();
+
+  Scene optimized, plain;
+  optimized.y = 0;
+  plain.y = kOffset;
+  optimized.graph.initialize(kBufferLength, kSampleRate);
+  plain.graph.initialize(kBufferLength, kSampleRate);
+  plain.graph.set_optimize(false);
+  build(optimized);
+  build(plain);
+  // The physics publishes where the discs are once it has ticked
+  Physics::update(0);
+  optimized.graph.rebuild();
+  plain.graph.rebuild();
+
+  double in[kBufferLength], optimized_out[kBufferLength], plain_out[kBufferLength];
+  double optimized_ns = 0, plain_ns = 0, max_diff = 0, start;
+  Disc *worst = NULL;
+  srand(1);
+  for (int b = 0; b < num_blocks; ++b){
+    if (b == num_blocks / 3){
+      optimized.discs[2]->get_ugen()->set_params(1600, 2);
+      plain.discs[2]->get_ugen()->set_params(1600, 2);
+    }
+    if (b == num_blocks / 2){
+      optimized.discs.back()->set_location(4 * 2 * kRadius, optimized.y - 20);
+      plain.discs.back()->set_location(4 * 2 * kRadius, plain.y - 20);
+      Physics::update(0);
+    }
+    for (int i = 0; i < kBufferLength; ++i) in[i] = 0.5 * (rand() / (1.0 * RAND_MAX) - 0.5);
+
+    start = now_ns();
+    optimized.graph.handoff_audio_buffer(in, kBufferLength);
+    optimized.graph.load_buffer(optimized_out, kBufferLength);
+    optimized.graph.rebuild();
+    optimized_ns += now_ns() - start;
+
+    start = now_ns();
+    plain.graph.handoff_audio_buffer(in, kBufferLength);
+    plain.graph.load_buffer(plain_out, kBufferLength);
+    plain.graph.rebuild();
+    plain_ns += now_ns() - start;
+
+    for (int i = 0; i < kBufferLength; ++i){
+      double diff = fabs(optimized_out[i] - plain_out[i]);
+      if (diff > max_diff){
+        max_diff = diff;
+        worst = NULL;
+      }
+    }
+    for (int k = 0; k < optimized.discs.size(); ++k){
+      double *a = optimized.discs[k]->get_ugen()->current_buffer();
+      double *p = plain.discs[k]->get_ugen()->current_buffer();
+      for (int i = 0; i < kBufferLength; ++i){
+        double diff = fabs(a[i] - p[i]);
+        if (diff > max_diff){
+          max_diff = diff;
+          worst = optimized.discs[k];
+        }
+      }
+    }
+  }
+
+  printf("%d blocks of %d samples\n", num_blocks, kBufferLength);
+  printf("  plain     %8.2f us/block\n", plain_ns / num_blocks / 1000);
+  printf("  optimized %8.2f us/block\n", optimized_ns / num_blocks / 1000);
+  printf("  speedup   %8.2fx\n", plain_ns / optimized_ns);
+  printf("  largest difference %g", max_diff);
+  if (max_diff > 0) printf(", at the %s", worst != NULL ? worst->get_ugen()->name() : "output");
+  printf("\n");
+  if (max_diff > kTolerance){
+    printf("The optimized graph doesn't sound like the plain one\n");
+    return 1;
+  }
+  return 0;
+}
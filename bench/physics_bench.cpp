@@ -0,0 +1,193 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  physics_bench.cpp
+  Fills a table with 500 discs, each trailed by a few orbs, and runs the
+  physics the way the graphics loop does, once with the grid and once
+  testing every pair of objects. Reports the cost of a frame for each and
+  how far apart the discs ended up, which should be nothing or close to
+  it. The same table runs again with sleeping and adaptive steps, then
+  once with every disc at rest and once with them all thrown hard, to
+  show what an idle table costs and that nothing gets through the walls.
+  Last, moves a crowd of orbs around still discs, once as objects with
+  their own forces the way orbs used to be, and once with OrbSystem.
+
+  make bench
+  ./physics_bench [frames]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "Physics.h"
+#include "OrbSystem.h"
+#include "bench_disc.h"
+#include "bench_time.h"
+
+static const int kNumDiscs = 500;
+static const int kOrbsPerDisc = 4;
+static const int kCrowdAnchors = 100;
+static const int kCrowdOrbsPerAnchor = 50;
+static const double kRadius = 1.15;
+static const double kWorldSize = 70;
+static const double kFrameTime = 1 / 60.0; // seconds
+
+// An orb the way it was before OrbSystem, with its own forces
+class BenchOrb : public Physical {
+public:
+  BenchOrb(Vector3d *anchor){
+    anchor_ = anchor;
+    pos_ = Vector3d(anchor->x + 2, anchor->y, 0);
+    wander_ = Vector3d(16.0 * (rand() / (1.0 * RAND_MAX) - .5),
+                       16.0 * (rand() / (1.0 * RAND_MAX) - .5),
+                       16.0 * (rand() / (1.0 * RAND_MAX) - .5));
+    m_ = 1;
+    I_ = 0;
+  }
+  bool has_collisions(){ return false; }
+  bool can_collide(){ return false; }
+  bool uses_friction(){ return false; }
+  double intersection_distance(){ return 0; }
+  bool rotates(){ return false; }
+  Vector3d external_forces(){
+    Vector3d axis = *anchor_ - pos_;
+    double norm_distance = axis.length() / 2.0;
+    double parabolic = -1.0 / pow(norm_distance, 2) + pow(norm_distance, 2);
+    axis.normalize();
+    return axis * OrbSystem::kStationaryForce * parabolic
+            - vel_ * OrbSystem::kStationaryDamping
+            + wander_ * OrbSystem::kStationaryWander;
+  }
+  Vector3d external_torques(){ return Vector3d(0, 0, 0); }
+  void advance_time(){
+    wander_.x = fmin(10, fmax(-10, wander_.x + rand() / (1.0 * RAND_MAX) - .5));
+    wander_.y = fmin(10, fmax(-10, wander_.y + rand() / (1.0 * RAND_MAX) - .5));
+    wander_.z = fmin(10, fmax(-10, wander_.z + rand() / (1.0 * RAND_MAX) - .5));
+  }
+private:
+  Vector3d *anchor_;
+  Vector3d wander_;
+};
+
+// Sets up the same table every time, with the discs' speeds scaled by
+// speed, and runs it. Returns the time of a frame in nanoseconds and
+// leaves the discs where they ended up
+static double run(bool grid, bool adaptive, double speed, int frames, std::vector<Vector3d> &ending){
+  std::vector<Physical *> objects;
+  std::vector<int> orbs(kNumDiscs * kOrbsPerDisc);
+  srand(1);
+  int per_row = static_cast<int>(sqrt(kNumDiscs)) + 1;
+  double spacing = kWorldSize / per_row;
+  for (int i = 0; i < kNumDiscs; ++i){
+    double x = -kWorldSize / 2 + spacing * (i % per_row + 0.5);
+    double y = -kWorldSize / 2 + spacing * (i / per_row + 0.5);
+    double vx = speed * (rand() / (1.0 * RAND_MAX) - 0.5);
+    double vy = speed * (rand() / (1.0 * RAND_MAX) - 0.5);
+    Physical *d = new BenchDisc(x, y, vx, vy, kRadius);
+    objects.push_back(d);
+    Physics::give_physics(d);
+    for (int j = 0; j < kOrbsPerDisc; ++j){
+      OrbSystem::add(&orbs[i * kOrbsPerDisc + j], &d->pos_, 2 * kRadius);
+    }
+  }
+  Physics::set_broad_phase(grid);
+  Physics::set_adaptive(adaptive);
+
+  double start = now_ns();
+  for (int f = 0; f < frames; ++f) Physics::update(kFrameTime);
+  double elapsed = now_ns() - start;
+
+  while (OrbSystem::size() > 0) OrbSystem::remove(OrbSystem::size() - 1);
+  ending.clear();
+  for (int i = 0; i < objects.size(); ++i){
+    ending.push_back(objects[i]->pos_);
+    Physics::take_physics(objects[i]);
+    delete objects[i];
+  }
+  return elapsed / frames;
+}
+
+// Moves a crowd of orbs around still anchors. Returns the time of a frame
+// in nanoseconds
+static double run_orbs(bool system, int frames){
+  std::vector<Vector3d> anchors(kCrowdAnchors);
+  std::vector<BenchOrb *> objects;
+  std::vector<int> orbs(kCrowdAnchors * kCrowdOrbsPerAnchor);
+  srand(1);
+  for (int i = 0; i < kCrowdAnchors; ++i){
+    anchors[i] = Vector3d(kWorldSize * (rand() / (1.0 * RAND_MAX) - 0.5), kWorldSize * (rand() / (1.0 * RAND_MAX) - 0.5), 0);
+    for (int j = 0; j < kCrowdOrbsPerAnchor; ++j){
+      if (system) OrbSystem::add(&orbs[i * kCrowdOrbsPerAnchor + j], &anchors[i], 2);
+      else {
+        objects.push_back(new BenchOrb(&anchors[i]));
+        Physics::give_physics(objects.back());
+      }
+    }
+  }
+
+  Physics::set_adaptive(false);
+  double start = now_ns();
+  for (int f = 0; f < frames; ++f){
+    Physics::update(kFrameTime);
+    for (int i = 0; i < objects.size(); ++i) objects[i]->advance_time();
+  }
+  double elapsed = now_ns() - start;
+
+  while (OrbSystem::size() > 0) OrbSystem::remove(OrbSystem::size() - 1);
+  for (int i = 0; i < objects.size(); ++i){
+    Physics::take_physics(objects[i]);
+    delete objects[i];
+  }
+  return elapsed / frames;
+}
+
+// The number of discs that ended up past a wall
+static int count_escaped(const std::vector<Vector3d> &ending){
+  double limit = kWorldSize / 2 - kRadius + 1e-9;
+  int escaped = 0;
+  for (int i = 0; i < ending.size(); ++i){
+    if (fabs(ending[i].x) > limit || fabs(ending[i].y) > limit) ++escaped;
+  }
+  return escaped;
+}
+
+int main(int argc, char *argv[]){
+  int frames = argc > 1 ? atoi(argv[1]) : 120;
+  Physics::set_bounds(kWorldSize, kWorldSize, 0, 0);
+
+  std::vector<Vector3d> with_grid, all_pairs;
+  double grid_ns = run(true, false, 8, frames, with_grid);
+  double pairs_ns = run(false, false, 8, frames, all_pairs);
+
+  double max_diff = 0;
+  for (int i = 0; i < with_grid.size(); ++i){
+    max_diff = fmax(max_diff, (with_grid[i] - all_pairs[i]).length());
+  }
+
+  printf("%d discs, %d orbs, %d frames\n", kNumDiscs, kNumDiscs * kOrbsPerDisc, frames);
+  printf("  all pairs %8.2f ms/frame\n", pairs_ns / 1e6);
+  printf("  grid      %8.2f ms/frame\n", grid_ns / 1e6);
+  printf("  speedup   %8.2fx\n", pairs_ns / grid_ns);
+  printf("  largest difference in position %g\n", max_diff);
+
+  // Speeds of 0, 8 and 400 units/s
+  static const double kSpeeds[] = {0, 8, 400};
+  static const char *kNames[] = {"at rest", "moving", "thrown"};
+  printf("Grid with %d fixed steps, then adaptive\n", Physics::kFixedSubsteps);
+  for (int i = 0; i < 3; ++i){
+    std::vector<Vector3d> fixed, adaptive;
+    double fixed_ns = run(true, false, kSpeeds[i], frames, fixed);
+    double adaptive_ns = run(true, true, kSpeeds[i], frames, adaptive);
+    printf("  %-8s %8.2f %8.2f ms/frame, escaped the walls %d %d\n", kNames[i],
+           fixed_ns / 1e6, adaptive_ns / 1e6, count_escaped(fixed), count_escaped(adaptive));
+  }
+
+  double objects_ns = run_orbs(false, frames);
+  double system_ns = run_orbs(true, frames);
+  printf("%d orbs around %d still discs\n", kCrowdAnchors * kCrowdOrbsPerAnchor, kCrowdAnchors);
+  printf("  objects   %8.2f ms/frame\n", objects_ns / 1e6);
+  printf("  OrbSystem %8.2f ms/frame\n", system_ns / 1e6);
+  printf("  speedup   %8.2fx\n", objects_ns / system_ns);
+  return 0;
+}
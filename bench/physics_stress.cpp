@@ -0,0 +1,264 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  physics_stress.cpp
+  Drops N discs, trailed by M orbs, onto a table at random from a seed and
+  runs the physics for a number of frames, without a window. Reports the
+  cost of a frame and of a step, and how often the engine tested pairs,
+  found them touching and bounced discs off the walls.
+
+  The path of every disc and orb can be recorded to a file, and a later
+  run can replay it: the same table is built from the seed in the file and
+  each frame is compared against the recording. Record with the engine as
+  it was and replay with a change to see whether the change moved
+  anything by more than the tolerance. The program exits with 1 if it did.
+
+  make bench
+  ./physics_stress [--discs N] [--orbs M] [--frames F] [--seed S]
+                   [--fixed] [--all-pairs] [--threads T] [--restart]
+                   [--record FILE | --replay FILE [--tolerance T]]
+
+  --fixed      takes the fixed number of steps with no sleeping
+  --all-pairs  tests every pair of discs instead of using the grid
+  --threads    splits each step between T threads. Any number above one
+               gives the same paths, so a recording made with one such
+               number replays exactly with another
+  --restart    stops the threads halfway through and starts them again,
+               which must not change the paths either
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "Physics.h"
+#include "OrbSystem.h"
+#include "bench_disc.h"
+#include "bench_time.h"
+
+static const double kRadius = 1.15;
+// Table space per disc, so that the crowding is the same at any size
+static const double kAreaPerDisc = 16;
+// The table in the program is this wide, smaller scenes use it as is
+static const double kMinWorldSize = 30;
+static const double kMaxSpeed = 8; // units/s
+static const int kPlacementTries = 1000;
+static const double kFrameTime = 1 / 60.0; // seconds
+static const char kMagic[8] = {'C', 'F', 'X', 'T', 'R', 'A', 'J', '1'};
+
+// What a recording holds before its frames
+struct Header {
+  char magic[8];
+  int discs, orbs, frames;
+  unsigned int seed;
+};
+
+// A uniform random number in [-0.5, 0.5)
+static double centered(){
+  return rand() / (RAND_MAX + 1.0) - 0.5;
+}
+
+// The table, built the same way from the same seed
+class Scene {
+public:
+  Scene(int discs, int orbs, unsigned int seed){
+    srand(seed);
+    double size = fmax(kMinWorldSize, sqrt(discs * kAreaPerDisc));
+    Physics::set_bounds(size, size, 0, 0);
+    for (int i = 0; i < discs; ++i){
+      for (int t = 0; t < kPlacementTries; ++t){
+        double x = size * centered(), y = size * centered();
+        if (!Physics::is_clear_area(x, y, kRadius)) continue;
+        BenchDisc *d = new BenchDisc(x, y, 2 * kMaxSpeed * centered(), 2 * kMaxSpeed * centered(), kRadius);
+        Physics::give_physics(d);
+        discs_.push_back(d);
+        break;
+      }
+    }
+    if (discs_.size() < discs){
+      printf("Only %d of %d discs fit on the table\n", static_cast<int>(discs_.size()), discs);
+    }
+    // Dealt out to the discs in turn, the way discs are handed new orbs
+    orbs_.resize(discs_.empty() ? 0 : orbs);
+    for (int i = 0; i < orbs_.size(); ++i){
+      OrbSystem::add(&orbs_[i], &discs_[i % discs_.size()]->pos_, 2 * kRadius);
+    }
+  }
+
+  ~Scene(){
+    while (OrbSystem::size() > 0) OrbSystem::remove(OrbSystem::size() - 1);
+    for (int i = 0; i < discs_.size(); ++i){
+      Physics::take_physics(discs_[i]);
+      delete discs_[i];
+    }
+  }
+
+  int num_discs(){ return discs_.size(); }
+  int num_orbs(){ return orbs_.size(); }
+
+  // Every position in the scene, discs then orbs. Orbs are kept in floats,
+  // so they are written as floats
+  void capture(std::vector<double> &discs, std::vector<float> &orbs){
+    discs.resize(2 * discs_.size());
+    for (int i = 0; i < discs_.size(); ++i){
+      discs[2 * i] = discs_[i]->pos_.x;
+      discs[2 * i + 1] = discs_[i]->pos_.y;
+    }
+    orbs.resize(3 * orbs_.size());
+    for (int i = 0; i < orbs_.size(); ++i){
+      double x, y, z;
+      OrbSystem::get_position(orbs_[i], x, y, z);
+      orbs[3 * i] = x;
+      orbs[3 * i + 1] = y;
+      orbs[3 * i + 2] = z;
+    }
+  }
+
+private:
+  std::vector<BenchDisc *> discs_;
+  std::vector<int> orbs_;
+};
+
+// Opens a recording and checks that it is one. Returns NULL on failure
+static FILE *open_replay(const char *path, Header &header){
+  FILE *f = fopen(path, "rb");
+  if (f == NULL){
+    printf("Could not open %s\n", path);
+    return NULL;
+  }
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, kMagic, sizeof(kMagic)) != 0){
+    printf("%s is not a recording\n", path);
+    fclose(f);
+    return NULL;
+  }
+  return f;
+}
+
+int main(int argc, char *argv[]){
+  int discs = 200, orbs = 1000, frames = 600;
+  unsigned int seed = 1;
+  bool fixed = false, all_pairs = false, restart = false;
+  int threads = 1;
+  const char *record_path = NULL, *replay_path = NULL;
+  double tolerance = 1e-9;
+  for (int i = 1; i < argc; ++i){
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--discs") == 0 && has_value) discs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--orbs") == 0 && has_value) orbs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--frames") == 0 && has_value) frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--seed") == 0 && has_value) seed = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--fixed") == 0) fixed = true;
+    else if (strcmp(argv[i], "--all-pairs") == 0) all_pairs = true;
+    else if (strcmp(argv[i], "--threads") == 0 && has_value) threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--restart") == 0) restart = true;
+    else if (strcmp(argv[i], "--record") == 0 && has_value) record_path = argv[++i];
+    else if (strcmp(argv[i], "--replay") == 0 && has_value) replay_path = argv[++i];
+    else if (strcmp(argv[i], "--tolerance") == 0 && has_value) tolerance = atof(argv[++i]);
+    else {
+      printf("Unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  // A replay takes its table from the recording
+  Header header;
+  FILE *replay = NULL;
+  if (replay_path != NULL){
+    replay = open_replay(replay_path, header);
+    if (replay == NULL) return 2;
+    discs = header.discs;
+    orbs = header.orbs;
+    frames = header.frames;
+    seed = header.seed;
+  }
+
+  Physics::set_broad_phase(!all_pairs);
+  Physics::set_adaptive(!fixed);
+  threads = Physics::set_threads(threads);
+  Scene scene(discs, orbs, seed);
+  if (replay != NULL && (scene.num_discs() != header.discs || scene.num_orbs() != header.orbs)){
+    printf("The table came out differently from the recording\n");
+    return 1;
+  }
+
+  FILE *record = NULL;
+  if (record_path != NULL){
+    record = fopen(record_path, "wb");
+    if (record == NULL){
+      printf("Could not open %s\n", record_path);
+      return 2;
+    }
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.discs = scene.num_discs();
+    header.orbs = scene.num_orbs();
+    header.frames = frames;
+    header.seed = seed;
+    fwrite(&header, sizeof(header), 1, record);
+  }
+
+  std::vector<double> disc_pos, disc_expected;
+  std::vector<float> orb_pos, orb_expected;
+  double disc_error = 0, orb_error = 0;
+  int first_bad_frame = -1;
+  double elapsed = 0;
+  Physics::reset_stats();
+  for (int f = 0; f < frames; ++f){
+    if (restart && f == frames / 2){
+      Physics::set_threads(1);
+      Physics::set_threads(threads);
+    }
+    double start = now_ns();
+    Physics::update(kFrameTime);
+    elapsed += now_ns() - start;
+
+    if (record == NULL && replay == NULL) continue;
+    scene.capture(disc_pos, orb_pos);
+    if (record != NULL){
+      fwrite(&disc_pos[0], sizeof(double), disc_pos.size(), record);
+      fwrite(&orb_pos[0], sizeof(float), orb_pos.size(), record);
+    }
+    if (replay != NULL){
+      disc_expected.resize(disc_pos.size());
+      orb_expected.resize(orb_pos.size());
+      if (fread(&disc_expected[0], sizeof(double), disc_expected.size(), replay) != disc_expected.size() ||
+          fread(&orb_expected[0], sizeof(float), orb_expected.size(), replay) != orb_expected.size()){
+        printf("The recording ends at frame %d\n", f);
+        return 1;
+      }
+      double worst = 0;
+      for (int i = 0; i < disc_pos.size(); ++i){
+        disc_error = fmax(disc_error, fabs(disc_pos[i] - disc_expected[i]));
+        worst = fmax(worst, fabs(disc_pos[i] - disc_expected[i]));
+      }
+      for (int i = 0; i < orb_pos.size(); ++i){
+        orb_error = fmax(orb_error, fabs(orb_pos[i] - orb_expected[i]));
+        worst = fmax(worst, fabs(orb_pos[i] - orb_expected[i]));
+      }
+      if (worst > tolerance && first_bad_frame < 0) first_bad_frame = f;
+    }
+  }
+  if (record != NULL) fclose(record);
+  if (replay != NULL) fclose(replay);
+
+  const Physics::Stats &stats = Physics::stats();
+  printf("%d discs, %d orbs, %d frames, seed %u, %d thread%s%s%s\n", scene.num_discs(), scene.num_orbs(), frames, seed,
+         threads, threads == 1 ? "" : "s", fixed ? ", fixed steps" : "", all_pairs ? ", all pairs" : "");
+  if (restart) printf("  restarted the threads at frame %d\n", frames / 2);
+  printf("  %10.0f ns/frame\n", elapsed / frames);
+  printf("  %10.0f ns/step, %.1f steps/frame\n", elapsed / fmax(1, stats.steps), stats.steps / (1.0 * frames));
+  printf("  %10ld collide calls, %ld contacts\n", stats.collide_calls, stats.contacts);
+  printf("  %10ld wall hits\n", stats.wall_hits);
+  if (record != NULL) printf("Recorded to %s\n", record_path);
+  if (replay != NULL){
+    printf("Replayed %s\n", replay_path);
+    printf("  largest difference: discs %g, orbs %g\n", disc_error, orb_error);
+    if (first_bad_frame >= 0){
+      printf("  beyond the tolerance of %g from frame %d\n", tolerance, first_bad_frame);
+      return 1;
+    }
+    printf("  within the tolerance of %g\n", tolerance);
+  }
+  Physics::set_threads(1);
+  return 0;
+}
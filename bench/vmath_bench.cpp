@@ -0,0 +1,167 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  vmath_bench.cpp
+  Times the vector math over arrays of vectors: lengths, normalizing and
+  dot products of Vector2f and Vector4f, once through vmath one vector at
+  a time and once through VectorSimd. Vector3d, which the physics uses
+  now, is timed alongside for reference. Reports the cost of a vector
+  for each, and the largest difference between the two answers, which
+  should be nothing.
+
+  make bench
+  ./vmath_bench [vectors] [passes]
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "vmath_simd.h"
+#include "bench_time.h"
+
+// A uniform random number in [-1, 1)
+static float centered(){
+  return 2 * (rand() / (RAND_MAX + 1.0)) - 1;
+}
+
+// The largest difference between two arrays of floats
+static float largest_difference(const float *a, const float *b, int n){
+  float worst = 0;
+  for (int i = 0; i < n; ++i) worst = fmaxf(worst, fabsf(a[i] - b[i]));
+  return worst;
+}
+
+static void report(const char *name, double scalar_ns, double simd_ns, int work, float difference){
+  printf("  %-16s %7.2f ns  %7.2f ns  %5.2fx   %g\n", name, scalar_ns / work, simd_ns / work,
+         scalar_ns / simd_ns, difference);
+}
+
+int main(int argc, char *argv[]){
+  int n = argc > 1 ? atoi(argv[1]) : 4096;
+  int passes = argc > 2 ? atoi(argv[2]) : 2000;
+  if (n <= 0 || passes <= 0){
+    printf("Usage: vmath_bench [vectors] [passes]\n");
+    return 2;
+  }
+  int work = n * passes;
+
+  srand(1);
+  std::vector<Vector2f> a2(n), b2(n);
+  std::vector<Vector4f> a4(n), b4(n);
+  std::vector<Vector3d> a3(n), b3(n);
+  for (int i = 0; i < n; ++i){
+    a2[i] = Vector2f(centered(), centered());
+    b2[i] = Vector2f(centered(), centered());
+    a4[i] = Vector4f(centered(), centered(), centered(), centered());
+    b4[i] = Vector4f(centered(), centered(), centered(), centered());
+    a3[i] = Vector3d(a2[i].x, a2[i].y, 0);
+    b3[i] = Vector3d(b2[i].x, b2[i].y, 0);
+  }
+  std::vector<float> scalar(n), simd(n);
+  std::vector<double> reference(n);
+  double start, scalar_ns, simd_ns;
+
+  printf("%d vectors, %d passes\n", n, passes);
+  printf("  %-16s %10s  %10s  %6s   %s\n", "per vector", "vmath", "simd", "", "difference");
+
+  // Vector3d, as the physics has it
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) reference[i] = a3[i].length();
+  }
+  double double_ns = now_ns() - start;
+  printf("  %-16s %7.2f ns\n", "Vector3d length", double_ns / work);
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) reference[i] = a3[i].dotProduct(b3[i]);
+  }
+  double_ns = now_ns() - start;
+  printf("  %-16s %7.2f ns\n", "Vector3d dot", double_ns / work);
+
+  // Vector2f
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) scalar[i] = a2[i].length();
+  }
+  scalar_ns = now_ns() - start;
+  start = now_ns();
+  for (int p = 0; p < passes; ++p) VectorSimd::lengths(&a2[0], &simd[0], n);
+  simd_ns = now_ns() - start;
+  report("Vector2f length", scalar_ns, simd_ns, work, largest_difference(&scalar[0], &simd[0], n));
+
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) scalar[i] = a2[i].x*b2[i].x + a2[i].y*b2[i].y;
+  }
+  scalar_ns = now_ns() - start;
+  start = now_ns();
+  for (int p = 0; p < passes; ++p) VectorSimd::dots(&a2[0], &b2[0], &simd[0], n);
+  simd_ns = now_ns() - start;
+  report("Vector2f dot", scalar_ns, simd_ns, work, largest_difference(&scalar[0], &simd[0], n));
+
+  // Normalized in place, over and over, from the same start
+  std::vector<Vector2f> s2(a2), v2(a2);
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) s2[i].normalize();
+  }
+  scalar_ns = now_ns() - start;
+  start = now_ns();
+  for (int p = 0; p < passes; ++p) VectorSimd::normalize(&v2[0], n);
+  simd_ns = now_ns() - start;
+  report("Vector2f normal", scalar_ns, simd_ns, work,
+         largest_difference(&s2[0].x, &v2[0].x, 2 * n));
+
+  // Vector4f
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) scalar[i] = a4[i].length();
+  }
+  scalar_ns = now_ns() - start;
+  start = now_ns();
+  for (int p = 0; p < passes; ++p) VectorSimd::lengths(&a4[0], &simd[0], n);
+  simd_ns = now_ns() - start;
+  report("Vector4f length", scalar_ns, simd_ns, work, largest_difference(&scalar[0], &simd[0], n));
+
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) scalar[i] = a4[i].x*b4[i].x + a4[i].y*b4[i].y + a4[i].z*b4[i].z + a4[i].w*b4[i].w;
+  }
+  scalar_ns = now_ns() - start;
+  start = now_ns();
+  for (int p = 0; p < passes; ++p) VectorSimd::dots(&a4[0], &b4[0], &simd[0], n);
+  simd_ns = now_ns() - start;
+  report("Vector4f dot", scalar_ns, simd_ns, work, largest_difference(&scalar[0], &simd[0], n));
+
+  std::vector<Vector4f> s4(a4), v4(a4);
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) s4[i].normalize();
+  }
+  scalar_ns = now_ns() - start;
+  start = now_ns();
+  for (int p = 0; p < passes; ++p) VectorSimd::normalize(&v4[0], n);
+  simd_ns = now_ns() - start;
+  report("Vector4f normal", scalar_ns, simd_ns, work,
+         largest_difference(&s4[0].x, &v4[0].x, 4 * n));
+
+  // One vector at a time, each in a register of its own
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) scalar[i] = a4[i].length();
+  }
+  scalar_ns = now_ns() - start;
+  start = now_ns();
+  for (int p = 0; p < passes; ++p){
+    for (int i = 0; i < n; ++i) simd[i] = VectorSimd::length(a4[i]);
+  }
+  simd_ns = now_ns() - start;
+  report("Vector4f single", scalar_ns, simd_ns, work, largest_difference(&scalar[0], &simd[0], n));
+
+  // Keeps the reference loops from being thrown away
+  double checksum = 0;
+  for (int i = 0; i < n; ++i) checksum += reference[i];
+  printf("(checksum %g)\n", checksum);
+  return 0;
+}
@@ -171,6 +171,15 @@ void ClassicWaveform::set_release(double seconds){
   release_samples_ = sample_rate_ * seconds;
 }
 
+// Changes the sample rate, keeping the envelope times the same
+void ClassicWaveform::set_sample_rate(int sample_rate){
+  double ratio = sample_rate / (1.0 * sample_rate_);
+  attack_samples_ = attack_samples_ * ratio;
+  sustain_samples_ = sustain_samples_ * ratio;
+  release_samples_ = release_samples_ * ratio;
+  sample_rate_ = sample_rate;
+}
+
 // #------------------Waveform Functions-----------------#  
 
 // A rectangular pulse is generated with high value of 1 and low value of -1. 
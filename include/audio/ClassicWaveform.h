@@ -51,6 +51,9 @@ public:
   void set_sustain(double seconds);
   void set_release(double seconds);
 
+  // Changes the sample rate, keeping the envelope times the same
+  void set_sample_rate(int sample_rate);
+
 private:
   // Gets the next sample for a single note
   double next_sample(Note *n);
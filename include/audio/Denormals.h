@@ -0,0 +1,92 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  Denormals.h
+  Keeps subnormal numbers out of the audio path. When the input stops, the
+  feedback in the filters, delays and reverb decays towards zero and passes
+  through the subnormal range, where x86 processors slow down dramatically.
+  The audio thread turns on flush-to-zero/denormals-are-zero where the
+  hardware supports it. Elsewhere, DENORMAL_GUARD flushes the values stored
+  in recursive structures in software.
+*/
+
+#ifndef _DENORMALS_H_
+#define _DENORMALS_H_
+
+#include <stdint.h>
+#include "complex.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+  #include <xmmintrin.h>
+  #define HAS_FLUSH_TO_ZERO
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__))
+  #define HAS_FLUSH_TO_ZERO
+#endif
+
+// The software guard is used when the hardware can't flush subnormals. It
+// can also be forced on with -DUSE_DENORMAL_GUARD
+#if !defined(HAS_FLUSH_TO_ZERO) && !defined(USE_DENORMAL_GUARD)
+  #define USE_DENORMAL_GUARD
+#endif
+
+// Far above the subnormal range of both floats and doubles, far below
+// anything audible
+static const double kDenormalOffset = 1e-18;
+
+// Flushes tiny values to zero without branching. Adding the offset rounds
+// away anything below about 1e-34, removing it leaves the rest unchanged
+inline double flush_denormal(double x){
+  x += kDenormalOffset;
+  return x - kDenormalOffset;
+}
+
+inline complex flush_denormal(const complex &x){
+  return complex(flush_denormal(x.re()), flush_denormal(x.im()));
+}
+
+#ifdef USE_DENORMAL_GUARD
+  #define DENORMAL_GUARD(x) flush_denormal(x)
+#else
+  #define DENORMAL_GUARD(x) (x)
+#endif
+
+// Turns on flush-to-zero and denormals-are-zero for the calling thread.
+// Returns false if the platform supports neither
+inline bool enable_flush_to_zero(){
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+  // FTZ is bit 15 and DAZ is bit 6 of the MXCSR register
+  _mm_setcsr(_mm_getcsr() | 0x8040);
+  return true;
+#elif defined(__aarch64__)
+  // FZ is bit 24 of the FPCR register, it covers both inputs and outputs
+  uint64_t fpcr;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));
+  return true;
+#elif defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+  uint32_t fpscr;
+  __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+  __asm__ __volatile__("vmsr fpscr, %0" : : "r"(fpscr | (1 << 24)));
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Restores gradual underflow for the calling thread
+inline void disable_flush_to_zero(){
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+  _mm_setcsr(_mm_getcsr() & ~0x8040);
+#elif defined(__aarch64__)
+  uint64_t fpcr;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr & ~(1 << 24)));
+#elif defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+  uint32_t fpscr;
+  __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+  __asm__ __volatile__("vmsr fpscr, %0" : : "r"(fpscr & ~(1 << 24)));
+#endif
+}
+
+#endif
@@ -31,43 +31,18 @@ void DigitalFilter::set_sample_rate(int sr){
   DigitalFilter::sample_rate = sr;
 }
 
-void DigitalFilter::update_coefficients(){
-  now_a_[0] += (a_[0] - now_a_[0])*tau_;
-  now_a_[1] += (a_[1] - now_a_[1])*tau_;
-  now_a_[2] += (a_[2] - now_a_[2])*tau_;
-  now_b_[0] += (b_[0] - now_b_[0])*tau_;
-  now_b_[1] += (b_[1] - now_b_[1])*tau_;
-  now_b_[2] += (b_[2] - now_b_[2])*tau_;
-}
-
-
-//Advances the filter by a single sample, in.
-complex DigitalFilter::tick(complex in) {
-  update_coefficients();
-  x_past_[2] = x_past_[1];
-  x_past_[1] = x_past_[0];
-  x_past_[0] = in;
-  y_past_[2] = y_past_[1];
-  y_past_[1] = y_past_[0];
-
-  y_past_[0] = -now_a_[1] * y_past_[1] - now_a_[2] * y_past_[2]
-      + (now_b_[0] * x_past_[0] + now_b_[1] * x_past_[1] + now_b_[2] * x_past_[2]);
-  
-  return most_recent_sample();
+// Recomputes the coefficients for the current sample rate and jumps
+// straight to them. The history of the filter is cleared.
+void DigitalFilter::reset_coefficients(){
+  calculate_coefficients();
+  for (int i = 0; i < 3; ++i){
+    now_a_[i] = a_[i];
+    now_b_[i] = b_[i];
+    x_past_[i] = 0;
+    y_past_[i] = 0;
+  }
 }
 
-//Gets the current output of the filter.
-complex DigitalFilter::most_recent_sample() {
-  return y_past_[0] * gain_;
-}
-
-//Calculates the DC gain of the system.
-double DigitalFilter::dc_gain() {
-  return fabs((b_[0] + b_[1] + b_[2]) / (a_[0] + a_[1] + a_[2]));
-}
-double DigitalFilter::hf_gain() {
-  return fabs(((b_[0] - b_[1] + b_[2]) / (a_[0] - a_[1] + a_[2])));
-}
 
 DigitalFilter* DigitalFilter::create_inverse(){
   double a[] = {b_[0], b_[1], b_[2]};
@@ -101,6 +76,22 @@ void DigitalFilter::set_state(DigitalFilterState *d){
   delete d;
 }
 
+// Copies the coefficients and the history into a biquad that scales its
+// output by gain. The signal is real, so the imaginary parts are dropped
+bool DigitalFilter::load_biquad(Biquad &b, double gain){
+  b.b0 = now_b_[0]; b.b1 = now_b_[1]; b.b2 = now_b_[2];
+  b.a1 = now_a_[1]; b.a2 = now_a_[2];
+  b.gain = gain * gain_;
+  b.x1 = x_past_[0].re(); b.x2 = x_past_[1].re();
+  b.y1 = y_past_[0].re(); b.y2 = y_past_[1].re();
+  return is_settled();
+}
+
+// Takes the history back after the biquad has run
+void DigitalFilter::store_biquad(const Biquad &b){
+  x_past_[0] = b.x1; x_past_[1] = b.x2; x_past_[2] = 0;
+  y_past_[0] = b.y1; y_past_[1] = b.y2; y_past_[2] = 0;
+}
 
 
 void DigitalBandpassFilter::calculate_coefficients() {
@@ -221,15 +212,6 @@ FilteredFeedbackCombFilter::~FilteredFeedbackCombFilter(){
   delete sp_;
 }
 
-// Computes a new value and adds it to a sample from the filtered delay line
-complex FilteredFeedbackCombFilter::tick(complex in){
-  complex out = in + roomsize_ * sp_->tick(buffer_[buf_index_]);
-  buffer_[buf_index_] = out;
-  ++buf_index_;
-  buf_index_ %= samples_;
-  return out;    
-}
-
 void FilteredFeedbackCombFilter::change_parameters(int samples, double roomsize, double damping){
   samples_ = samples; 
   roomsize_ = roomsize;
@@ -258,16 +240,6 @@ AllpassApproximationFilter::~AllpassApproximationFilter(){
   delete[] input_buffer_;
 }
 
-// Computes a new value and adds it to a sample from the filtered delay line
-complex AllpassApproximationFilter::tick(complex in){
-  complex out = g_ * output_buffer_[buf_index_] - in + (1+g_) * input_buffer_[buf_index_];
-  input_buffer_[buf_index_] = in;
-  output_buffer_[buf_index_] = out;
-  ++buf_index_;
-  buf_index_ %= samples_;
-  return out;    
-}
-
 // Stores the most recent values in the filter so that the state of the 
 // filter can be restored later
 DigitalFilterState* AllpassApproximationFilter::get_state(){
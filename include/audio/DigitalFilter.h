@@ -10,6 +10,7 @@
 
 #include <list>
 #include "complex.h"
+#include "Denormals.h"
 #include <iostream>
 
 
@@ -26,6 +27,22 @@
                   H. K. Kwan
 */
 
+// A real valued second order section. A chain of these runs several
+// filters in one pass, without the complex arithmetic or the coefficient
+// gliding. The output is scaled by gain
+struct Biquad{
+  double b0, b1, b2, a1, a2;
+  double gain;
+  double x1, x2, y1, y2;
+
+  inline double tick(double x){
+    double y = DENORMAL_GUARD(b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2);
+    x2 = x1; x1 = x;
+    y2 = y1; y1 = y;
+    return gain * y;
+  }
+};
+
 class DigitalFilterState{
 public:
   DigitalFilterState(){}
@@ -36,6 +53,9 @@ public:
 
 class DigitalFilter {
  public:
+  // Relative difference at which gliding coefficients count as arrived
+  static const double kSettledTolerance = 1e-9;
+
   //Creates a generic filter with no history or previous input
   DigitalFilter(double a[3], double b[3]);//Pick coefficents directly
   DigitalFilter(double center_frequency, double Q, double gain);
@@ -54,6 +74,10 @@ class DigitalFilter {
   
   // When changing coefficients over time, we update using this.
   void update_coefficients();
+
+  // Recomputes the coefficients for the current sample rate and jumps
+  // straight to them. The history of the filter is cleared.
+  void reset_coefficients();
     
   // Calculates the gain of the system at frequency zero. Good for 
   // normalizing with high Q or extreme corner frequency values.
@@ -74,6 +98,15 @@ class DigitalFilter {
   virtual DigitalFilterState* get_state();
   virtual void set_state(DigitalFilterState *d);
 
+  // True once the coefficients have finished gliding to their targets
+  bool is_settled();
+
+  // Copies the coefficients and the history into a biquad that scales its
+  // output by gain. Returns false if the coefficients are still gliding
+  bool load_biquad(Biquad &b, double gain);
+  // Takes the history back after the biquad has run
+  void store_biquad(const Biquad &b);
+
  private:
   void force_coefficients(double a[3], double b[3]){
     a_[0] = a[0]; b_[0] = b[0];
@@ -278,4 +311,84 @@ class FilterBank {
 };
 
 
+// The per-sample work is defined here rather than in DigitalFilter.cpp so
+// that it can be inlined wherever the type of the filter is known
+
+// True once the coefficients have finished gliding to their targets. The
+// glide only approaches them, so this allows for a tiny difference
+inline bool DigitalFilter::is_settled(){
+  for (int i = 0; i < 3; ++i){
+    if (fabs(now_a_[i] - a_[i]) > kSettledTolerance * (1 + fabs(a_[i]))) return false;
+    if (fabs(now_b_[i] - b_[i]) > kSettledTolerance * (1 + fabs(b_[i]))) return false;
+  }
+  return true;
+}
+
+// Glides toward the target coefficients. Once they are close enough to
+// count as settled they jump the rest of the way, so a filter run as a
+// biquad, which can't glide, has the same coefficients as one that ticks
+inline void DigitalFilter::update_coefficients(){
+  now_a_[0] += (a_[0] - now_a_[0])*tau_;
+  now_a_[1] += (a_[1] - now_a_[1])*tau_;
+  now_a_[2] += (a_[2] - now_a_[2])*tau_;
+  now_b_[0] += (b_[0] - now_b_[0])*tau_;
+  now_b_[1] += (b_[1] - now_b_[1])*tau_;
+  now_b_[2] += (b_[2] - now_b_[2])*tau_;
+  if (is_settled()){
+    for (int i = 0; i < 3; ++i){
+      now_a_[i] = a_[i];
+      now_b_[i] = b_[i];
+    }
+  }
+}
+
+//Advances the filter by a single sample, in.
+inline complex DigitalFilter::tick(complex in) {
+  update_coefficients();
+  x_past_[2] = x_past_[1];
+  x_past_[1] = x_past_[0];
+  x_past_[0] = in;
+  y_past_[2] = y_past_[1];
+  y_past_[1] = y_past_[0];
+
+  y_past_[0] = DENORMAL_GUARD(-now_a_[1] * y_past_[1] - now_a_[2] * y_past_[2]
+      + (now_b_[0] * x_past_[0] + now_b_[1] * x_past_[1] + now_b_[2] * x_past_[2]));
+  
+  return most_recent_sample();
+}
+
+//Gets the current output of the filter.
+inline complex DigitalFilter::most_recent_sample() {
+  return y_past_[0] * gain_;
+}
+
+//Calculates the DC gain of the system.
+inline double DigitalFilter::dc_gain() {
+  return fabs((b_[0] + b_[1] + b_[2]) / (a_[0] + a_[1] + a_[2]));
+}
+inline double DigitalFilter::hf_gain() {
+  return fabs(((b_[0] - b_[1] + b_[2]) / (a_[0] - a_[1] + a_[2])));
+}
+
+// Computes a new value and adds it to a sample from the filtered delay line.
+// The single pole doesn't override tick, so its call skips the vtable
+inline complex FilteredFeedbackCombFilter::tick(complex in){
+  complex out = DENORMAL_GUARD(in + roomsize_ * sp_->SinglePoleFilter::tick(buffer_[buf_index_]));
+  buffer_[buf_index_] = out;
+  ++buf_index_;
+  buf_index_ %= samples_;
+  return out;    
+}
+
+// Computes a new value and adds it to a sample from the filtered delay line
+inline complex AllpassApproximationFilter::tick(complex in){
+  complex out = DENORMAL_GUARD(g_ * output_buffer_[buf_index_] - in + (1+g_) * input_buffer_[buf_index_]);
+  input_buffer_[buf_index_] = in;
+  output_buffer_[buf_index_] = out;
+  ++buf_index_;
+  buf_index_ %= samples_;
+  return out;    
+}
+
+
 #endif /* DFILT_H_ */
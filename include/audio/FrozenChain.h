@@ -0,0 +1,198 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  FrozenChain.h
+  Runs a fixed series of effects as a single unit generator. The effects
+  are chosen at compile time and nested into a Series, for example
+
+    FrozenChain<Series<Distortion, Series<Filter, Series<Delay,
+                Series<Reverb> > > > >
+
+  Each effect is held by value and its tick is called directly rather than
+  through the vtable. A whole buffer runs in one loop with no graph walk
+  and no wet/dry buffers between the effects. Each effect still mixes its
+  input wet and dry the way the graph does between two discs, so a chain
+  sounds the same as the discs it stands in for. The chain is a unit
+  generator itself, so it can sit on a disc in the graph like any other
+  effect.
+*/
+
+#ifndef _FROZENCHAIN_H_
+#define _FROZENCHAIN_H_
+
+#include <vector>
+#include "UnitGenerator.h"
+
+// The end of a Series
+class ChainEnd {
+public:
+  static const int kLength = 0;
+
+  inline double tick(double in){ return in; }
+  UnitGenerator *stage(int i){ return NULL; }
+  void set_mix(int i, double wet_level){}
+  double mix(int i){ return 0; }
+};
+
+
+// An effect followed by the rest of the chain
+template <class Head, class Tail = ChainEnd>
+class Series {
+public:
+  static const int kLength = 1 + Tail::kLength;
+
+  // Fully wet, as between two discs that touch
+  Series() : wet_gain_(1), dry_gain_(0) {}
+
+  // The effect gets the wet part of the input and the dry part goes around
+  // it, as in UGenGraphBuilder::mix_inputs. The qualified call skips the
+  // vtable, the compiler knows which tick it is
+  inline double tick(double in){
+    return tail_.tick(head_.Head::tick(wet_gain_ * in) + dry_gain_ * in);
+  }
+
+  // The effect at position i, counting from zero. NULL past the end
+  UnitGenerator *stage(int i){ return i == 0 ? &head_ : tail_.stage(i - 1); }
+
+  // Sets how wet the input to the effect at position i is, from 0 to 1,
+  // as UGenGraphBuilder::compute_mix_level finds it for two discs. Each
+  // effect has a single input, so there is no fan out to scale by
+  void set_mix(int i, double wet_level){
+    if (i != 0){
+      tail_.set_mix(i - 1, wet_level);
+      return;
+    }
+    wet_gain_ = wet_level;
+    dry_gain_ = 1 - wet_level;
+  }
+  double mix(int i){ return i == 0 ? wet_gain_ : tail_.mix(i - 1); }
+
+private:
+  Head head_;
+  Tail tail_;
+  double wet_gain_, dry_gain_;
+};
+
+
+class FrozenChainState : public UGenState {
+public:
+  FrozenChainState(){}
+  // The states that were never recalled are freed here
+  ~FrozenChainState(){
+    for (int i = 0; i < states_.size(); ++i) delete states_[i];
+  }
+  std::vector<UGenState *> states_;
+};
+
+
+template <class Stages>
+class FrozenChain : public UnitGenerator {
+public:
+  FrozenChain(const char *name = "Frozen Chain"){
+    name_ = name;
+    param1_name_ = "Level";
+    param2_name_ = "Not Used";
+    set_limits(0, 2, 0, 1);
+    set_params(1, 0);
+    define_printouts(&param1_, "", NULL, "");
+    ugen_buffer_size_ = UnitGenerator::buffer_length;
+    ugen_buffer_ = new double[ugen_buffer_size_];
+    for (int i = 0; i < ugen_buffer_size_; i++){
+      ugen_buffer_[i] = 0;
+    }
+  }
+  ~FrozenChain(){}
+
+  // Processes a single sample through every effect
+  inline double tick(double in){ return param1_ * stages_.tick(in); }
+
+  // Runs the whole buffer in one loop
+  double *process_buffer(double *buffer, int length){
+    if (length != ugen_buffer_size_) printf("Buffer size mismatch! Input: %d  internal: %d\n", length, ugen_buffer_size_);
+    for (int i = 0; i < length; ++i){
+      ugen_buffer_[i] = param1_ * stages_.tick(buffer[i]);
+    }
+    return ugen_buffer_;
+  }
+
+  // The effect at position i, for setting its parameters. NULL past the end
+  UnitGenerator *stage(int i){ return stages_.stage(i); }
+  int num_stages(){ return Stages::kLength; }
+
+  // How wet the input to the effect at position i is, from 0 to 1. The
+  // first effect's mix comes on top of the graph's mix into the chain
+  void set_mix(int i, double wet_level){ stages_.set_mix(i, wet_level); }
+  double mix(int i){ return stages_.mix(i); }
+
+  void prepare(int bl, int sr){
+    UnitGenerator::prepare(bl, sr);
+    for (int i = 0; i < Stages::kLength; ++i) stage(i)->prepare(bl, sr);
+  }
+
+  bool is_input(){ return false; }
+  bool is_looper(){ return false; }
+  bool is_midi(){ return false; }
+
+  // The tails ring one after the other
+  int tail_length(){
+    int tail = 0;
+    for (int i = 0; i < Stages::kLength; ++i){
+      int t = stage(i)->tail_length();
+      if (t < 0) return -1;
+      tail += t;
+    }
+    return tail;
+  }
+
+  UGenState *save_state(){
+    FrozenChainState *s = new FrozenChainState();
+    for (int i = 0; i < Stages::kLength; ++i) s->states_.push_back(stage(i)->save_state());
+    return s;
+  }
+
+  void recall_state(UGenState *state){
+    FrozenChainState *s = static_cast<FrozenChainState *>(state);
+    // Each effect takes ownership of its own state
+    for (int i = 0; i < Stages::kLength; ++i){
+      stage(i)->recall_state(s->states_[i]);
+      s->states_[i] = NULL;
+    }
+    delete state;
+  }
+
+  void write_session(SessionWriter &w){
+    UnitGenerator::write_session(w);
+    for (int i = 0; i < Stages::kLength; ++i){
+      stage(i)->write_session(w);
+      w.write_double(mix(i));
+    }
+  }
+
+  void read_session(SessionReader &r){
+    UnitGenerator::read_session(r);
+    for (int i = 0; i < Stages::kLength; ++i){
+      stage(i)->read_session(r);
+      set_mix(i, r.read_double());
+    }
+  }
+
+private:
+  Stages stages_;
+};
+
+
+// The chain the installations run behind their input
+typedef Series<Distortion, Series<Filter, Series<Delay, Series<Reverb> > > > PresetStages;
+
+class PresetChain : public FrozenChain<PresetStages> {
+public:
+  PresetChain() : FrozenChain<PresetStages>("Preset Chain") {
+    stage(0)->set_params(4.0, 0.3);
+    stage(1)->set_params(2500, 1.5);
+    stage(2)->set_params(0.35, 0.4);
+    stage(3)->set_params(0.8, 0.3);
+  }
+};
+
+#endif
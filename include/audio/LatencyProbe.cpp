@@ -0,0 +1,273 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  LatencyProbe.cpp
+  A diagnostic that measures the round trip latency and callback jitter.
+*/
+
+#include "LatencyProbe.h"
+
+// Seconds elapsed since the given time
+static double seconds_since(struct timeval &start){
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+LatencyProbe::LatencyProbe(Signal signal, int sample_rate, int buffer_frames){
+  sample_rate_ = sample_rate;
+  generate_signal(signal);
+
+  preroll_ = static_cast<int>(kPreroll * sample_rate_);
+  capture_length_ = signal_length_ + static_cast<int>(kMaxLatency * sample_rate_);
+  capture_ = new double[capture_length_];
+  for (int i = 0; i < capture_length_; ++i) capture_[i] = 0;
+  position_ = 0;
+
+  stream_times_ = NULL;
+  wall_times_ = NULL;
+  set_buffer_frames(buffer_frames);
+  gettimeofday(&start_, NULL);
+}
+
+LatencyProbe::~LatencyProbe(){
+  delete[] signal_;
+  delete[] capture_;
+  delete[] stream_times_;
+  delete[] wall_times_;
+}
+
+// The device may settle on a different buffer size than was requested.
+// Must be called before the stream starts
+void LatencyProbe::set_buffer_frames(int buffer_frames){
+  buffer_frames_ = buffer_frames;
+  delete[] stream_times_;
+  delete[] wall_times_;
+  // Room for every callback of the run, plus a few extra
+  max_callbacks_ = (preroll_ + capture_length_) / buffer_frames_ + 16;
+  stream_times_ = new double[max_callbacks_];
+  wall_times_ = new double[max_callbacks_];
+  num_callbacks_ = 0;
+}
+
+// Called from the audio callback. Writes the test signal to every channel
+// of the interleaved output and records the mono input
+void LatencyProbe::process(const double *in, double *out, int frames, int out_channels,
+                           double stream_time){
+  if (num_callbacks_ < max_callbacks_){
+    stream_times_[num_callbacks_] = stream_time;
+    wall_times_[num_callbacks_] = seconds_since(start_);
+    ++num_callbacks_;
+  }
+
+  double sample;
+  long at;
+  for (int i = 0; i < frames; ++i){
+    at = position_ - preroll_;
+    sample = 0;
+    if (at >= 0 && at < signal_length_) sample = signal_[at];
+    for (int j = 0; j < out_channels; ++j){
+      out[i * out_channels + j] = sample;
+    }
+    if (at >= 0 && at < capture_length_ && in != NULL) capture_[at] = in[i];
+    ++position_;
+  }
+}
+
+// Cross correlates the recorded input with the test signal. Returns the
+// round trip latency in samples, or -1 if the signal was not found
+int LatencyProbe::find_latency(double &confidence){
+  int n = 1;
+  while (n < capture_length_ + signal_length_) n <<= 1;
+
+  // Correlation is done in the frequency domain
+  complex *a = new complex[n];
+  complex *b = new complex[n];
+  for (int i = 0; i < n; ++i){
+    a[i] = i < capture_length_ ? capture_[i] : 0;
+    b[i] = i < signal_length_ ? signal_[i] : 0;
+  }
+  CFFT::Forward(a, n);
+  CFFT::Forward(b, n);
+  for (int i = 0; i < n; ++i){
+    a[i] = a[i] * b[i].conjugate();
+  }
+  CFFT::Inverse(a, n);
+
+  // Only non-negative lags up to the maximum latency are meaningful
+  int max_lag = capture_length_ - signal_length_;
+  int best = 0;
+  double peak = 0, sum = 0, value;
+  for (int lag = 0; lag <= max_lag; ++lag){
+    value = fabs(a[lag].re());
+    sum += value * value;
+    if (value > peak){
+      peak = value;
+      best = lag;
+    }
+  }
+  delete[] a;
+  delete[] b;
+
+  double rms = sqrt(sum / (max_lag + 1));
+  confidence = rms > 0 ? peak / rms : 0;
+  if (confidence < kMinConfidence) return -1;
+  return best;
+}
+
+// Prints the latency and the callback jitter
+void LatencyProbe::report(){
+  printf("Latency test: %s, %d frames at %d Hz\n", signal_name_, buffer_frames_, sample_rate_);
+
+  double confidence;
+  int latency = find_latency(confidence);
+  if (latency < 0){
+    printf("  Round trip: signal not found (confidence %.1f)\n", confidence);
+    printf("  Is the output connected to the input?\n");
+  }
+  else {
+    printf("  Round trip: %d samples, %.2f ms (confidence %.1f)\n", latency,
+           1000.0 * latency / sample_rate_, confidence);
+  }
+
+  // The time between successive callbacks
+  if (num_callbacks_ < 2) return;
+  int num_deltas = num_callbacks_ - 1;
+  double *stream_deltas = new double[num_deltas];
+  double *wall_deltas = new double[num_deltas];
+  for (int i = 0; i < num_deltas; ++i){
+    stream_deltas[i] = 1000.0 * (stream_times_[i + 1] - stream_times_[i]);
+    wall_deltas[i] = 1000.0 * (wall_times_[i + 1] - wall_times_[i]);
+  }
+  printf("  Callback period: %.2f ms expected over %d callbacks\n",
+         1000.0 * buffer_frames_ / sample_rate_, num_callbacks_);
+  print_stats("stream time", stream_deltas, num_deltas);
+  print_stats("wall clock", wall_deltas, num_deltas);
+  delete[] stream_deltas;
+  delete[] wall_deltas;
+}
+
+// #------------- Private --------------#
+
+// Fills signal_ with the test signal
+void LatencyProbe::generate_signal(Signal signal){
+  if (signal == kImpulse){
+    signal_name_ = "impulse";
+    signal_length_ = 1;
+    signal_ = new double[signal_length_];
+    signal_[0] = 0.9;
+    return;
+  }
+
+  // Maximum length sequence from a linear feedback shift register with
+  // taps at 15 and 14
+  signal_name_ = "MLS";
+  signal_length_ = (1 << kMLSOrder) - 1;
+  signal_ = new double[signal_length_];
+  unsigned int reg = 1, bit;
+  for (int i = 0; i < signal_length_; ++i){
+    signal_[i] = (reg & 1) ? 0.5 : -0.5;
+    bit = ((reg >> 0) ^ (reg >> 1)) & 1;
+    reg = (reg >> 1) | (bit << (kMLSOrder - 1));
+  }
+}
+
+// Prints the min, mean, 99th percentile and max of the values
+void LatencyProbe::print_stats(const char *label, double *values, int length){
+  double *sorted = new double[length];
+  double sum = 0;
+  for (int i = 0; i < length; ++i){
+    sorted[i] = values[i];
+    sum += values[i];
+  }
+  std::sort(sorted, sorted + length);
+  int p99 = std::min(length - 1, static_cast<int>(ceil(0.99 * length)) - 1);
+  printf("  %-12s min %.3f  mean %.3f  p99 %.3f  max %.3f ms\n", label, sorted[0],
+         sum / length, sorted[p99], sorted[length - 1]);
+  delete[] sorted;
+}
+
+
+
+
+// #------------- LoopbackDevice --------------#
+
+LoopbackDevice::LoopbackDevice(int buffer_frames, int sample_rate, int latency_frames){
+  buffer_frames_ = buffer_frames;
+  sample_rate_ = sample_rate;
+  // The output of a buffer can't be heard until the next one
+  latency_frames_ = std::max(latency_frames, buffer_frames);
+  running_ = false;
+  in_ = NULL;
+  out_ = NULL;
+
+  line_size_ = 1;
+  while (line_size_ < latency_frames_ + buffer_frames_) line_size_ <<= 1;
+  line_ = new double[line_size_];
+  for (int i = 0; i < line_size_; ++i) line_[i] = 0;
+  written_ = 0;
+}
+
+LoopbackDevice::~LoopbackDevice(){
+  delete[] line_;
+}
+
+// Calls the callback once per buffer period until it returns nonzero or
+// stop() is called. Blocks until the device has stopped
+void LoopbackDevice::run(RtAudioCallback callback, void *data, int out_channels){
+  callback_ = callback;
+  data_ = data;
+  out_channels_ = out_channels;
+  in_ = new double[buffer_frames_];
+  out_ = new double[buffer_frames_ * out_channels_];
+  running_ = true;
+
+  // A Thread would be cancelled when it went out of scope, perhaps in the
+  // middle of a callback. This one is left to finish its block and joined
+  pthread_t device;
+  if (pthread_create(&device, NULL, &LoopbackDevice::device_thread, this) == 0){
+    pthread_join(device, NULL);
+  }
+  else printf("Could not start the loopback device\n");
+  running_ = false;
+  delete[] in_;
+  delete[] out_;
+  in_ = NULL;
+  out_ = NULL;
+}
+
+// The body of the device thread
+void *LoopbackDevice::device_thread(void *ptr){
+  LoopbackDevice *d = static_cast<LoopbackDevice *>(ptr);
+  double *in = d->in_;
+  double *out = d->out_;
+  int mask = d->line_size_ - 1;
+  double period = d->buffer_frames_ / (1.0 * d->sample_rate_);
+  long block = 0;
+
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  while (d->running_){
+    // Reads what was written latency_frames_ ago
+    long read = d->written_ - d->latency_frames_;
+    for (int i = 0; i < d->buffer_frames_; ++i){
+      in[i] = read + i >= 0 ? d->line_[(read + i) & mask] : 0;
+    }
+
+    double stream_time = block * period;
+    if (d->callback_(out, in, d->buffer_frames_, stream_time, 0, d->data_) != 0){
+      d->running_ = false;
+    }
+    for (int i = 0; i < d->buffer_frames_; ++i){
+      d->line_[(d->written_ + i) & mask] = out[i * d->out_channels_];
+    }
+    d->written_ += d->buffer_frames_;
+    ++block;
+
+    // Waits for the start of the next period
+    double wait = block * period - seconds_since(start);
+    if (wait > 0) usleep(static_cast<useconds_t>(wait * 1000000));
+  }
+  return NULL;
+}
@@ -0,0 +1,116 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  LatencyProbe.h
+  A diagnostic that plays a test signal through the output and listens for
+  it on the input to measure the round trip latency. The arrival time of
+  every callback is also logged so that the jitter can be reported. The
+  LoopbackDevice stands in for a sound card on machines without one.
+*/
+
+#ifndef _LATENCYPROBE_H_
+#define _LATENCYPROBE_H_
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <sys/time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "RtAudio.h"
+#include "complex.h"
+#include "fft.h"
+
+class LatencyProbe {
+public:
+  // An impulse is easy to see on a scope, the maximum length sequence
+  // survives noise and quiet inputs much better
+  enum Signal { kImpulse, kMLS };
+
+  static const int kMLSOrder = 15;
+  static const double kMaxLatency = 1.0; // s
+  static const double kPreroll = 0.25; // s
+  // Peak to RMS ratio of the correlation needed to trust the result
+  static const double kMinConfidence = 8.0;
+
+  LatencyProbe(Signal signal, int sample_rate, int buffer_frames);
+  ~LatencyProbe();
+
+  // Called from the audio callback. Writes the test signal to every channel
+  // of the interleaved output and records the mono input
+  void process(const double *in, double *out, int frames, int out_channels,
+               double stream_time);
+
+  // The device may settle on a different buffer size than was requested.
+  // Must be called before the stream starts
+  void set_buffer_frames(int buffer_frames);
+
+  // True once the signal has been played and enough input has been heard
+  bool is_finished(){ return position_ >= preroll_ + capture_length_; }
+
+  // Cross correlates the recorded input with the test signal. Returns the
+  // round trip latency in samples, or -1 if the signal was not found.
+  // confidence is set to the peak to RMS ratio of the correlation
+  int find_latency(double &confidence);
+
+  // Prints the latency and the callback jitter
+  void report();
+
+private:
+  // Fills signal_ with the test signal
+  void generate_signal(Signal signal);
+
+  // Prints the min, mean, 99th percentile and max of the values
+  void print_stats(const char *label, double *values, int length);
+
+  int sample_rate_, buffer_frames_;
+  const char *signal_name_;
+
+  double *signal_;
+  int signal_length_;
+  double *capture_;
+  int capture_length_;
+  int preroll_;
+  long position_;
+
+  // The time at which each callback arrived
+  double *stream_times_, *wall_times_;
+  int max_callbacks_, num_callbacks_;
+  struct timeval start_;
+};
+
+
+// Calls an audio callback in real time with its output fed back into its
+// input after a fixed delay, just like a cable from the output to the input
+class LoopbackDevice {
+public:
+  LoopbackDevice(int buffer_frames, int sample_rate, int latency_frames);
+  ~LoopbackDevice();
+
+  // Calls the callback once per buffer period until it returns nonzero or
+  // stop() is called. Blocks until the device thread has exited
+  void run(RtAudioCallback callback, void *data, int out_channels);
+  void stop(){ running_ = false; }
+
+private:
+  // The body of the device thread
+  static void *device_thread(void *ptr);
+
+  int buffer_frames_, sample_rate_, latency_frames_;
+  int out_channels_;
+  RtAudioCallback callback_;
+  void *data_;
+  volatile bool running_;
+  // The buffers handed to the callback. They belong to run(), which frees
+  // them once the device thread is done with them
+  double *in_, *out_;
+
+  // Carries the first output channel back to the input. The length is a
+  // power of two so that positions can be wrapped with a mask
+  double *line_;
+  int line_size_;
+  long written_;
+};
+
+#endif
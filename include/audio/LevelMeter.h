@@ -0,0 +1,72 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  LevelMeter.h
+  The peak and RMS level of a unit generator's latest buffer. The audio
+  thread writes the levels and the graphics thread reads them without
+  locking. A sequence number tells the reader when it caught a write
+  halfway through, so it can read again.
+*/
+
+#ifndef _LEVELMETER_H_
+#define _LEVELMETER_H_
+
+#include <cmath>
+
+class LevelMeter {
+public:
+  // How many times a reader tries before it gives up on a busy meter
+  static const int kMaxRetries = 8;
+
+  LevelMeter(){
+    sequence_ = 0;
+    peak_ = 0;
+    rms_ = 0;
+  }
+
+  // Measures a buffer and publishes its levels. Only one thread may write
+  void measure(const double *buffer, int length){
+    double peak = 0, sum = 0;
+    for (int i = 0; i < length; ++i){
+      peak = fmax(peak, fabs(buffer[i]));
+      sum += buffer[i] * buffer[i];
+    }
+    publish(peak, length > 0 ? sqrt(sum / length) : 0);
+  }
+
+  // An odd sequence number means a write is under way
+  void publish(double peak, double rms){
+    unsigned int s = __atomic_load_n(&sequence_, __ATOMIC_RELAXED);
+    __atomic_store_n(&sequence_, s + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&peak_, &peak, __ATOMIC_RELAXED);
+    __atomic_store(&rms_, &rms, __ATOMIC_RELAXED);
+    __atomic_store_n(&sequence_, s + 2, __ATOMIC_RELEASE);
+  }
+
+  // Copies out a pair of levels from the same buffer. Returns false, and
+  // leaves the arguments alone, if the writer kept getting in the way
+  bool read(double &peak, double &rms){
+    for (int i = 0; i < kMaxRetries; ++i){
+      unsigned int before = __atomic_load_n(&sequence_, __ATOMIC_ACQUIRE);
+      if (before & 1) continue;
+      double p, r;
+      __atomic_load(&peak_, &p, __ATOMIC_RELAXED);
+      __atomic_load(&rms_, &r, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&sequence_, __ATOMIC_RELAXED) == before){
+        peak = p;
+        rms = r;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  unsigned int sequence_;
+  double peak_, rms_;
+};
+
+#endif
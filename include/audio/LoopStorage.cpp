@@ -0,0 +1,411 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  LoopStorage.cpp
+  Memory and file backed storage for Looper recordings.
+*/
+
+#include "LoopStorage.h"
+
+const char *LoopStorage::directory_ = NULL;
+
+// Creates storage for a loop of the given number of samples, all zero
+LoopStorage *LoopStorage::create(int length){
+  // Loops that fit in the streaming window gain nothing from the file
+  int window = StreamingLoopStorage::kNumFrames * StreamingLoopStorage::kPageSize;
+  if (directory_ != NULL && length > window){
+    StreamingLoopStorage *s = new StreamingLoopStorage(length, directory_);
+    if (s->is_open()) return s;
+    delete s;
+    printf("Keeping the loop in memory instead\n");
+  }
+  return new MemoryLoopStorage(length);
+}
+
+
+
+
+// #------------- MemoryLoopStorage --------------#
+
+MemoryLoopStorage::MemoryLoopStorage(int length){
+  length_ = length;
+  samples_ = new float[length_];
+  clear();
+}
+
+MemoryLoopStorage::~MemoryLoopStorage(){
+  delete[] samples_;
+}
+
+// Zeros the whole loop
+void MemoryLoopStorage::clear(){
+  for (int i = 0; i < length_; ++i) samples_[i] = 0;
+}
+
+void MemoryLoopStorage::read_block(int start, int count, float *out){
+  for (int i = 0; i < count; ++i) out[i] = samples_[start + i];
+}
+
+void MemoryLoopStorage::write_block(int start, int count, const float *in){
+  for (int i = 0; i < count; ++i) samples_[start + i] = in[i];
+}
+
+// Everything is in memory, so nothing is left for later
+DeferredBlock *MemoryLoopStorage::copy_out(int start, int count, float *out){
+  read_block(start, count, out);
+  return NULL;
+}
+
+
+
+
+// #------------- StreamingLoopStorage --------------#
+
+// Passed by reference to std::min, so it needs storage of its own
+const int StreamingLoopStorage::kPageSize;
+
+// Creates a temporary file in the directory. Check is_open afterwards
+StreamingLoopStorage::StreamingLoopStorage(int length, const char *directory){
+  length_ = length;
+  num_pages_ = (length_ + kPageSize - 1) / kPageSize;
+  page_frame_ = new int[num_pages_];
+  stale_ = new bool[num_pages_];
+  for (int i = 0; i < num_pages_; ++i){
+    page_frame_[i] = -1;
+    stale_[i] = true;
+  }
+  for (int f = 0; f < kNumFrames; ++f){
+    frames_[f].page = -1;
+    frames_[f].state = kFree;
+    frames_[f].data = new float[kPageSize];
+    // The audio thread is the first to write most frames
+    Scheduling::prefault(frames_[f].data, kPageSize * sizeof(float));
+  }
+  // No page is where the heads are yet, so the first follow fetches them
+  read_page_ = -1;
+  write_page_ = -1;
+  since_maintain_ = 0;
+  clear_requested_ = 0;
+  running_ = false;
+  stopped_ = true;
+
+  // The file is unlinked right away so that it disappears with us. Its
+  // full size is reserved up front, so the disk can't fill up mid loop
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/collidefx-loop-XXXXXX", directory);
+  fd_ = mkstemp(path);
+  if (fd_ < 0){
+    printf("Could not create a loop file in %s\n", directory);
+    return;
+  }
+  unlink(path);
+  if (ftruncate(fd_, static_cast<off_t>(length_) * sizeof(float)) != 0){
+    printf("Could not reserve %d samples in %s\n", length_, directory);
+    close(fd_);
+    fd_ = -1;
+    return;
+  }
+
+  running_ = true;
+  stopped_ = false;
+  if (!io_.start(&StreamingLoopStorage::io_thread, this)){
+    running_ = false;
+    stopped_ = true;
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+StreamingLoopStorage::~StreamingLoopStorage(){
+  // Thread::wait cancels the thread, so we wait for it to finish on its own
+  running_ = false;
+  while (!stopped_) usleep(kPollInterval);
+  if (fd_ >= 0) close(fd_);
+  for (int f = 0; f < kNumFrames; ++f) delete[] frames_[f].data;
+  delete[] page_frame_;
+  delete[] stale_;
+}
+
+// Called from the audio thread. A sample that isn't in memory yet reads
+// as zero
+float StreamingLoopStorage::read(int index){
+  int f = page_frame_[index / kPageSize];
+  // A frame that was just stored still holds its page until the next
+  // maintain, only one that is still loading can't be read
+  if (f < 0 || get_state(f) == kLoading) return 0;
+  return frames_[f].data[index % kPageSize];
+}
+
+// Called from the audio thread. A write to a page that isn't in memory
+// yet is lost
+void StreamingLoopStorage::write(int index, float sample){
+  int f = page_frame_[index / kPageSize];
+  if (f < 0) return;
+  int state = get_state(f);
+  if (state == kReady) set_state(f, kDirty);
+  else if (state != kDirty) return;
+  frames_[f].data[index % kPageSize] = sample;
+}
+
+// Tells the storage where the heads are so that it can fetch ahead
+void StreamingLoopStorage::follow(int read, int write){
+  int r = std::min(read / kPageSize, num_pages_ - 1);
+  int w = std::min(write / kPageSize, num_pages_ - 1);
+  ++since_maintain_;
+  if (r != read_page_ || w != write_page_ || since_maintain_ >= kMaintainInterval
+      || __atomic_load_n(&clear_requested_, __ATOMIC_ACQUIRE)){
+    read_page_ = r;
+    write_page_ = w;
+    maintain();
+  }
+}
+
+// Zeros the whole loop. This may be called from any thread, the audio
+// thread does the work the next time it maintains the pages
+void StreamingLoopStorage::clear(){
+  __atomic_store_n(&clear_requested_, 1, __ATOMIC_RELEASE);
+}
+
+// Copies samples out, waiting for the disk if needed
+void StreamingLoopStorage::read_block(int start, int count, float *out){
+  wait_idle();
+  for (int i = 0; i < count; ){
+    int index = start + i;
+    int page = index / kPageSize;
+    int n = std::min(count - i, kPageSize - index % kPageSize);
+    int f = page_frame_[page];
+    if (f >= 0) memcpy(out + i, frames_[f].data + index % kPageSize, n * sizeof(float));
+    else if (stale_[page]) memset(out + i, 0, n * sizeof(float));
+    else if (pread(fd_, out + i, n * sizeof(float), static_cast<off_t>(index) * sizeof(float)) < 0){
+      memset(out + i, 0, n * sizeof(float));
+    }
+    i += n;
+  }
+}
+
+// Copies samples in, waiting for the disk if needed
+void StreamingLoopStorage::write_block(int start, int count, const float *in){
+  wait_idle();
+  for (int i = 0; i < count; ){
+    int index = start + i;
+    int page = index / kPageSize;
+    int n = std::min(count - i, kPageSize - index % kPageSize);
+    int f = page_frame_[page];
+    if (f >= 0){
+      memcpy(frames_[f].data + index % kPageSize, in + i, n * sizeof(float));
+      set_state(f, kDirty);
+    }
+    else {
+      // The rest of a cleared page has to be zeroed in the file too
+      if (stale_[page]){
+        Frame scratch;
+        scratch.page = page;
+        scratch.data = new float[kPageSize];
+        memset(scratch.data, 0, kPageSize * sizeof(float));
+        store_page(scratch);
+        delete[] scratch.data;
+        stale_[page] = false;
+      }
+      if (pwrite(fd_, in + i, n * sizeof(float), static_cast<off_t>(index) * sizeof(float)) < 0){
+        printf("Could not write to the loop file\n");
+      }
+    }
+    i += n;
+  }
+}
+
+// Copies the pages that are in memory and the cleared ones, and leaves
+// the rest to be read from the file later. Nothing is changed, so the I/O
+// thread can keep going meanwhile. A frame holds its page until the audio
+// thread frees it, whether or not it has been stored, only one that is
+// still loading doesn't
+DeferredBlock *StreamingLoopStorage::copy_out(int start, int count, float *out){
+  bool cleared = __atomic_load_n(&clear_requested_, __ATOMIC_ACQUIRE) != 0;
+  FileReader *reader = NULL;
+  for (int i = 0; i < count; ){
+    int index = start + i;
+    int page = index / kPageSize;
+    int n = std::min(count - i, kPageSize - index % kPageSize);
+    int f = page_frame_[page];
+    if (cleared || stale_[page]) memset(out + i, 0, n * sizeof(float));
+    else if (f >= 0 && get_state(f) != kLoading){
+      memcpy(out + i, frames_[f].data + index % kPageSize, n * sizeof(float));
+    }
+    else {
+      if (reader == NULL) reader = new FileReader(dup(fd_));
+      FileReader::Span span = {index, n, i};
+      reader->spans_.push_back(span);
+    }
+    i += n;
+  }
+  return reader;
+}
+
+// Fetches the pages around the heads and waits for them, so that a loop
+// restored from a file doesn't start out silent
+void StreamingLoopStorage::prefetch(int read, int write){
+  read_page_ = std::min(read / kPageSize, num_pages_ - 1);
+  write_page_ = std::min(write / kPageSize, num_pages_ - 1);
+  maintain();
+  wait_idle();
+}
+
+// #------------- Private --------------#
+
+// The body of the I/O thread
+THREAD_RETURN THREAD_TYPE StreamingLoopStorage::io_thread(void *ptr){
+  StreamingLoopStorage *s = static_cast<StreamingLoopStorage *>(ptr);
+  int f;
+  while (s->running_){
+    if (!s->requests_.pop(f)){
+      usleep(kPollInterval);
+      continue;
+    }
+    if (s->get_state(f) == kLoading){
+      s->load_page(s->frames_[f]);
+      s->set_state(f, kReady);
+    }
+    else {
+      s->store_page(s->frames_[f]);
+      s->set_state(f, kFree);
+    }
+  }
+  s->stopped_ = true;
+  return NULL;
+}
+
+// Reads the runs of samples that were only in the file. Anything that
+// can't be read is left as silence
+void StreamingLoopStorage::FileReader::finish(void *data){
+  float *out = static_cast<float *>(data);
+  for (int i = 0; i < spans_.size(); ++i){
+    const Span &s = spans_[i];
+    ssize_t got = fd_ < 0 ? -1 : pread(fd_, out + s.at, s.count * sizeof(float),
+                                      static_cast<off_t>(s.index) * sizeof(float));
+    if (got < 0) got = 0;
+    for (int j = got / sizeof(float); j < s.count; ++j) out[s.at + j] = 0;
+  }
+}
+
+// Reads a page of the file
+void StreamingLoopStorage::load_page(Frame &frame){
+  int samples = std::min(kPageSize, length_ - frame.page * kPageSize);
+  off_t offset = static_cast<off_t>(frame.page) * kPageSize * sizeof(float);
+  ssize_t got = pread(fd_, frame.data, samples * sizeof(float), offset);
+  if (got < 0) got = 0;
+  for (int i = got / sizeof(float); i < kPageSize; ++i) frame.data[i] = 0;
+}
+
+// Writes a page of the file
+void StreamingLoopStorage::store_page(Frame &frame){
+  int samples = std::min(kPageSize, length_ - frame.page * kPageSize);
+  off_t offset = static_cast<off_t>(frame.page) * kPageSize * sizeof(float);
+  if (pwrite(fd_, frame.data, samples * sizeof(float), offset) < 0){
+    printf("Could not write to the loop file\n");
+  }
+}
+
+// True if the page is near one of the heads. The page behind the write
+// head is kept too, a recalled state may move the head back onto it
+bool StreamingLoopStorage::is_needed(int page){
+  return is_read_window(page) || (page >= write_page_ - 1 && page <= write_page_ + 1);
+}
+
+// True if the page is one of the next few to be played. The loop wraps
+// around, so the first pages are fetched while the last ones play
+bool StreamingLoopStorage::is_read_window(int page){
+  return (page - read_page_ + num_pages_) % num_pages_ <= kReadAhead;
+}
+
+// Writes back and frees pages that aren't needed, then fetches the ones
+// that are. Called from the audio thread
+void StreamingLoopStorage::maintain(){
+  since_maintain_ = 0;
+  settle();
+
+  // Frees the pages that have fallen out of the window
+  for (int f = 0; f < kNumFrames; ++f){
+    int page = frames_[f].page;
+    if (page < 0 || is_needed(page)) continue;
+    int state = get_state(f);
+    if (state == kReady){
+      page_frame_[page] = -1;
+      frames_[f].page = -1;
+      set_state(f, kFree);
+    }
+    else if (state == kDirty){
+      set_state(f, kStoring);
+      if (!requests_.push(f)) set_state(f, kDirty);
+    }
+  }
+
+  // Fetches the pages that have come into the window. Pages that are only
+  // near the write head are about to be overwritten, so they aren't read
+  int candidates[kReadAhead + 3];
+  int num_candidates = 0;
+  for (int i = 0; i <= kReadAhead; ++i){
+    candidates[num_candidates++] = (read_page_ + i) % num_pages_;
+  }
+  candidates[num_candidates++] = write_page_;
+  if (write_page_ + 1 < num_pages_) candidates[num_candidates++] = write_page_ + 1;
+
+  int next_free = 0;
+  for (int i = 0; i < num_candidates; ++i){
+    int page = candidates[i];
+    if (page_frame_[page] >= 0) continue;
+    while (next_free < kNumFrames && frames_[next_free].page >= 0) ++next_free;
+    if (next_free == kNumFrames) return;
+
+    int f = next_free;
+    frames_[f].page = page;
+    page_frame_[page] = f;
+    if (is_read_window(page) && !stale_[page]){
+      set_state(f, kLoading);
+      if (!requests_.push(f)){
+        frames_[f].page = -1;
+        page_frame_[page] = -1;
+        set_state(f, kFree);
+      }
+    }
+    else zero_frame(f);
+  }
+}
+
+// Gives a frame to a page that will be overwritten, so it isn't loaded
+void StreamingLoopStorage::zero_frame(int frame){
+  memset(frames_[frame].data, 0, kPageSize * sizeof(float));
+  stale_[frames_[frame].page] = false;
+  set_state(frame, kDirty);
+}
+
+// Catches up with the I/O thread and with any clear. Pages that were
+// stored keep their samples, so they are simply marked ready
+void StreamingLoopStorage::settle(){
+  if (__atomic_exchange_n(&clear_requested_, 0, __ATOMIC_ACQ_REL)){
+    for (int p = 0; p < num_pages_; ++p) stale_[p] = true;
+  }
+  for (int f = 0; f < kNumFrames; ++f){
+    if (frames_[f].page < 0) continue;
+    int state = get_state(f);
+    if (state == kFree){
+      set_state(f, kReady);
+      state = kReady;
+    }
+    if ((state == kReady || state == kDirty) && stale_[frames_[f].page]) zero_frame(f);
+  }
+}
+
+// Waits until the I/O thread has finished every request
+void StreamingLoopStorage::wait_idle(){
+  bool busy = true;
+  while (busy){
+    busy = false;
+    for (int f = 0; f < kNumFrames; ++f){
+      int state = get_state(f);
+      if (state == kLoading || state == kStoring) busy = true;
+    }
+    if (busy) usleep(kPollInterval);
+  }
+  settle();
+}
@@ -0,0 +1,199 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  LoopStorage.h
+  Holds the samples of a Looper's recording. Short loops are kept in
+  memory. When a loop directory is given, long loops are kept in a file
+  instead and only a few pages around the read and write heads stay in
+  memory. A background thread moves pages to and from the file, the audio
+  thread never waits on the disk.
+*/
+
+#ifndef _LOOPSTORAGE_H_
+#define _LOOPSTORAGE_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "SessionFile.h"
+#include "SpscQueue.h"
+#include "Thread.h"
+#include "Scheduling.h"
+
+class LoopStorage {
+public:
+  virtual ~LoopStorage(){}
+
+  // Long loops are streamed to a file in this directory. Without one,
+  // every loop is kept in memory
+  static void set_directory(const char *path){ directory_ = path; }
+
+  // Creates storage for a loop of the given number of samples, all zero
+  static LoopStorage *create(int length);
+
+  int length(){ return length_; }
+
+  // Called from the audio thread. A sample that isn't in memory yet
+  // reads as zero and a write to it is lost
+  virtual float read(int index) = 0;
+  virtual void write(int index, float sample) = 0;
+
+  // Tells the storage where the heads are so that it can fetch ahead.
+  // Called from the audio thread
+  virtual void follow(int read, int write){}
+
+  // Zeros the whole loop
+  virtual void clear() = 0;
+
+  // Copies samples in or out, waiting for the disk if needed. Only for use
+  // while the audio thread is not running
+  virtual void read_block(int start, int count, float *out) = 0;
+  virtual void write_block(int start, int count, const float *in) = 0;
+
+  // Copies samples out without waiting for the disk, for use while the
+  // audio thread waits. What is only in the file is left to the returned
+  // block, which reads it later from any thread, even once the storage is
+  // gone. Returns NULL if everything was copied
+  virtual DeferredBlock *copy_out(int start, int count, float *out) = 0;
+
+  // Fetches the pages around the heads and waits for them. Only for use
+  // while the audio thread is not running
+  virtual void prefetch(int read, int write){}
+
+protected:
+  int length_;
+  static const char *directory_;
+};
+
+
+
+// The whole loop in memory
+class MemoryLoopStorage : public LoopStorage {
+public:
+  MemoryLoopStorage(int length);
+  ~MemoryLoopStorage();
+
+  float read(int index){ return samples_[index]; }
+  void write(int index, float sample){ samples_[index] = sample; }
+  void clear();
+  void read_block(int start, int count, float *out);
+  void write_block(int start, int count, const float *in);
+  DeferredBlock *copy_out(int start, int count, float *out);
+
+private:
+  float *samples_;
+};
+
+
+
+// The loop in a file, with a window of pages in memory
+class StreamingLoopStorage : public LoopStorage {
+public:
+  // Samples per page
+  static const int kPageSize = 16384;
+  // Pages in memory at once
+  static const int kNumFrames = 8;
+  // Pages fetched ahead of the read head
+  static const int kReadAhead = 2;
+  // Samples between checks on pages that were loaded or stored
+  static const int kMaintainInterval = 1024;
+  // Time the I/O thread sleeps when it has nothing to do
+  static const int kPollInterval = 1000; // us
+
+  // Creates a temporary file in the directory. Check is_open afterwards
+  StreamingLoopStorage(int length, const char *directory);
+  ~StreamingLoopStorage();
+
+  bool is_open(){ return fd_ >= 0; }
+
+  float read(int index);
+  void write(int index, float sample);
+  void follow(int read, int write);
+  void clear();
+  void read_block(int start, int count, float *out);
+  void write_block(int start, int count, const float *in);
+  DeferredBlock *copy_out(int start, int count, float *out);
+  void prefetch(int read, int write);
+
+private:
+  // A frame moves between the threads: the audio thread owns it while
+  // it is free, ready or dirty, the I/O thread while loading or storing
+  enum FrameState { kFree, kLoading, kReady, kDirty, kStoring };
+
+  // A page sized block of memory
+  struct Frame {
+    int page;
+    int state;
+    float *data;
+  };
+
+  // Reads the parts of a copy_out that were only in the file. It has a
+  // descriptor of its own, so the file outlives the storage until it is
+  // done. A page that is recorded over after the copy was made may come
+  // out newer than the rest
+  class FileReader : public DeferredBlock {
+  public:
+    FileReader(int fd) : fd_(fd) {}
+    ~FileReader(){ if (fd_ >= 0) close(fd_); }
+    void finish(void *data);
+    // A run of samples to read from the file, and where they go in the
+    // block
+    struct Span {
+      int index, count, at;
+    };
+    std::vector<Span> spans_;
+  private:
+    int fd_;
+  };
+
+  // The body of the I/O thread
+  static THREAD_RETURN THREAD_TYPE io_thread(void *ptr);
+
+  // Reads or writes a page of the file. Called from the I/O thread, or
+  // from any thread once the I/O thread is idle
+  void load_page(Frame &frame);
+  void store_page(Frame &frame);
+
+  int get_state(int frame){ return __atomic_load_n(&frames_[frame].state, __ATOMIC_ACQUIRE); }
+  void set_state(int frame, int state){ __atomic_store_n(&frames_[frame].state, state, __ATOMIC_RELEASE); }
+
+  // True if the page is near one of the heads
+  bool is_needed(int page);
+  bool is_read_window(int page);
+
+  // Writes back and frees pages that aren't needed, then fetches the ones
+  // that are. Called from the audio thread
+  void maintain();
+
+  // Catches up with the I/O thread and with any clear
+  void settle();
+
+  // Gives a frame to a page that will be overwritten, so it isn't loaded
+  void zero_frame(int frame);
+
+  // Waits until the I/O thread has finished every request
+  void wait_idle();
+
+  int fd_;
+  int num_pages_;
+  Frame frames_[kNumFrames];
+  // The frame holding each page, or -1
+  int *page_frame_;
+  // Pages that were cleared since they were last written to the file
+  bool *stale_;
+  int read_page_, write_page_, since_maintain_;
+  int clear_requested_;
+
+  // Frames waiting to be loaded or stored
+  SpscQueue<int, 16> requests_;
+  // Destroying a Thread cancels it, so it lives as long as we do
+  Thread io_;
+  volatile bool running_, stopped_;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  OutputStage.cpp
+  Turns the mono mix of the graph into the interleaved output buffer.
+*/
+
+#include "OutputStage.h"
+
+OutputStage::OutputStage(){
+  gain_ = 1;
+  limit_ = 0;
+  prepare();
+}
+
+// Recomputes the filters for the current sample rate and clears them. The
+// coefficients come from the same filters that used to run here
+void OutputStage::prepare(){
+  DigitalHighpassFilter highpass(kHighpassFrequency, 1, 1);
+  DigitalLowpassFilter lowpass(kLowpassFrequency, 1, 1);
+  highpass.load_biquad(highpass_, 1);
+  lowpass.load_biquad(lowpass_, 1);
+}
+
+// Filters the mono mix and writes it to every channel of the interleaved
+// output. Stereo is written two frames at a time
+void OutputStage::process(const double *mono, double *out, int frames, int channels){
+  int i = 0;
+#ifdef HAS_SSE2
+  if (channels == 2){
+    for (; i + 1 < frames; i += 2){
+      // The filters carry state, so the order of the two matters
+      double first = next(mono[i]);
+      double second = next(mono[i + 1]);
+      __m128d pair = _mm_set_pd(second, first);
+      _mm_storeu_pd(out + 2 * i, _mm_unpacklo_pd(pair, pair));
+      _mm_storeu_pd(out + 2 * i + 2, _mm_unpackhi_pd(pair, pair));
+    }
+  }
+#endif
+  for (; i < frames; ++i){
+    double y = next(mono[i]);
+    for (int c = 0; c < channels; ++c) out[i * channels + c] = y;
+  }
+}
+
+// #------------- Private --------------#
+
+// Filters, limits and scales one sample
+inline double OutputStage::next(double in){
+  double y = lowpass_.tick(highpass_.tick(in));
+  if (limit_ > 0) y = soft_limit(y);
+  return gain_ * y;
+}
+
+// Bends the signal smoothly towards limit_ above the knee. The curve meets
+// the straight line with the same slope, so quiet signals pass untouched
+double OutputStage::soft_limit(double x){
+  double knee = kKnee * limit_;
+  double size = fabs(x);
+  if (size <= knee) return x;
+  double bent = knee + (limit_ - knee) * tanh((size - knee) / (limit_ - knee));
+  return x < 0 ? -bent : bent;
+}
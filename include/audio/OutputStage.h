@@ -0,0 +1,59 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  OutputStage.h
+  Turns the mono mix of the graph into the interleaved buffer the sound
+  card plays. The DC blocker, the anti-aliasing lowpass, the output gain,
+  an optional soft limiter and the copy to every channel all happen in a
+  single pass, straight into the device's buffer.
+*/
+
+#ifndef _OUTPUTSTAGE_H_
+#define _OUTPUTSTAGE_H_
+
+#include <cmath>
+#include "DigitalFilter.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define HAS_SSE2
+#endif
+
+class OutputStage {
+public:
+  // Removes DC and rumble below this
+  static const double kHighpassFrequency = 10; // Hz
+  // Removes anything above this
+  static const double kLowpassFrequency = 15000; // Hz
+  // The limiter leaves the signal alone below this fraction of its level
+  static const double kKnee = 0.5;
+
+  OutputStage();
+
+  // Recomputes the filters for the current sample rate and clears them
+  void prepare();
+
+  // Scales the output after the filters
+  void set_gain(double gain){ gain_ = gain; }
+
+  // Softly limits the filtered mix to +/- level before the gain is
+  // applied. Zero turns the limiter off
+  void set_limit(double level){ limit_ = level; }
+
+  // Filters the mono mix and writes it to every channel of the
+  // interleaved output
+  void process(const double *mono, double *out, int frames, int channels);
+
+private:
+  // Filters, limits and scales one sample
+  inline double next(double in);
+
+  // Bends the signal smoothly towards limit_ above the knee
+  double soft_limit(double x);
+
+  Biquad highpass_, lowpass_;
+  double gain_, limit_;
+};
+
+#endif
@@ -0,0 +1,284 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  PartitionedConvolver.cpp
+  Frequency domain convolution with a long impulse response.
+*/
+
+#include "PartitionedConvolver.h"
+
+// The partition size must be a power of two
+ConvolutionStage::ConvolutionStage(const double *ir, int length, int partition){
+  partition_ = partition;
+  fft_size_ = 2 * partition_;
+  num_bins_ = partition_ + 1;
+  num_partitions_ = std::max(1, (length + partition_ - 1) / partition_);
+
+  fft_buffer_ = new complex[fft_size_];
+  spectra_ = new complex[num_partitions_ * num_bins_];
+  delay_line_ = new complex[num_partitions_ * num_bins_];
+  accumulator_ = new complex[num_bins_];
+  input_ = new double[fft_size_];
+  output_ = new double[partition_];
+
+  // Each partition is zero padded to twice its length, so that the
+  // circular convolution of the FFT holds one block of the linear one
+  for (int p = 0; p < num_partitions_; ++p){
+    for (int i = 0; i < fft_size_; ++i){
+      int at = p * partition_ + i;
+      fft_buffer_[i] = i < partition_ && at < length ? ir[at] : 0;
+    }
+    CFFT::Forward(fft_buffer_, fft_size_);
+    for (int k = 0; k < num_bins_; ++k){
+      spectra_[p * num_bins_ + k] = fft_buffer_[k];
+    }
+  }
+  clear();
+}
+
+ConvolutionStage::~ConvolutionStage(){
+  delete[] fft_buffer_;
+  delete[] spectra_;
+  delete[] delay_line_;
+  delete[] accumulator_;
+  delete[] input_;
+  delete[] output_;
+}
+
+// Adds the contribution of partitions [first, first + count) of the
+// impulse response to the next output
+void ConvolutionStage::accumulate(int first, int count){
+  int last = std::min(first + count, num_partitions_);
+  for (int p = std::max(first, 1); p < last; ++p){
+    // The next input will be newest_ + 1, so partition p meets the input
+    // that arrived p - 1 blocks before the newest
+    int slot = (newest_ - (p - 1) + num_partitions_) % num_partitions_;
+    const complex *x = delay_line_ + slot * num_bins_;
+    const complex *h = spectra_ + p * num_bins_;
+    for (int k = 0; k < num_bins_; ++k){
+      accumulator_[k] += x[k] * h[k];
+    }
+  }
+}
+
+// Takes the next partition of input and computes the next partition of
+// output. All of the other partitions must have been accumulated
+void ConvolutionStage::transform(const double *in){
+  // Slides the input along by one partition
+  for (int i = 0; i < partition_; ++i){
+    input_[i] = input_[i + partition_];
+    input_[i + partition_] = in[i];
+  }
+  for (int i = 0; i < fft_size_; ++i) fft_buffer_[i] = input_[i];
+  CFFT::Forward(fft_buffer_, fft_size_);
+
+  newest_ = (newest_ + 1) % num_partitions_;
+  complex *x = delay_line_ + newest_ * num_bins_;
+  for (int k = 0; k < num_bins_; ++k){
+    x[k] = fft_buffer_[k];
+    accumulator_[k] += x[k] * spectra_[k];
+  }
+
+  // The output is real, so the negative frequencies mirror the positive
+  for (int k = 0; k < num_bins_; ++k){
+    fft_buffer_[k] = accumulator_[k];
+    accumulator_[k] = 0;
+  }
+  for (int k = num_bins_; k < fft_size_; ++k){
+    fft_buffer_[k] = fft_buffer_[fft_size_ - k].conjugate();
+  }
+  CFFT::Inverse(fft_buffer_, fft_size_);
+
+  // The first half has wrapped around, only the second half is kept
+  for (int i = 0; i < partition_; ++i){
+    output_[i] = fft_buffer_[i + partition_].re();
+  }
+}
+
+// Forgets all past input
+void ConvolutionStage::clear(){
+  for (int i = 0; i < num_partitions_ * num_bins_; ++i) delay_line_[i] = 0;
+  for (int k = 0; k < num_bins_; ++k) accumulator_[k] = 0;
+  for (int i = 0; i < fft_size_; ++i) input_[i] = 0;
+  for (int i = 0; i < partition_; ++i) output_[i] = 0;
+  newest_ = 0;
+}
+
+// Enough to undo one call to transform and the accumulates before it
+ConvolutionStageState *ConvolutionStage::save_state(){
+  ConvolutionStageState *s = new ConvolutionStageState();
+  s->newest_ = newest_;
+  int next = (newest_ + 1) % num_partitions_;
+  s->slot_ = new complex[num_bins_];
+  s->accumulator_ = new complex[num_bins_];
+  for (int k = 0; k < num_bins_; ++k){
+    s->slot_[k] = delay_line_[next * num_bins_ + k];
+    s->accumulator_[k] = accumulator_[k];
+  }
+  s->input_ = new double[fft_size_];
+  for (int i = 0; i < fft_size_; ++i) s->input_[i] = input_[i];
+  s->output_ = new double[partition_];
+  for (int i = 0; i < partition_; ++i) s->output_[i] = output_[i];
+  return s;
+}
+
+void ConvolutionStage::recall_state(ConvolutionStageState *s){
+  newest_ = s->newest_;
+  int next = (newest_ + 1) % num_partitions_;
+  for (int k = 0; k < num_bins_; ++k){
+    delay_line_[next * num_bins_ + k] = s->slot_[k];
+    accumulator_[k] = s->accumulator_[k];
+  }
+  for (int i = 0; i < fft_size_; ++i) input_[i] = s->input_[i];
+  for (int i = 0; i < partition_; ++i) output_[i] = s->output_[i];
+  delete s;
+}
+
+
+
+
+// #------------- PartitionedConvolver --------------#
+
+// The block size must be a power of two
+PartitionedConvolver::PartitionedConvolver(const double *ir, int length, int block){
+  block_ = block;
+  tail_ = NULL;
+  tail_in_ = NULL;
+  tail_blocks_ = 1;
+  tail_step_ = 0;
+
+  // Small blocks would need thousands of partitions to cover a long
+  // response, so everything past the first kTailPartition samples is
+  // left to the tail
+  if (block_ < kTailPartition && length > kTailPartition){
+    head_ = new ConvolutionStage(ir, kTailPartition, block_);
+    tail_ = new ConvolutionStage(ir + kTailPartition, length - kTailPartition,
+                                 kTailPartition);
+    tail_blocks_ = kTailPartition / block_;
+    tail_in_ = new double[kTailPartition];
+  }
+  else {
+    head_ = new ConvolutionStage(ir, length, block_);
+  }
+
+  queue_in_ = new double[block_];
+  queue_out_ = new double[block_];
+  clear();
+}
+
+PartitionedConvolver::~PartitionedConvolver(){
+  delete head_;
+  delete tail_;
+  delete[] tail_in_;
+  delete[] queue_in_;
+  delete[] queue_out_;
+}
+
+// Convolves the input. When the length is a multiple of the block size
+// the output is not delayed at all. Otherwise the samples are queued and
+// the output is one block late
+void PartitionedConvolver::process(const double *in, double *out, int length){
+  if (queued_ == 0 && length % block_ == 0){
+    for (int i = 0; i < length; i += block_){
+      process_block(in + i, out + i);
+    }
+    return;
+  }
+  double sample;
+  for (int i = 0; i < length; ++i){
+    sample = in[i];
+    out[i] = queue_out_[queued_];
+    queue_in_[queued_] = sample;
+    if (++queued_ == block_){
+      process_block(queue_in_, queue_out_);
+      queued_ = 0;
+    }
+  }
+}
+
+// Forgets all past input
+void PartitionedConvolver::clear(){
+  head_->clear();
+  if (tail_ != NULL){
+    tail_->clear();
+    for (int i = 0; i < kTailPartition; ++i) tail_in_[i] = 0;
+  }
+  for (int i = 0; i < block_; ++i){
+    queue_in_[i] = 0;
+    queue_out_[i] = 0;
+  }
+  tail_step_ = 0;
+  queued_ = 0;
+}
+
+// Enough to undo one block of processing
+PartitionedConvolverState *PartitionedConvolver::save_state(){
+  PartitionedConvolverState *s = new PartitionedConvolverState();
+  s->head_ = head_->save_state();
+  s->tail_ = NULL;
+  s->tail_in_ = NULL;
+  if (tail_ != NULL){
+    s->tail_ = tail_->save_state();
+    s->tail_in_ = new double[kTailPartition];
+    for (int i = 0; i < kTailPartition; ++i) s->tail_in_[i] = tail_in_[i];
+  }
+  s->queue_in_ = new double[block_];
+  s->queue_out_ = new double[block_];
+  for (int i = 0; i < block_; ++i){
+    s->queue_in_[i] = queue_in_[i];
+    s->queue_out_[i] = queue_out_[i];
+  }
+  s->tail_step_ = tail_step_;
+  s->queued_ = queued_;
+  return s;
+}
+
+void PartitionedConvolver::recall_state(PartitionedConvolverState *s){
+  head_->recall_state(s->head_);
+  s->head_ = NULL;
+  if (tail_ != NULL){
+    tail_->recall_state(s->tail_);
+    s->tail_ = NULL;
+    for (int i = 0; i < kTailPartition; ++i) tail_in_[i] = s->tail_in_[i];
+  }
+  for (int i = 0; i < block_; ++i){
+    queue_in_[i] = s->queue_in_[i];
+    queue_out_[i] = s->queue_out_[i];
+  }
+  tail_step_ = s->tail_step_;
+  queued_ = s->queued_;
+  delete s;
+}
+
+// #------------- Private --------------#
+
+// Convolves a single block
+void PartitionedConvolver::process_block(const double *in, double *out){
+  // The input is saved first, in case out and in are the same
+  if (tail_ != NULL){
+    for (int i = 0; i < block_; ++i) tail_in_[tail_step_ * block_ + i] = in[i];
+  }
+
+  head_->accumulate(1, head_->num_partitions());
+  head_->transform(tail_ != NULL ? tail_in_ + tail_step_ * block_ : in);
+  const double *head_out = head_->output();
+  for (int i = 0; i < block_; ++i) out[i] = head_out[i];
+  if (tail_ == NULL) return;
+
+  // The tail's output was computed at the end of the last period. It
+  // starts kTailPartition samples into the response, exactly one period
+  const double *tail_out = tail_->output() + tail_step_ * block_;
+  for (int i = 0; i < block_; ++i) out[i] += tail_out[i];
+
+  // A share of the tail's multiply-adds, so no single block pays for all
+  int remaining = tail_->num_partitions() - 1;
+  int first = 1 + remaining * tail_step_ / tail_blocks_;
+  int last = 1 + remaining * (tail_step_ + 1) / tail_blocks_;
+  tail_->accumulate(first, last - first);
+
+  if (++tail_step_ == tail_blocks_){
+    tail_->transform(tail_in_);
+    tail_step_ = 0;
+  }
+}
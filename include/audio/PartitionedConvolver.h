@@ -0,0 +1,148 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  PartitionedConvolver.h
+  Convolves a signal with a long impulse response in the frequency domain.
+  The impulse response is cut into partitions that are each transformed
+  once, so every block of input costs one FFT, one inverse FFT and a
+  multiply-add per partition. Two partition sizes are used: a head with
+  partitions the size of the audio block, which adds no latency, and a
+  tail with larger partitions that keeps multi-second responses cheap.
+*/
+
+#ifndef _PARTITIONEDCONVOLVER_H_
+#define _PARTITIONEDCONVOLVER_H_
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include "complex.h"
+#include "fft.h"
+
+class ConvolutionStageState;
+class PartitionedConvolverState;
+
+
+// Uniformly partitioned overlap-save convolution. Each call to transform
+// takes one partition of input and produces one partition of output
+class ConvolutionStage {
+public:
+  // The partition size must be a power of two
+  ConvolutionStage(const double *ir, int length, int partition);
+  ~ConvolutionStage();
+
+  // Adds the contribution of partitions [first, first + count) of the
+  // impulse response to the next output. These only depend on past input,
+  // so the work can be spread out ahead of the next call to transform.
+  // Partition 0 is always handled by transform
+  void accumulate(int first, int count);
+
+  // Takes the next partition of input and computes the next partition of
+  // output. All of the other partitions must have been accumulated
+  void transform(const double *in);
+
+  const double *output(){ return output_; }
+  int num_partitions(){ return num_partitions_; }
+
+  // Forgets all past input
+  void clear();
+
+  // Enough to undo one call to transform and the accumulates before it
+  ConvolutionStageState *save_state();
+  void recall_state(ConvolutionStageState *state);
+
+private:
+  int partition_, fft_size_, num_bins_, num_partitions_;
+
+  // The spectrum of every partition of the impulse response. Only the
+  // non-negative frequencies are kept, the input is real
+  complex *spectra_;
+  // The spectra of the last num_partitions_ blocks of input, newest_ is
+  // the most recent
+  complex *delay_line_;
+  int newest_;
+  // The spectrum of the next output
+  complex *accumulator_;
+
+  complex *fft_buffer_;
+  // The previous and the current partition of input
+  double *input_;
+  double *output_;
+};
+
+class ConvolutionStageState {
+public:
+  ConvolutionStageState(){}
+  ~ConvolutionStageState(){
+    delete[] slot_;
+    delete[] accumulator_;
+    delete[] input_;
+    delete[] output_;
+  }
+  int newest_;
+  // The delay line slot that the next transform overwrites
+  complex *slot_;
+  complex *accumulator_;
+  double *input_;
+  double *output_;
+};
+
+
+
+class PartitionedConvolver {
+public:
+  // Partition size of the tail, in samples
+  static const int kTailPartition = 1024;
+
+  // The block size must be a power of two
+  PartitionedConvolver(const double *ir, int length, int block);
+  ~PartitionedConvolver();
+
+  // Convolves the input. When the length is a multiple of the block size
+  // the output is not delayed at all. Otherwise the samples are queued and
+  // the output is one block late. Safe to call in place
+  void process(const double *in, double *out, int length);
+
+  int block_size(){ return block_; }
+
+  // Forgets all past input
+  void clear();
+
+  // Enough to undo one block of processing
+  PartitionedConvolverState *save_state();
+  void recall_state(PartitionedConvolverState *state);
+
+private:
+  // Convolves a single block
+  void process_block(const double *in, double *out);
+
+  int block_;
+  ConvolutionStage *head_, *tail_;
+
+  // The tail runs once every tail_blocks_ blocks. Its input is gathered
+  // in tail_in_ and its multiply-adds are spread over the blocks between
+  int tail_blocks_, tail_step_;
+  double *tail_in_;
+
+  // Queues samples when the caller's length doesn't fit the blocks
+  double *queue_in_, *queue_out_;
+  int queued_;
+};
+
+class PartitionedConvolverState {
+public:
+  PartitionedConvolverState(){}
+  ~PartitionedConvolverState(){
+    delete head_;
+    delete tail_;
+    delete[] tail_in_;
+    delete[] queue_in_;
+    delete[] queue_out_;
+  }
+  ConvolutionStageState *head_, *tail_;
+  int tail_step_, queued_;
+  double *tail_in_, *queue_in_, *queue_out_;
+};
+
+#endif
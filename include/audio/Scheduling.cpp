@@ -0,0 +1,196 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  Scheduling.cpp
+  Realtime priority, memory locking and core pinning for the audio thread.
+*/
+
+#include "Scheduling.h"
+
+int Scheduling::priority_ = 0;
+bool Scheduling::lock_requested_ = false;
+std::vector<int> Scheduling::audio_cores_;
+std::vector<int> Scheduling::worker_cores_;
+bool Scheduling::memory_locked_ = false;
+bool Scheduling::future_locked_ = false;
+int Scheduling::lock_error_ = 0;
+pthread_t Scheduling::audio_thread_;
+bool Scheduling::audio_seen_ = false;
+int Scheduling::audio_ready_ = 0;
+int Scheduling::audio_policy_ = SCHED_OTHER;
+int Scheduling::audio_priority_ = 0;
+int Scheduling::audio_pin_error_ = 0;
+int Scheduling::audio_priority_error_ = 0;
+int Scheduling::workers_failed_ = 0;
+
+// Asks for realtime scheduling of the audio thread. Zero turns it off
+void Scheduling::set_realtime_priority(int priority){
+  int lowest = sched_get_priority_min(SCHED_FIFO);
+  int highest = sched_get_priority_max(SCHED_FIFO);
+  if (priority > 0 && (priority < lowest || priority > highest)){
+    printf("Realtime priority must be between %d and %d, using %d\n", lowest, highest, kDefaultPriority);
+    priority = kDefaultPriority;
+  }
+  priority_ = priority > 0 ? priority : 0;
+}
+
+bool Scheduling::set_audio_cores(const char *list){
+  return parse_cores(list, audio_cores_);
+}
+
+bool Scheduling::set_worker_cores(const char *list){
+  return parse_cores(list, worker_cores_);
+}
+
+// Locks every page that is mapped now, and the ones mapped later when
+// the limits allow it. Does nothing unless it was asked for
+void Scheduling::lock_memory(){
+  if (!lock_requested_ || memory_locked_) return;
+  // Once future pages are locked, any allocation past the limit fails. So
+  // they are only locked when there is no limit to run into
+  struct rlimit limit;
+  bool unlimited = geteuid() == 0 ||
+      (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY);
+  int flags = unlimited ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT;
+  if (mlockall(flags) == 0){
+    memory_locked_ = true;
+    future_locked_ = unlimited;
+  }
+  else lock_error_ = errno;
+}
+
+// Touches every page of a buffer so that the first write from the audio
+// thread doesn't fault. The contents are left as they are
+void Scheduling::prefault(void *buffer, size_t bytes){
+  if (buffer == NULL || bytes == 0) return;
+  static const long page = sysconf(_SC_PAGESIZE) > 0 ? sysconf(_SC_PAGESIZE) : 4096;
+  // Writing, not just reading, so that copy on write pages are copied now
+  volatile char *c = static_cast<volatile char *>(buffer);
+  for (size_t i = 0; i < bytes; i += page) c[i] = c[i];
+  c[bytes - 1] = c[bytes - 1];
+}
+
+// Called at the top of every audio callback. The first time it runs on a
+// thread, that thread is pinned and given its priority. A restarted
+// stream may call back from a new thread, which is set up again
+void Scheduling::enter_audio_thread(){
+  pthread_t self = pthread_self();
+  if (audio_seen_ && pthread_equal(self, audio_thread_)) return;
+  audio_thread_ = self;
+  audio_seen_ = true;
+
+  audio_pin_error_ = audio_cores_.empty() ? 0 : pin_current_thread(audio_cores_);
+
+  // Backends that don't honor the stream's realtime flag leave us where
+  // we were, so the priority is asked for directly
+  struct sched_param param;
+  int policy;
+  audio_priority_error_ = 0;
+  if (pthread_getschedparam(self, &policy, &param) != 0) policy = SCHED_OTHER;
+  if (priority_ > 0 && policy != SCHED_FIFO && policy != SCHED_RR){
+    param.sched_priority = priority_;
+    audio_priority_error_ = pthread_setschedparam(self, SCHED_FIFO, &param);
+    if (audio_priority_error_ == 0) policy = SCHED_FIFO;
+    else param.sched_priority = 0;
+  }
+  audio_policy_ = policy;
+  audio_priority_ = param.sched_priority;
+  __atomic_store_n(&audio_ready_, 1, __ATOMIC_RELEASE);
+}
+
+// Pins the calling thread to the worker cores, if any were chosen
+bool Scheduling::enter_worker_thread(){
+  if (worker_cores_.empty()) return true;
+  if (pin_current_thread(worker_cores_) == 0) return true;
+  __atomic_add_fetch(&workers_failed_, 1, __ATOMIC_RELAXED);
+  return false;
+}
+
+// Prints which of the settings took effect. Waits briefly for the audio
+// thread so that its settings can be reported
+void Scheduling::report(){
+  for (int waited = 0; waited < kReportWait; waited += kPollInterval){
+    if (__atomic_load_n(&audio_ready_, __ATOMIC_ACQUIRE)) break;
+    usleep(kPollInterval);
+  }
+  bool ready = __atomic_load_n(&audio_ready_, __ATOMIC_ACQUIRE);
+
+  printf("Scheduling:\n");
+  printf("  memory lock    ");
+  if (!lock_requested_) printf("off\n");
+  else if (!memory_locked_) printf("failed (%s)\n", strerror(lock_error_));
+  else if (!future_locked_) printf("current pages only, RLIMIT_MEMLOCK is limited\n");
+  else printf("current and future pages\n");
+
+  printf("  priority       ");
+  if (!ready) printf("unknown, the audio thread hasn't started\n");
+  else if (audio_policy_ == SCHED_FIFO || audio_policy_ == SCHED_RR){
+    printf("%s %d\n", audio_policy_ == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR", audio_priority_);
+  }
+  else if (priority_ > 0) printf("failed (%s)\n", strerror(audio_priority_error_));
+  else printf("off\n");
+
+  printf("  audio cores    ");
+  if (audio_cores_.empty()) printf("any\n");
+  else if (!ready) printf("unknown, the audio thread hasn't started\n");
+  else if (audio_pin_error_ != 0) printf("failed (%s)\n", strerror(audio_pin_error_));
+  else print_cores(audio_cores_);
+
+  printf("  worker cores   ");
+  if (worker_cores_.empty()) printf("any\n");
+  else {
+    int failed = __atomic_load_n(&workers_failed_, __ATOMIC_RELAXED);
+    if (failed > 0) printf("failed for %d workers, ", failed);
+    print_cores(worker_cores_);
+  }
+}
+
+// #------------- Private --------------#
+
+// Pins the calling thread. Returns 0 or an errno value
+int Scheduling::pin_current_thread(const std::vector<int> &cores){
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = 0; i < cores.size(); ++i){
+    if (cores[i] < CPU_SETSIZE) CPU_SET(cores[i], &set);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  // Other systems only take hints about affinity
+  return ENOSYS;
+#endif
+}
+
+// Reads a list of cores such as "2" or "1,3" or "2-3"
+bool Scheduling::parse_cores(const char *list, std::vector<int> &cores){
+  std::vector<int> parsed;
+  const char *c = list;
+  while (*c != '\0'){
+    char *end;
+    long first = strtol(c, &end, 10);
+    long last = first;
+    if (end == c || first < 0) break;
+    c = end;
+    if (*c == '-'){
+      last = strtol(c + 1, &end, 10);
+      if (end == c + 1 || last < first) break;
+      c = end;
+    }
+    for (long i = first; i <= last && i < kMaxCores; ++i) parsed.push_back(i);
+    if (*c == ',') ++c;
+    else if (*c != '\0') break;
+  }
+  if (*c != '\0' || parsed.empty()){
+    printf("Could not read the core list \"%s\"\n", list);
+    return false;
+  }
+  cores = parsed;
+  return true;
+}
+
+void Scheduling::print_cores(const std::vector<int> &cores){
+  for (int i = 0; i < cores.size(); ++i) printf(i == 0 ? "%d" : ",%d", cores[i]);
+  printf("\n");
+}
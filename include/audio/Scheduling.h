@@ -0,0 +1,94 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  Scheduling.h
+  Keeps the audio thread from being held up by the rest of the machine.
+  The settings are chosen at startup: a realtime priority for the stream,
+  locking the program's memory so that it is never paged out, and the
+  cores that the audio thread and any DSP workers may run on. Each of
+  these can be refused by the system, so a report says what took effect.
+*/
+
+#ifndef _SCHEDULING_H_
+#define _SCHEDULING_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+class Scheduling {
+public:
+  // Used when realtime is asked for without a priority
+  static const int kDefaultPriority = 70;
+  // How long the report waits for the first audio callback
+  static const int kReportWait = 500000; // us
+  static const int kPollInterval = 10000; // us
+  // Cores past this are ignored
+  static const int kMaxCores = 1024;
+
+  // Asks for realtime scheduling of the audio thread. Zero turns it off
+  static void set_realtime_priority(int priority);
+  static int realtime_priority(){ return priority_; }
+
+  // Locks the program's memory into RAM when lock_memory is called
+  static void set_lock_memory(bool lock){ lock_requested_ = lock; }
+
+  // Reads a list of cores such as "2" or "1,3" or "2-3". Returns false and
+  // keeps the old list if it can't be read
+  static bool set_audio_cores(const char *list);
+  static bool set_worker_cores(const char *list);
+
+  // Locks every page that is mapped now, and the ones mapped later when
+  // the limits allow it. Does nothing unless it was asked for
+  static void lock_memory();
+
+  // Touches every page of a buffer so that the first write from the audio
+  // thread doesn't fault. The contents are left as they are
+  static void prefault(void *buffer, size_t bytes);
+
+  // Called at the top of every audio callback. The first time it runs on a
+  // thread, that thread is pinned and given its priority
+  static void enter_audio_thread();
+
+  // Pins the calling thread to the worker cores, if any were chosen
+  static bool enter_worker_thread();
+
+  // Prints which of the settings took effect. Waits briefly for the audio
+  // thread so that its settings can be reported
+  static void report();
+
+private:
+  // Pins the calling thread. Returns 0 or an errno value
+  static int pin_current_thread(const std::vector<int> &cores);
+
+  static bool parse_cores(const char *list, std::vector<int> &cores);
+  static void print_cores(const std::vector<int> &cores);
+
+  static int priority_;
+  static bool lock_requested_;
+  static std::vector<int> audio_cores_, worker_cores_;
+
+  // What lock_memory managed, and why it failed
+  static bool memory_locked_, future_locked_;
+  static int lock_error_;
+
+  // Written by the audio thread, then published through audio_ready_
+  static pthread_t audio_thread_;
+  static bool audio_seen_;
+  static int audio_ready_;
+  static int audio_policy_, audio_priority_;
+  static int audio_pin_error_, audio_priority_error_;
+
+  // Counted by the workers that couldn't be pinned
+  static int workers_failed_;
+};
+
+#endif
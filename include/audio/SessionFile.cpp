@@ -0,0 +1,190 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  SessionFile.cpp
+  Reads and writes the binary session format.
+*/
+
+#include "SessionFile.h"
+
+// The first bytes of every session
+static const char kMagic[4] = {'C', 'F', 'X', 'S'};
+// Read back differently on a machine of the other endianness
+static const int kByteOrder = 0x01020304;
+
+
+
+
+// #------------- SessionWriter --------------#
+
+// Starts a session recorded at the given sample rate
+SessionWriter::SessionWriter(int sample_rate){
+  last_block_ = 0;
+  append(kMagic, 4);
+  write_int(kVersion);
+  write_int(kByteOrder);
+  write_int(sample_rate);
+}
+
+// Blocks that were never finished are dropped with the session
+SessionWriter::~SessionWriter(){
+  for (int i = 0; i < deferred_.size(); ++i) delete deferred_[i].second;
+}
+
+void SessionWriter::write_int(int value){
+  int32_t v = value;
+  append(&v, sizeof(v));
+}
+
+void SessionWriter::write_double(double value){
+  append(&value, sizeof(value));
+}
+
+// Copies a block of memory into the session
+void SessionWriter::write_block(const void *data, int bytes){
+  void *block = reserve_block(bytes);
+  if (bytes > 0) memcpy(block, data, bytes);
+}
+
+// Makes room for a block and returns where its contents go. The size
+// comes first, then padding up to the alignment
+void *SessionWriter::reserve_block(int bytes){
+  write_int(bytes);
+  int padding = (kBlockAlignment - data_.size() % kBlockAlignment) % kBlockAlignment;
+  data_.resize(data_.size() + padding + bytes, 0);
+  last_block_ = data_.size() - bytes;
+  return bytes > 0 ? &data_[last_block_] : NULL;
+}
+
+// Leaves the rest of the block reserved last to be filled in later. The
+// block is found again by where it starts, the data may have moved
+void SessionWriter::defer(DeferredBlock *block){
+  if (block != NULL) deferred_.push_back(std::make_pair(last_block_, block));
+}
+
+// Fills in every deferred block
+void SessionWriter::finish_blocks(){
+  for (int i = 0; i < deferred_.size(); ++i){
+    deferred_[i].second->finish(&data_[deferred_[i].first]);
+    delete deferred_[i].second;
+  }
+  deferred_.clear();
+}
+
+// Writes the session to a file. Returns false if it could not be written
+bool SessionWriter::save(const char *path){
+  finish_blocks();
+  FILE *file = fopen(path, "wb");
+  if (file == NULL){
+    printf("Could not open %s for writing\n", path);
+    return false;
+  }
+  bool ok = fwrite(&data_[0], 1, data_.size(), file) == data_.size();
+  if (fclose(file) != 0) ok = false;
+  if (!ok) printf("Could not write %s\n", path);
+  return ok;
+}
+
+// #------------- Private --------------#
+
+// Appends raw bytes
+void SessionWriter::append(const void *data, int bytes){
+  const char *c = static_cast<const char *>(data);
+  data_.insert(data_.end(), c, c + bytes);
+}
+
+
+
+
+// #------------- SessionReader --------------#
+
+// Maps the file into memory and checks its header. Check is_open
+// afterwards
+SessionReader::SessionReader(const char *path){
+  map_ = NULL;
+  size_ = 0;
+  offset_ = 0;
+  sample_rate_ = 0;
+  failed_ = false;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0){
+    printf("Could not open %s\n", path);
+    return;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < 16){
+    printf("%s is not a session\n", path);
+    close(fd);
+    return;
+  }
+  size_ = info.st_size;
+  void *map = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open on its own
+  close(fd);
+  if (map == MAP_FAILED){
+    printf("Could not map %s\n", path);
+    return;
+  }
+  // The whole file is about to be read, so the kernel can fetch it all now
+  madvise(map, size_, MADV_WILLNEED);
+  map_ = static_cast<const char *>(map);
+
+  char magic[4];
+  take(magic, 4);
+  int version = read_int();
+  int byte_order = read_int();
+  sample_rate_ = read_int();
+  if (memcmp(magic, kMagic, 4) != 0 || version != SessionWriter::kVersion
+      || byte_order != kByteOrder){
+    printf("%s is not a session this version can read\n", path);
+    munmap(const_cast<char *>(map_), size_);
+    map_ = NULL;
+  }
+}
+
+SessionReader::~SessionReader(){
+  if (map_ != NULL) munmap(const_cast<char *>(map_), size_);
+}
+
+int SessionReader::read_int(){
+  int32_t v = 0;
+  take(&v, sizeof(v));
+  return v;
+}
+
+double SessionReader::read_double(){
+  double v = 0;
+  take(&v, sizeof(v));
+  return v;
+}
+
+// Returns the next block, which points into the mapped file
+const void *SessionReader::read_block(int &bytes){
+  bytes = read_int();
+  size_t padding = (SessionWriter::kBlockAlignment - offset_ % SessionWriter::kBlockAlignment)
+                   % SessionWriter::kBlockAlignment;
+  if (failed_ || bytes < 0 || offset_ + padding + bytes > size_){
+    failed_ = true;
+    bytes = 0;
+    return NULL;
+  }
+  const void *block = map_ + offset_ + padding;
+  offset_ += padding + bytes;
+  return block;
+}
+
+// #------------- Private --------------#
+
+// Copies raw bytes out of the file
+bool SessionReader::take(void *out, int bytes){
+  if (failed_ || offset_ + bytes > size_){
+    failed_ = true;
+    memset(out, 0, bytes);
+    return false;
+  }
+  memcpy(out, map_ + offset_, bytes);
+  offset_ += bytes;
+  return true;
+}
@@ -0,0 +1,113 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  SessionFile.h
+  Reads and writes the binary session format. A session is a header
+  followed by a stream of numbers and blocks. Blocks hold large buffers
+  like delay lines and loops, they are aligned within the file so that a
+  reader can map the file and use them in place.
+*/
+
+#ifndef _SESSIONFILE_H_
+#define _SESSIONFILE_H_
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The rest of a block that couldn't be filled in when it was reserved,
+// for instance the part of a loop that is only on the disk. Handed to
+// SessionWriter::defer
+class DeferredBlock {
+public:
+  virtual ~DeferredBlock(){}
+  // Fills in the rest of the block, which starts at data
+  virtual void finish(void *data) = 0;
+};
+
+
+
+class SessionWriter {
+public:
+  // Bumped whenever the layout of a session changes
+  static const int kVersion = 1;
+  // Blocks start on a multiple of this many bytes from the start of the file
+  static const int kBlockAlignment = 64;
+
+  // Starts a session recorded at the given sample rate
+  SessionWriter(int sample_rate);
+  ~SessionWriter();
+
+  void write_int(int value);
+  void write_double(double value);
+
+  // Copies a block of memory into the session
+  void write_block(const void *data, int bytes);
+
+  // Makes room for a block and returns where its contents go. The pointer
+  // is only valid until the next write
+  void *reserve_block(int bytes);
+
+  // Leaves the rest of the block reserved last to be filled in later, so
+  // that a buffer can be copied while the audio thread waits and finished
+  // after it has been let go. Takes ownership, NULL is ignored
+  void defer(DeferredBlock *block);
+
+  // Fills in every deferred block. save does this first
+  void finish_blocks();
+
+  // Writes the session to a file. Returns false if it could not be written
+  bool save(const char *path);
+
+private:
+  // Appends raw bytes
+  void append(const void *data, int bytes);
+
+  std::vector<char> data_;
+  // Where the last block starts, and the blocks waiting to be filled in
+  size_t last_block_;
+  std::vector<std::pair<size_t, DeferredBlock *> > deferred_;
+};
+
+
+
+class SessionReader {
+public:
+  // Maps the file into memory and checks its header. Check is_open
+  // afterwards
+  SessionReader(const char *path);
+  ~SessionReader();
+
+  bool is_open(){ return map_ != NULL; }
+
+  // The sample rate the session was recorded at
+  int sample_rate(){ return sample_rate_; }
+
+  // Reading past the end of the file gives zeros and sets failed
+  int read_int();
+  double read_double();
+
+  // Returns the next block, which points into the mapped file and lives as
+  // long as the reader does. bytes is set to the size of the block
+  const void *read_block(int &bytes);
+
+  // True if the file ended early
+  bool failed(){ return failed_; }
+
+private:
+  // Copies raw bytes out of the file
+  bool take(void *out, int bytes);
+
+  const char *map_;
+  size_t size_, offset_;
+  int sample_rate_;
+  bool failed_;
+};
+
+#endif
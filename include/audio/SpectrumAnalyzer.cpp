@@ -0,0 +1,210 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  SpectrumAnalyzer.cpp
+  A streaming short-time Fourier transform used for the spectral display.
+*/
+
+#include "SpectrumAnalyzer.h"
+
+// Time constant of the smoothing applied to the displayed bands
+static const double kSmoothingTime = 0.08; // s
+
+SpectrumAnalyzer::SpectrumAnalyzer(int fft_size, int hop_size, int num_bands){
+  fft_size_ = kDefaultFFTSize;
+  hop_size_ = hop_size;
+  num_bands_ = num_bands < 1 ? 1 : num_bands;
+  sample_rate_ = 44100;
+  min_frequency_ = 20;
+
+  ring_ = NULL; window_ = NULL; frame_ = NULL; magnitudes_ = NULL;
+  band_first_ = NULL; band_last_ = NULL; band_center_bin_ = NULL; bands_ = NULL;
+
+  set_fft_size(fft_size);
+  set_hop_size(hop_size);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer(){
+  delete[] ring_;
+  delete[] window_;
+  delete[] frame_;
+  delete[] magnitudes_;
+  delete[] band_first_;
+  delete[] band_last_;
+  delete[] band_center_bin_;
+  delete[] bands_;
+}
+
+// Changes the length of the transform. The size is rounded up to a power
+// of two and restricted to the range [kMinFFTSize, kMaxFFTSize].
+void SpectrumAnalyzer::set_fft_size(int fft_size){
+  int size = kMinFFTSize;
+  while (size < fft_size && size < kMaxFFTSize) size <<= 1;
+
+  // Keep the overlap the same
+  double overlap = 1 - hop_size_ / (1.0 * fft_size_);
+  fft_size_ = size;
+  hop_size_ = static_cast<int>(round(fft_size_ * (1 - overlap)));
+  if (hop_size_ < 1) hop_size_ = 1;
+  prepare();
+}
+
+// Changes the number of samples between the starts of successive frames
+void SpectrumAnalyzer::set_hop_size(int hop_size){
+  hop_size_ = hop_size < 1 ? 1 : hop_size;
+  if (hop_size_ > fft_size_) hop_size_ = fft_size_;
+}
+
+// Sets the hop size as a fraction of overlap between frames
+void SpectrumAnalyzer::set_overlap(double overlap){
+  overlap = fmax(0, fmin(0.95, overlap));
+  set_hop_size(static_cast<int>(round(fft_size_ * (1 - overlap))));
+}
+
+// Changes the number of logarithmically spaced bands in the display
+void SpectrumAnalyzer::set_num_bands(int num_bands){
+  num_bands_ = num_bands < 1 ? 1 : num_bands;
+  prepare();
+}
+
+// The sample rate is needed to place the log-frequency bands
+void SpectrumAnalyzer::set_sample_rate(int sample_rate){
+  if (sample_rate == sample_rate_) return;
+  sample_rate_ = sample_rate;
+  build_band_table();
+}
+
+// Adds a block of samples to the history
+void SpectrumAnalyzer::push_samples(const double *samples, int length){
+  int mask = ring_size_ - 1;
+  int at = static_cast<int>(written_ & mask);
+  for (int i = 0; i < length; ++i){
+    ring_[at] = samples[i];
+    at = (at + 1) & mask;
+  }
+  written_ += length;
+}
+
+// Forgets all history and the smoothed spectrum
+void SpectrumAnalyzer::clear(){
+  for (int i = 0; i < ring_size_; ++i) ring_[i] = 0;
+  for (int i = 0; i < fft_size_/2; ++i) magnitudes_[i] = 0;
+  for (int i = 0; i < num_bands_; ++i) bands_[i] = 0;
+  written_ = 0;
+  next_frame_end_ = fft_size_;
+}
+
+// Transforms every complete hop that has arrived since the last call
+int SpectrumAnalyzer::analyze(){
+  // If we have fallen behind by more than the history holds, skip ahead
+  // to the newest frame that is still available
+  long oldest = written_ - (ring_size_ - fft_size_);
+  if (next_frame_end_ < oldest){
+    next_frame_end_ = written_ - (written_ - next_frame_end_) % hop_size_;
+  }
+
+  double smoothing = exp(-hop_size_ / (kSmoothingTime * sample_rate_));
+  int frames = 0;
+  while (next_frame_end_ <= written_){
+    transform_frame(next_frame_end_);
+    // Aggregate the linear bins into log-frequency bands
+    for (int b = 0; b < num_bands_; ++b){
+      double level = 0;
+      if (band_first_[b] > band_last_[b]){
+        // Narrower than a bin, interpolate the neighbors
+        double at = band_center_bin_[b];
+        int lower = static_cast<int>(floor(at));
+        double frac = at - lower;
+        int upper = lower + 1 < fft_size_/2 ? lower + 1 : lower;
+        level = (1 - frac) * magnitudes_[lower] + frac * magnitudes_[upper];
+      }
+      else {
+        // Strongest bin in the band, so a sinusoid reads the same anywhere
+        for (int i = band_first_[b]; i <= band_last_[b]; ++i){
+          level = fmax(level, magnitudes_[i]);
+        }
+      }
+      // The GUI thread doesn't flush subnormals, so silence is flushed here
+      bands_[b] = flush_denormal(smoothing * bands_[b] + (1 - smoothing) * level);
+    }
+    next_frame_end_ += hop_size_;
+    ++frames;
+  }
+  return frames;
+}
+
+// The center frequency of a band in Hz
+double SpectrumAnalyzer::band_frequency(int band){
+  double max_frequency = sample_rate_ / 2.0;
+  return min_frequency_ * pow(max_frequency / min_frequency_, (band + 0.5) / num_bands_);
+}
+
+// #------------- Private --------------#
+
+// (Re)builds the window, FFT scratch and band tables for the current size
+void SpectrumAnalyzer::prepare(){
+  delete[] ring_;
+  delete[] window_;
+  delete[] frame_;
+  delete[] magnitudes_;
+  delete[] bands_;
+
+  // Twice the frame length lets the display fall behind by a frame
+  ring_size_ = 2 * fft_size_;
+  ring_ = new double[ring_size_];
+  frame_ = new complex[fft_size_];
+  magnitudes_ = new double[fft_size_/2];
+  bands_ = new double[num_bands_];
+
+  // Periodic Hann window
+  window_ = new double[fft_size_];
+  double sum = 0;
+  for (int i = 0; i < fft_size_; ++i){
+    window_[i] = 0.5 * (1 - cos(6.2831853071795862 * i / fft_size_));
+    sum += window_[i];
+  }
+  // Scales so that a full scale sinusoid reads 1.0
+  window_gain_ = 2.0 / sum;
+
+  build_band_table();
+  clear();
+}
+
+// Maps the linear bins onto the log-frequency bands
+void SpectrumAnalyzer::build_band_table(){
+  if (bands_ == NULL) return;
+  delete[] band_first_;
+  delete[] band_last_;
+  delete[] band_center_bin_;
+  band_first_ = new int[num_bands_];
+  band_last_ = new int[num_bands_];
+  band_center_bin_ = new double[num_bands_];
+
+  int bins = fft_size_/2;
+  double bin_width = sample_rate_ / (1.0 * fft_size_);
+  double max_frequency = sample_rate_ / 2.0;
+  double ratio = max_frequency / min_frequency_;
+  for (int b = 0; b < num_bands_; ++b){
+    double low = min_frequency_ * pow(ratio, b / (1.0 * num_bands_));
+    double high = min_frequency_ * pow(ratio, (b + 1) / (1.0 * num_bands_));
+    band_first_[b] = static_cast<int>(ceil(low / bin_width));
+    band_last_[b] = static_cast<int>(floor(high / bin_width));
+    if (band_last_[b] > bins - 1) band_last_[b] = bins - 1;
+    band_center_bin_[b] = fmin(band_frequency(b) / bin_width, bins - 1);
+  }
+}
+
+// Copies the newest frame out of the history, applies the window and
+// transforms it
+void SpectrumAnalyzer::transform_frame(long frame_end){
+  int mask = ring_size_ - 1;
+  long start = frame_end - fft_size_;
+  for (int i = 0; i < fft_size_; ++i){
+    frame_[i] = ring_[(start + i) & mask] * window_[i];
+  }
+  CFFT::Forward(frame_, fft_size_);
+  for (int i = 0; i < fft_size_/2; ++i){
+    magnitudes_[i] = frame_[i].norm() * window_gain_;
+  }
+}
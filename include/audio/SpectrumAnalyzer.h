@@ -0,0 +1,108 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  SpectrumAnalyzer.h
+  A streaming short-time Fourier transform used for the spectral display.
+  Samples are pushed from the audio thread into a ring of recent history
+  and frames are taken from it at a fixed hop size, so the resolution of the
+  display does not depend on the size of the audio buffers.
+*/
+
+#ifndef _SPECTRUMANALYZER_H_
+#define _SPECTRUMANALYZER_H_
+
+#include <cmath>
+#include "complex.h"
+#include "fft.h"
+#include "Denormals.h"
+
+class SpectrumAnalyzer {
+public:
+  static const int kMinFFTSize = 256;
+  static const int kMaxFFTSize = 16384;
+  static const int kDefaultFFTSize = 4096;
+  static const int kDefaultBands = 128;
+
+  SpectrumAnalyzer(int fft_size = kDefaultFFTSize, int hop_size = kDefaultFFTSize/4,
+                   int num_bands = kDefaultBands);
+  ~SpectrumAnalyzer();
+
+  // Changes the length of the transform. The size is rounded up to a power
+  // of two and restricted to the range [kMinFFTSize, kMaxFFTSize]. The hop
+  // size is scaled to keep the same overlap. Clears the sample history.
+  void set_fft_size(int fft_size);
+  int get_fft_size(){ return fft_size_; }
+
+  // Changes the number of samples between the starts of successive frames
+  void set_hop_size(int hop_size);
+  int get_hop_size(){ return hop_size_; }
+
+  // Sets the hop size as a fraction of overlap between frames (0 - 0.95)
+  void set_overlap(double overlap);
+
+  // Changes the number of logarithmically spaced bands in the display
+  void set_num_bands(int num_bands);
+  int get_num_bands(){ return num_bands_; }
+
+  // The sample rate is needed to place the log-frequency bands
+  void set_sample_rate(int sample_rate);
+
+  // Adds a block of samples to the history. Called from the audio thread.
+  void push_samples(const double *samples, int length);
+
+  // Forgets all history and the smoothed spectrum
+  void clear();
+
+  // Transforms every complete hop that has arrived since the last call and
+  // updates the smoothed band magnitudes. Returns the number of frames that
+  // were computed
+  int analyze();
+
+  // The smoothed magnitude of each band. A full scale sinusoid reads 1.0
+  double *get_bands(){ return bands_; }
+
+  // The magnitude of each linear bin of the most recent frame
+  double *get_bins(){ return magnitudes_; }
+  int get_num_bins(){ return fft_size_/2; }
+
+  // The center frequency of a band in Hz
+  double band_frequency(int band);
+
+private:
+  // (Re)builds the window, FFT scratch and band tables for the current size
+  void prepare();
+
+  // Maps the linear bins onto the log-frequency bands
+  void build_band_table();
+
+  // Copies the newest frame out of the history, applies the window and
+  // transforms it. The magnitudes are left in magnitudes_
+  void transform_frame(long frame_end);
+
+  int fft_size_, hop_size_, num_bands_;
+  int sample_rate_;
+  double min_frequency_;
+
+  // The history of recent samples. Its length is a power of two so that
+  // positions can be wrapped with a mask
+  double *ring_;
+  int ring_size_;
+  long written_;
+  long next_frame_end_;
+
+  // Window table and its normalization
+  double *window_;
+  double window_gain_;
+
+  complex *frame_;
+  double *magnitudes_;
+
+  // First and last linear bin that each band collects, and the fractional
+  // bin used for bands that are narrower than a single bin
+  int *band_first_, *band_last_;
+  double *band_center_bin_;
+  double *bands_;
+};
+
+#endif
@@ -0,0 +1,55 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  SpscQueue.h
+  A fixed size queue for passing items from one thread to another without
+  locking. Exactly one thread may push and exactly one thread may pop.
+*/
+
+#ifndef _SPSCQUEUE_H_
+#define _SPSCQUEUE_H_
+
+// The capacity must be a power of two
+template <class T, unsigned int kCapacity>
+class SpscQueue {
+public:
+  SpscQueue(){
+    head_ = 0;
+    tail_ = 0;
+  }
+
+  // Called only by the producer. Returns false if the queue is full
+  bool push(const T &item){
+    unsigned int tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+    unsigned int head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+    if (tail - head == kCapacity) return false;
+    items_[tail & (kCapacity - 1)] = item;
+    // The item must be in place before the consumer can see it
+    __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Called only by the consumer. Returns false if the queue is empty
+  bool pop(T &item){
+    unsigned int head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+    unsigned int tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+    if (head == tail) return false;
+    item = items_[head & (kCapacity - 1)];
+    // The slot can't be reused until the item has been copied out
+    __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  bool empty(){
+    return __atomic_load_n(&head_, __ATOMIC_ACQUIRE)
+           == __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+  }
+
+private:
+  T items_[kCapacity];
+  // Only ever increase, the difference is the number of items
+  unsigned int head_, tail_;
+};
+
+#endif
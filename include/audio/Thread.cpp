@@ -136,3 +136,16 @@ void Mutex :: unlock()
 
 #endif 
 }
+
+bool Mutex :: tryLock()
+{
+#if (defined(__OS_IRIX__) || defined(__OS_LINUX__) || defined(__OS_MACOSX__)) || defined(__WINDOWS_PTHREAD__)
+
+  return pthread_mutex_trylock(&mutex) == 0;
+
+#elif defined(__OS_WINDOWS__)
+
+  return TryEnterCriticalSection(&mutex) != 0;
+
+#endif 
+}
@@ -76,6 +76,9 @@ class Mutex : public Stk
   //! Unlock the mutex.
   void unlock(void);
 
+  //! Lock the mutex if no one else holds it.  Returns TRUE if it was locked.
+  bool tryLock(void);
+
  protected:
 
   MUTEX mutex;
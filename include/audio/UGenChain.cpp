@@ -10,10 +10,22 @@
 
 bool UGenChain::audio_initialized_ = false;
 bool UGenChain::midi_initialized_ = false;
+unsigned int UGenChain::input_channels_ = 1;
+const unsigned int UGenChain::kBufferSizes[] = {32, 64, 128, 256, 512};
+const unsigned int UGenChain::kSampleRates[] = {44100, 48000, 96000};
 // Check to see if the audio and midi has been set up properly
 bool UGenChain::has_audio(){ return audio_initialized_; }
 bool UGenChain::has_midi(){ return midi_initialized_; }
 
+// The number of input channels to open, chosen before the audio starts
+void UGenChain::set_input_channels(int channels){
+  if (channels < 1 || channels > kMaxInputChannels){
+    printf("Input channels must be between 1 and %d, using 1\n", kMaxInputChannels);
+    channels = 1;
+  }
+  input_channels_ = channels;
+}
+
 
 
 // #--------------- callback functions ---------------#
@@ -44,28 +56,35 @@ int audioCallback(void *outputBuffer, void *inputBuffer, unsigned int num_frames
   UGenGraphBuilder *graph = (UGenGraphBuilder *) data;
   int numChannels = UGenChain::kNumChannels;
   
-  double newVal = 0, lastVal;
+  // Decaying feedback must not fall into the slow subnormal range. This is
+  // cheap, and it follows the stream onto a new thread after a restart
+  enable_flush_to_zero();
+  Scheduling::enter_audio_thread();
 
-  graph->handoff_audio_buffer(input_buffer, num_frames);
+  // The inputs read the device's buffer in place, it stays put until we return
+  graph->handoff_audio_buffer(input_buffer, num_frames, UGenChain::input_channels());
 
-  double *out_mono = new double[num_frames];
+  // The output stage writes every channel straight into the device buffer
   graph->lock_thread(true);
-  graph->load_buffer(out_mono, num_frames);
+  graph->load_buffer(output_buffer, num_frames, numChannels);
   graph->signal_new_buffer();
   graph->rebuild();
   graph->lock_thread(false);
 
-  //Fills the other channels
-  for (unsigned int i = 0; i < num_frames; ++i) {
-    for (unsigned int j = 0; j < numChannels; ++j) {
-      output_buffer[i * numChannels + j] = 0.1 * out_mono[i];
-    }
-  }
+  return 0;
 
-  delete[] out_mono;
+}
 
-  return 0;
 
+
+// Used in place of the audioCallback while the round trip latency is measured
+int latencyCallback(void *outputBuffer, void *inputBuffer, unsigned int num_frames, double streamTime, RtAudioStreamStatus status, void * data) {
+  LatencyProbe *probe = (LatencyProbe *) data;
+  // Measured under the same scheduling as the graph would run
+  Scheduling::enter_audio_thread();
+  probe->process((double *) inputBuffer, (double *) outputBuffer, num_frames, 
+                 UGenChain::kNumChannels, streamTime);
+  return probe->is_finished() ? 1 : 0;
 }
 
 
@@ -88,58 +107,186 @@ UGenChain::~UGenChain(){
 
 // Sets up the RtAudio framework and passes the callback 
 // function to send and receive audio data.
-int UGenChain::initialize_audio(){
+int UGenChain::initialize_audio(unsigned int buffer_frames, unsigned int sample_rate){
   if (audio_initialized_) return -1;
+  if (!create_device()) exit(-1);
+
+  buffer_frames_ = buffer_frames;
+  sample_rate_ = sample_rate;
+  graph_builder_ = new UGenGraphBuilder();
+  graph_builder_->output_stage()->set_gain(kOutputGain);
+  
+  if (start_graph() != 0) return -1;
+  
+  audio_initialized_ = true;
+  return 0;
+}
+
+// Creates the RtAudio object. Returns false if there are no devices
+bool UGenChain::create_device(){
   adac_ = new RtAudio();
-  RtAudio::StreamParameters input_params, output_params;
-  RtAudio::StreamOptions options_;
   
   // check for audio devices
   if (adac_->getDeviceCount() < 1) {
     printf("Audio devices not found!\n");
-    exit(-1);
+    return false;
   }
   // let RtAudio print messages to stderr.
   adac_->showWarnings(true);
+  return true;
+}
+
+// Opens the stream with the current buffer size and sample rate and the
+// given number of input channels. The device may change the buffer
+// size. Returns 0 on success
+int UGenChain::open_stream(RtAudioCallback callback, void *data, unsigned int input_channels){
+  RtAudio::StreamParameters input_params, output_params;
+  RtAudio::StreamOptions options_;
+
   // set input and output parameters
   input_params.deviceId = adac_->getDefaultInputDevice();
-  input_params.nChannels = 1;
+  input_params.nChannels = input_channels;
   input_params.firstChannel = 0;
   output_params.deviceId = adac_->getDefaultOutputDevice();
   output_params.nChannels = kNumChannels;
   output_params.firstChannel = 0; 
 
-  buffer_frames_ = 512; // a default value
-  graph_builder_ = new UGenGraphBuilder();
+  // The backend raises its callback thread to this priority, where it can
+  if (Scheduling::realtime_priority() > 0){
+    options_.flags |= RTAUDIO_SCHEDULE_REALTIME;
+    options_.priority = Scheduling::realtime_priority();
+  }
     
   try { 
-    // Yeah, I hate this too, it's just to make the openStream function happy...
-    unsigned int sample_rate = kSampleRate;
     RtAudioFormat format = kFormat;
 
     // Tells the audio stream how to open and what callback to use
     adac_->openStream(&output_params, 
                       &input_params, 
                       format, 
-                      sample_rate, 
+                      sample_rate_, 
                       &buffer_frames_, 
-                      &audioCallback, 
-                      (void *) this->graph_builder_, 
+                      callback, 
+                      data, 
                       &options_);
+  } catch (RtError& e) {
+    std::cout << e.getMessage() << std::endl;
+    return -1;
+  }
+  return 0;
+}
 
-    // Tells it how big the buffer should be (set by the external audio setup)
-    graph_builder_->initialize(buffer_frames_, sample_rate);
-    
+// Starts the opened stream. Returns 0 on success
+int UGenChain::start_stream(){
+  try { 
      // opens the audio buffer
     adac_->startStream();
   } catch (RtError& e) {
     std::cout << e.getMessage() << std::endl;
     return -1;
   }
-  
-  audio_initialized_ = true;
+  printf("Audio: %d frames at %d Hz (%.1f ms)\n", buffer_frames_, sample_rate_,
+         1000.0 * buffer_frames_ / sample_rate_);
   return 0;
 }
+
+// Opens the stream for the signal graph, prepares the graph for the buffer
+// size the device settled on and starts the stream. Returns 0 on success
+int UGenChain::start_graph(){
+  if (open_stream(&audioCallback, (void *) this->graph_builder_, input_channels_) != 0) return -1;
+  // Tells it how big the buffer should be (set by the external audio setup)
+  graph_builder_->reconfigure(buffer_frames_, sample_rate_);
+  return start_stream();
+}
+
+// Stops the stream, prepares every unit generator for the new buffer
+// size and sample rate and starts the stream again. If the device
+// refuses the new settings, the old ones are restored. Returns 0 on success
+int UGenChain::reconfigure_audio(unsigned int buffer_frames, unsigned int sample_rate){
+  if (!audio_initialized_) return -1;
+  if (!is_valid_buffer_size(buffer_frames) || !is_valid_sample_rate(sample_rate)){
+    printf("Unsupported audio settings: %d frames at %d Hz\n", buffer_frames, sample_rate);
+    return -1;
+  }
+  unsigned int old_frames = buffer_frames_, old_rate = sample_rate_;
+
+  // Nothing is processed while the unit generators are resized
+  stop_audio();
+  buffer_frames_ = buffer_frames;
+  sample_rate_ = sample_rate;
+  if (start_graph() == 0) return 0;
+
+  printf("Restoring previous audio settings\n");
+  if (adac_->isStreamOpen()) adac_->closeStream();
+  buffer_frames_ = old_frames;
+  sample_rate_ = old_rate;
+  start_graph();
+  return -1;
+}
+
+// Plays a test signal through the output and listens for it on the input
+// to measure the round trip latency and the callback jitter, then prints
+// a report. With loopback, a software device stands in for the sound card
+int UGenChain::run_latency_test(LatencyProbe::Signal signal, bool loopback,
+                                unsigned int buffer_frames, unsigned int sample_rate){
+  buffer_frames_ = buffer_frames;
+  sample_rate_ = sample_rate;
+  LatencyProbe *probe = new LatencyProbe(signal, sample_rate_, buffer_frames_);
+
+  if (loopback){
+    // Two buffers of device latency, like a typical duplex driver
+    LoopbackDevice device(buffer_frames_, sample_rate_, 2 * buffer_frames_);
+    printf("Audio: %d frames at %d Hz on the loopback device\n", buffer_frames_, sample_rate_);
+    device.run(&latencyCallback, probe, kNumChannels);
+  }
+  else {
+    if (!create_device() || open_stream(&latencyCallback, probe, 1) != 0){
+      delete probe;
+      return -1;
+    }
+    // The device may have picked a different buffer size
+    probe->set_buffer_frames(buffer_frames_);
+    if (start_stream() != 0){
+      delete probe;
+      return -1;
+    }
+    while (!probe->is_finished() && adac_->isStreamRunning()) usleep(10000);
+    stop_audio();
+  }
+
+  probe->report();
+  delete probe;
+  return 0;
+}
+
+// Steps through the supported buffer sizes
+void UGenChain::cycle_buffer_size(){
+  int i = 0;
+  while (i < kNumBufferSizes && kBufferSizes[i] != buffer_frames_) ++i;
+  reconfigure_audio(kBufferSizes[(i + 1) % kNumBufferSizes], sample_rate_);
+}
+
+// Steps through the supported sample rates
+void UGenChain::cycle_sample_rate(){
+  int i = 0;
+  while (i < kNumSampleRates && kSampleRates[i] != sample_rate_) ++i;
+  reconfigure_audio(buffer_frames_, kSampleRates[(i + 1) % kNumSampleRates]);
+}
+
+// Checks a setting against the supported values
+bool UGenChain::is_valid_buffer_size(unsigned int buffer_frames){
+  for (int i = 0; i < kNumBufferSizes; ++i){
+    if (kBufferSizes[i] == buffer_frames) return true;
+  }
+  return false;
+}
+
+bool UGenChain::is_valid_sample_rate(unsigned int sample_rate){
+  for (int i = 0; i < kNumSampleRates; ++i){
+    if (kSampleRates[i] == sample_rate) return true;
+  }
+  return false;
+}
   
 // Tests if a string is a number or not
 bool is_number(const std::string& s)
@@ -196,7 +343,8 @@ int UGenChain::initialize_midi(){
 
 // Stops the audio stream gracefully
 void UGenChain::stop_audio(){  
-  adac_->stopStream();
+  if (adac_->isStreamRunning())
+    adac_->stopStream();
   // close if open
   if (adac_->isStreamOpen())
     adac_->closeStream();
@@ -17,6 +17,9 @@
 #include "RtError.h"
 #include "vmath.h"
 #include "UGenGraphBuilder.h"
+#include "LatencyProbe.h"
+#include "Denormals.h"
+#include "Scheduling.h"
 
 
 class UGenChain {
@@ -24,9 +27,19 @@ class UGenChain {
 public:
   static const RtAudioFormat kFormat = RTAUDIO_FLOAT64;
   static const unsigned int kSampleRate = 44100;
+  static const unsigned int kDefaultBufferFrames = 512;
+  // The settings that can be selected at startup or while running
+  static const unsigned int kBufferSizes[];
+  static const int kNumBufferSizes = 5;
+  static const unsigned int kSampleRates[];
+  static const int kNumSampleRates = 3;
   static const int kNumChannels = 2;
+  // Input discs each pick one channel of the device's input
+  static const int kMaxInputChannels = Input::kMaxChannels;
   static const double kTwoPi = 6.2831853072;
   static const double kMaxOutput = 2.5;
+  // Scales the mix down to a comfortable level for the sound card
+  static const double kOutputGain = 0.1;
 
   UGenChain();
   // Closes the buffer and cleans up objects
@@ -34,12 +47,32 @@ public:
   
   // Sets up the RtAudio framework and passes the callback 
   // function to send and receive audio data.
-  int initialize_audio(); 
+  int initialize_audio(unsigned int buffer_frames = kDefaultBufferFrames,
+                       unsigned int sample_rate = kSampleRate); 
   int initialize_midi();
 
   // Stops the audio stream gracefully
   void stop_audio();
 
+  // Stops the stream, prepares every unit generator for the new buffer
+  // size and sample rate and starts the stream again. If the device
+  // refuses the new settings, the old ones are restored. Returns 0 on success
+  int reconfigure_audio(unsigned int buffer_frames, unsigned int sample_rate);
+
+  // Plays a test signal through the output and listens for it on the input
+  // to measure the round trip latency and the callback jitter, then prints
+  // a report. With loopback, a software device stands in for the sound card
+  int run_latency_test(LatencyProbe::Signal signal, bool loopback,
+                       unsigned int buffer_frames, unsigned int sample_rate);
+
+  // Steps through the supported buffer sizes and sample rates
+  void cycle_buffer_size();
+  void cycle_sample_rate();
+
+  // Checks a setting against the supported values
+  static bool is_valid_buffer_size(unsigned int buffer_frames);
+  static bool is_valid_sample_rate(unsigned int sample_rate);
+
   // Returns the interconnects of unit generators
   UGenGraphBuilder *get_signal_graph();
 
@@ -47,10 +80,15 @@ public:
   static bool has_audio();
   static bool has_midi();
 
+  // The number of input channels to open, chosen before the audio starts
+  static void set_input_channels(int channels);
+  static unsigned int input_channels(){ return input_channels_; }
+
   
 private: 
   // Set once the audio stream has been initialized and opened
   static bool audio_initialized_, midi_initialized_;
+  static unsigned int input_channels_;
 
   // The signal chain
   UGenGraphBuilder *graph_builder_;
@@ -60,8 +98,24 @@ private:
   // The RtMidi object listens for MIDI events
   RtMidiIn *midi_;
 
+  // Creates the RtAudio object. Returns false if there are no devices
+  bool create_device();
+
+  // Opens the stream with the current buffer size and sample rate and the
+  // given number of input channels. The device may change the buffer
+  // size. Returns 0 on success
+  int open_stream(RtAudioCallback callback, void *data, unsigned int input_channels);
+
+  // Starts the opened stream. Returns 0 on success
+  int start_stream();
+
+  // Opens the stream for the signal graph, prepares the graph for the buffer
+  // size the device settled on and starts the stream. Returns 0 on success
+  int start_graph();
+
   // The size of all buffers
   unsigned int buffer_frames_;
+  unsigned int sample_rate_;
 };
  
 #endif
@@ -14,22 +14,46 @@ bool compare_wires(Wire i, Wire j);
 
 UGenGraphBuilder::UGenGraphBuilder(){
   buffer_ready_ = false;
-  anti_aliasing_ = new DigitalLowpassFilter(15000, 1, 1);
-  low_pass_ = new DigitalHighpassFilter(10, 1, 1);
+  analyzer_ = new SpectrumAnalyzer();
+  analyzed_disc_ = NULL;
+  optimize_ = true;
+  topology_hash_ = 0;
+  epoch_ = 0;
+  buffer_epoch_ = 0;
+  planned_ = false;
+  planned_epoch_ = 0;
+  planned_sequence_ = 0;
 }
 
 UGenGraphBuilder::~UGenGraphBuilder(){
-  delete low_pass_;  
-  delete anti_aliasing_;
-  delete[] fft_visual_;
+  delete analyzer_;
 }
 
 void UGenGraphBuilder::initialize(int length, int sample_rate){
   buffer_length_ = length;
-  fft_visual_ = new complex[buffer_length_];
+  mix_.resize(length);
+  analyzer_->set_sample_rate(sample_rate);
   UnitGenerator::set_audio_settings(length, sample_rate);
 }
 
+// Changes the buffer length and sample rate of every unit generator in
+// the graph. The audio stream must be stopped while this is called
+void UGenGraphBuilder::reconfigure(int length, int sample_rate){
+  lock_thread(true);
+  initialize(length, sample_rate);
+  analyzer_->clear();
+
+  // Discs waiting to be deleted are still used in the next crossfade
+  int num_nodes = inputs_.size() + midi_modules_.size() 
+                 + fx_.size() + to_delete_.size();
+  for (int i = 0; i < num_nodes; ++i){
+    indexed(i)->get_ugen()->prepare(length, sample_rate);
+  }
+
+  output_stage_.prepare();
+  lock_thread(false);
+}
+
 
 // Prints all data about the graph, including the nodes,
 // their type and positions
@@ -64,6 +88,7 @@ void UGenGraphBuilder::print_all(){
 
 // Recomputes the graph based on the new positions of the discs
 void UGenGraphBuilder::rebuild(){
+  capture_positions();
   wires_.clear();
   old_sinks_.clear();
   old_sinks_ = sinks_;
@@ -71,13 +96,18 @@ void UGenGraphBuilder::rebuild(){
 
   int num_inputs = inputs_.size() + midi_modules_.size();
   int num_nodes = num_inputs+ fx_.size();
-  if (num_nodes == 0) return;
+  if (num_nodes == 0){
+    // Every wire is gone
+    if (topology_hash_ != 0){
+      topology_hash_ = 0;
+      ++epoch_;
+    }
+    return;
+  }
 
   bool marked[num_nodes];
   bool is_sink[num_nodes];
 
-  past_signature_ = signature_; 
-
   for (int i = 0; i < num_nodes; ++i){
     if (data_.count(indexed(i))){
       data_[indexed(i)].past_inputs_ = data_[indexed(i)].inputs_;
@@ -89,6 +119,15 @@ void UGenGraphBuilder::rebuild(){
     else {
       data_[indexed(i)] = GraphData();
     }
+    // The node's scratch is made here, so pulling it allocates nothing,
+    // not even in a crossfade
+    GraphData &d = data_[indexed(i)];
+    if (d.wet_.size() < buffer_length_){
+      d.wet_.resize(buffer_length_);
+      d.dry_.resize(buffer_length_);
+      d.crossfade_wet_.resize(buffer_length_);
+      d.crossfade_dry_.resize(buffer_length_);
+    }
     marked[i] = false;
     is_sink[i] = false;
   }
@@ -113,7 +152,7 @@ void UGenGraphBuilder::rebuild(){
             if (!indexed(i)->get_ugen()->is_input() ||
                 !indexed(j)->get_ugen()->is_input() ){
                 
-              this_dist = get_edge_cost(indexed(i), indexed(j));
+              this_dist = get_edge_cost(i, j);
               if (this_dist < min_dist && this_dist < kMaxDist){
                 next_j = j;
                 next_i = i;
@@ -144,8 +183,7 @@ void UGenGraphBuilder::rebuild(){
   
   // Sorts the wires to ensure that the directionality is stable
   std::sort(wires_.begin(), wires_.end(), compare_wires);
-  signature_ = compute_signature();
-  
+
 
   // Make sure inputs are only transmitting
   bool finalized[wires_.size()];
@@ -188,11 +226,31 @@ void UGenGraphBuilder::rebuild(){
     }
   }
 
+  // The hash is built up as each wire's final direction is known
+  uint64_t hash = 0;
   for (int i = 0; i < wires_.size(); ++i){
     data_[wires_[i].second].inputs_.push_back(wires_[i].first);
     data_[wires_[i].first].outputs_.push_back(wires_[i].second);
+    hash += wire_hash(wires_[i].first, wires_[i].second);
+  }
+  if (hash != topology_hash_){
+    topology_hash_ = hash;
+    ++epoch_;
   }
 
+  // The plan for each buffer is made in this storage, so load_buffer
+  // doesn't allocate
+  int num_biquads = 0;
+  for (int i = 0; i < num_nodes; ++i){
+    GraphData &d = data_[indexed(i)];
+    d.past_wet_levels_.resize(d.past_inputs_.size());
+    d.wet_gains_.resize(d.inputs_.size());
+    d.dry_gains_.resize(d.inputs_.size());
+    d.chain_.reserve(num_nodes);
+    num_biquads += indexed(i)->get_ugen()->num_biquads();
+  }
+  chain_biquads_.reserve(num_biquads);
+
   for (int i = 0; i < num_nodes; ++i){
     data_[indexed(i)].computed = false;
     if (data_[indexed(i)].outputs_.size() == 0){
@@ -205,12 +263,15 @@ void UGenGraphBuilder::rebuild(){
   }
 }
 
-std::string UGenGraphBuilder::compute_signature(){
-  std::stringstream s ;
-  for (int i = 0; i < wires_.size(); i++){
-    s << wires_[i].first->getID() << ":" << wires_[i].second->getID() << "."; 
-  }
-  return s.str();
+// Hashes a directed wire. The hash of a graph is the sum over its wires,
+// so it doesn't depend on the order they were found in. The splitmix64 
+// finalizer spreads the two IDs over all of the bits
+uint64_t UGenGraphBuilder::wire_hash(Disc *from, Disc *to){
+  uint64_t z = (static_cast<uint64_t>(from->getID()) << 32) ^ static_cast<uint32_t>(to->getID());
+  z += 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
 }
 
 
@@ -225,15 +286,29 @@ bool compare_wires (Wire i, Wire j){
 
 // Processes a whole buffer. Note that you must first handoff audio 
 // and midi data to the graph by using the handoff_audio and 
-// handoff midi functions (mono)
-void UGenGraphBuilder::load_buffer(double *out, int frames){
+// handoff midi functions. The mix is written to every channel of the
+// interleaved output
+void UGenGraphBuilder::load_buffer(double *output, int frames, int channels){
+  // Only grows if the device hands us a bigger buffer than it promised
+  if (mix_.size() < frames) mix_.resize(frames);
+  double *out = &mix_[0];
   // Zero out old array
   for (int i = 0; i < frames; ++i) out[i] = 0;
       
   double *temp;
-  find_mix_levels();
+  // The mix levels only change when the wires do, which changes the
+  // epoch, or when the physics has moved the discs since they were found
+  unsigned int sequence = Physics::begin_snapshot();
+  if (!planned_ || epoch_ != planned_epoch_ || sequence != planned_sequence_){
+    find_mix_levels();
+    planned_ = true;
+    planned_epoch_ = epoch_;
+    planned_sequence_ = sequence;
+  }
+  optimize();
   // There has been a change in the graph
-  if (signature_ != past_signature_){
+  if (epoch_ != buffer_epoch_){
+    buffer_epoch_ = epoch_;
     int num_nodes = inputs_.size() + midi_modules_.size() 
                    + fx_.size() + to_delete_.size();
 
@@ -266,16 +341,15 @@ void UGenGraphBuilder::load_buffer(double *out, int frames){
       for (int i = 0; i < frames; ++i) out[i] += temp[i];
     }
 
-    // Cleans up any extra buffers that were created during crossfade
+    // The crossfade buffers are kept for the next change
     for (std::map<Disc *, UGenState *>::iterator it = saved_states.begin(); 
       it != saved_states.end(); ++it){
-      if (data_[it->first].need_crossfade_){
-        delete[] data_[it->first].crossfade_wet_;
-        delete[] data_[it->first].crossfade_dry_;
-        data_[it->first].need_crossfade_ = false;
-      }  
+      data_[it->first].need_crossfade_ = false;
     }
 
+    // The analyzer must see the buffer before its disc can be deleted
+    feed_analyzer(frames);
+
     // Cleans up any discs that are on the to_delete list
     finalize_delete();
   }
@@ -290,15 +364,15 @@ void UGenGraphBuilder::load_buffer(double *out, int frames){
         out[i] += temp[i];
       }
     }
+    feed_analyzer(frames);
   }
 
-  for (int i = 0; i < frames; ++i){
-    //Filters the signal to remove HF and DC components
-    low_pass_->tick(out[i]);
-    anti_aliasing_->tick(low_pass_->most_recent_sample());
-    out[i] = anti_aliasing_->most_recent_sample().re();
-  }
+  // The graphics thread reads the levels without taking the lock
+  int num_nodes = inputs_.size() + midi_modules_.size() + fx_.size();
+  for (int i = 0; i < num_nodes; ++i) indexed(i)->get_ugen()->update_meter();
 
+  // Removes HF and DC components on the way out
+  output_stage_.process(out, output, frames, channels);
 }
 
 
@@ -308,49 +382,19 @@ void UGenGraphBuilder::load_buffer(double *out, int frames){
 // State - 0: Normal, 1: Prepare, 2: Recall
 double *UGenGraphBuilder::pull_result_buffer(Disc *k, int length, int state){
   if (data_[k].computed) return k->get_ugen()->current_buffer();
+  if (state == 0 && data_[k].chain_.size() > 1) return pull_chain(k, length);
 
-  double *wet = new double[length];
-  double *dry = new double[length];
-  for (int i = 0; i < length; ++i){ 
-    wet[i] = 0; dry[i] = 0;
-  }
-
-  double *temp, wet_level, scale;
-  // Current Inputs
-  std::vector<Disc *> input_list;
-  if (state == 1){
-    input_list = data_[k].past_inputs_;
-  } else {
-    input_list = data_[k].inputs_;
-  }
-
-  for (std::vector< Disc* >::iterator it = input_list.begin(); 
-    it != input_list.end(); ++it) {
-    // Finds mix level
-    wet_level = get_mix_level(k, *it);
-    
-    // Scales down based on fan out
-    if (state == 1) {
-      scale = scale_factor( data_[*it].past_outputs_.size() );
-    }
-    else{
-      scale = scale_factor( data_[*it].outputs_.size() );
-    } 
-    // Computes buffer coming from previous ugen
-    temp = pull_result_buffer(*it, length, state);
-    
-    // Computes wet dry mix
-    for (int i = 0; i < length; ++i){
-      wet[i] += wet_level * scale * temp[i];
-      dry[i] += (1-wet_level) * scale * temp[i];
-    }  
-  }
+  double *wet = clear_scratch(data_[k].wet_, length);
+  double *dry = clear_scratch(data_[k].dry_, length);
+  mix_inputs(k, length, state, wet, dry);
 
   // We need to store the input buffers so that they may be 
   // used in the recall state
   if (state == 1){
-    data_[k].crossfade_wet_ = new double[length];
-    data_[k].crossfade_dry_ = new double[length];
+    if (data_[k].crossfade_wet_.size() < length){
+      data_[k].crossfade_wet_.resize(length);
+      data_[k].crossfade_dry_.resize(length);
+    }
     for (int i = 0; i < length; ++i){
       data_[k].crossfade_wet_[i] = wet[i]; 
       data_[k].crossfade_dry_[i] = dry[i]; 
@@ -371,7 +415,24 @@ double *UGenGraphBuilder::pull_result_buffer(Disc *k, int length, int state){
     }
   }
 
-  double *out_buffer = k->get_ugen()->process_buffer(wet, length);
+  // The prepare pass replays the old graph, so it doesn't count. A
+  // bypassed node's input is known to be silent
+  bool asleep = false;
+  if (state != 1){
+    bool silent = (state == 0 && data_[k].bypass_) || is_silent(wet, length);
+    asleep = update_silence(k, silent, length, k->get_ugen()->tail_length());
+  }
+
+  // A sleeping node skips its processing and outputs silence. It wakes up
+  // on the first buffer with any signal in it
+  double *out_buffer;
+  if (state == 0 && asleep){
+    out_buffer = k->get_ugen()->current_buffer();
+    for (int i = 0; i < length; ++i) out_buffer[i] = 0;
+  }
+  else {
+    out_buffer = k->get_ugen()->process_buffer(wet, length);
+  }
   
   data_[k].computed = true;
   // Merges wet and dry
@@ -380,35 +441,202 @@ double *UGenGraphBuilder::pull_result_buffer(Disc *k, int length, int state){
       out_buffer[i] += dry[i];
     }
   }
-  delete[] wet;
-  delete[] dry;
   return out_buffer;
 }
 
-void UGenGraphBuilder::find_mix_levels(){
-  wet_levels_.clear();
-  int num_nodes = inputs_.size() + midi_modules_.size() + fx_.size() + to_delete_.size();
-  for ( int i = 0; i < num_nodes; ++i ){
-    for ( int j = i + 1; j < num_nodes; ++j ){
-      if (indexed(i) < indexed(j)){
-        wet_levels_[indexed(i)][indexed(j)] = compute_mix_level(indexed(i), indexed(j));
-      }
-      else{
-        wet_levels_[indexed(j)][indexed(i)] = compute_mix_level(indexed(j), indexed(i));
-      }
+// Mixes a node's inputs into its wet and dry buffers. The prepare pass
+// uses the old connections, the others use the gains from find_mix_levels()
+void UGenGraphBuilder::mix_inputs(Disc *k, int length, int state, double *wet, double *dry){
+  double *temp, wet_level, scale;
+  if (state == 1){
+    std::vector<Disc *> &input_list = data_[k].past_inputs_;
+    for (int j = 0; j < input_list.size(); ++j) {
+      // Finds mix level, scaled down based on fan out
+      wet_level = data_[k].past_wet_levels_[j];
+      scale = scale_factor( data_[input_list[j]].past_outputs_.size() );
+      // Computes buffer coming from previous ugen
+      temp = pull_result_buffer(input_list[j], length, state);
+      // Computes wet dry mix
+      for (int i = 0; i < length; ++i){
+        wet[i] += wet_level * scale * temp[i];
+        dry[i] += (1-wet_level) * scale * temp[i];
+      }  
+    }
+    return;
+  }
+
+  GraphData &d = data_[k];
+  for (int j = 0; j < d.inputs_.size(); ++j){
+    temp = pull_result_buffer(d.inputs_[j], length, state);
+    double wet_gain = d.wet_gains_[j], dry_gain = d.dry_gains_[j];
+    if (wet_gain != 0){
+      for (int i = 0; i < length; ++i) wet[i] += wet_gain * temp[i];
+    }
+    for (int i = 0; i < length; ++i) dry[i] += dry_gain * temp[i];
+  }
+}
+
+// Runs a chain of filters that ends at k in one pass. The first filter
+// mixes its inputs as usual, then every sample goes through all of the
+// biquads. Each filter's output still lands in its own buffer, since its
+// disc glows with it and the analyzer may be showing any of them
+double *UGenGraphBuilder::pull_chain(Disc *k, int length){
+  std::vector<Disc *> &chain = data_[k].chain_;
+  int num_filters = chain.size();
+
+  double *wet = clear_scratch(data_[k].wet_, length);
+  double *dry = clear_scratch(data_[k].dry_, length);
+  mix_inputs(chain[0], length, 0, wet, dry);
+
+  // The whole chain sleeps once its input has been silent for longer than
+  // all of the filters ring for. The last filter keeps the count
+  int tail = 0;
+  for (int j = 0; j < num_filters; ++j) tail += chain[j]->get_ugen()->tail_length();
+  bool asleep = update_silence(k, is_silent(wet, length) && is_silent(dry, length), length, tail);
+
+  // Every filter after the first has a single input, the one before it
+  int first[num_filters + 1];
+  double *out[num_filters];
+  double wet_gain[num_filters], dry_gain[num_filters];
+  int total = 0;
+  for (int j = 0; j < num_filters; ++j){
+    first[j] = total;
+    total += chain[j]->get_ugen()->num_biquads();
+  }
+  first[num_filters] = total;
+  chain_biquads_.resize(total);
+  Biquad *b = &chain_biquads_[0];
+  for (int j = 0; j < num_filters; ++j){
+    UnitGenerator *u = chain[j]->get_ugen();
+    u->load_biquads(b + first[j]);
+    out[j] = u->current_buffer();
+    wet_gain[j] = j > 0 ? data_[chain[j]].wet_gains_[0] : 1;
+    dry_gain[j] = j > 0 ? data_[chain[j]].dry_gains_[0] : 1;
+  }
+
+  for (int i = 0; i < length && asleep; ++i){
+    for (int j = 0; j < num_filters; ++j) out[j][i] = 0;
+  }
+  for (int i = 0; i < length && !asleep; ++i){
+    double previous = 0;
+    for (int j = 0; j < num_filters; ++j){
+      double x = j > 0 ? wet_gain[j] * previous : wet[i];
+      double through = j > 0 ? dry_gain[j] * previous : dry[i];
+      for (int n = first[j]; n < first[j + 1]; ++n) x = b[n].tick(x);
+      previous = out[j][i] = x + through;
+    }
+  }
+
+  for (int j = 0; j < num_filters; ++j){
+    chain[j]->get_ugen()->store_biquads(b + first[j]);
+    data_[chain[j]].computed = true;
+    // Sleeping starts over for the others if the chain comes apart
+    if (j + 1 < num_filters) data_[chain[j]].silent_samples_ = 0;
+  }
+  return out[num_filters - 1];
+}
+
+// Plans the next buffer. Finds the nodes that get no wet signal and the
+// chains of filters that can run in one pass. A filter can start or stop
+// gliding at any time, so this runs for every buffer, in the storage that
+// rebuild() reserved
+void UGenGraphBuilder::optimize(){
+  int num_nodes = inputs_.size() + midi_modules_.size() + fx_.size();
+  for (int i = 0; i < num_nodes; ++i){
+    Disc *k = indexed(i);
+    GraphData &d = data_[k];
+    d.bypass_ = optimize_;
+    for (int j = 0; j < d.wet_gains_.size(); ++j){
+      if (d.wet_gains_[j] != 0) d.bypass_ = false;
     }
+
+    // A filter whose coefficients are gliding runs on its own until they
+    // arrive, the biquads only know where they are now
+    UnitGenerator *u = k->get_ugen();
+    d.fusible_ = false;
+    if (optimize_ && u->num_biquads() > 0){
+      chain_biquads_.resize(u->num_biquads());
+      d.fusible_ = u->load_biquads(&chain_biquads_[0]);
+    }
+    d.chain_.clear();
   }
+  if (!optimize_) return;
+
+  // Each chain is found from its last filter and stored there
+  for (int i = 0; i < num_nodes; ++i){
+    Disc *k = indexed(i);
+    GraphData &d = data_[k];
+    if (!d.fusible_) continue;
+    if (d.outputs_.size() == 1 && fuses_with(k, d.outputs_[0])) continue;
+    Disc *at = k;
+    d.chain_.push_back(k);
+    while (data_[at].inputs_.size() == 1 && fuses_with(data_[at].inputs_[0], at)){
+      at = data_[at].inputs_[0];
+      d.chain_.push_back(at);
+    }
+    std::reverse(d.chain_.begin(), d.chain_.end());
+    if (d.chain_.size() < 2) d.chain_.clear();
+  }
+}
+
+// True if b can run right after a in a chain of filters. Nothing else may
+// listen to a or feed b
+bool UGenGraphBuilder::fuses_with(Disc *a, Disc *b){
+  GraphData &da = data_[a];
+  GraphData &db = data_[b];
+  return da.fusible_ && db.fusible_ && da.outputs_.size() == 1
+         && db.inputs_.size() == 1 && db.inputs_[0] == a;
 }
 
-double UGenGraphBuilder::get_mix_level(Disc *a, Disc *b){
-  if (a < b)return wet_levels_[a][b];
-  return wet_levels_[b][a];
+// True if every sample is below UnitGenerator::kTailLevel
+bool UGenGraphBuilder::is_silent(double *buffer, int length){
+  for (int i = 0; i < length; ++i){
+    if (fabs(buffer[i]) >= UnitGenerator::kTailLevel) return false;
+  }
+  return true;
 }
 
+// Counts how long a node's input has been silent. True once that is
+// longer than the tail, so the node's output has decayed to nothing
+bool UGenGraphBuilder::update_silence(Disc *k, bool silent, int length, int tail){
+  int &count = data_[k].silent_samples_;
+  // Wakes up as soon as there is signal
+  if (!silent){
+    count = 0;
+    return false;
+  }
+  if (tail >= 0 && count >= tail) return true;
+  // Stops counting once asleep, so this can't overflow
+  count += length;
+  return false;
+}
 
-double UGenGraphBuilder::compute_mix_level(Disc *a, Disc *b){
-  double both_radii = a->get_radius() + b->get_radius();
-  double separation = (a->pos_ - b->pos_).length() - both_radii;
+// Finds the mix level of every wire, old and new, from the discs' latest
+// positions. Each current wire's level and its input's fan out are folded
+// into one gain for the wet and one for the dry
+void UGenGraphBuilder::find_mix_levels(){
+  capture_positions();
+  int num_nodes = inputs_.size() + midi_modules_.size() + fx_.size() + to_delete_.size();
+  for (int i = 0; i < num_nodes; ++i) data_[indexed(i)].index_ = i;
+  for (int i = 0; i < num_nodes; ++i){
+    GraphData &d = data_[indexed(i)];
+    for (int j = 0; j < d.past_inputs_.size(); ++j){
+      d.past_wet_levels_[j] = compute_mix_level(i, data_[d.past_inputs_[j]].index_);
+    }
+    for (int j = 0; j < d.inputs_.size(); ++j){
+      double wet_level = compute_mix_level(i, data_[d.inputs_[j]].index_);
+      double scale = scale_factor(data_[d.inputs_[j]].outputs_.size());
+      d.wet_gains_[j] = wet_level * scale;
+      d.dry_gains_[j] = (1 - wet_level) * scale;
+    }
+  }
+}
+
+
+// Finds the mix level for the discs at indices a and b
+double UGenGraphBuilder::compute_mix_level(int a, int b){
+  double both_radii = indexed(a)->get_radius() + indexed(b)->get_radius();
+  double separation = (positions_[a] - positions_[b]).length() - both_radii;
   double mix = 1 - separation/(kMaxDist- both_radii);
   mix = fmax(0, fmin(1, mix));
   return mix;
@@ -423,27 +651,18 @@ void UGenGraphBuilder::lock_thread(bool lock){
   else audio_lock_.unlock();
 }
 
+// Takes the mutex only if it is free. Returns true if it was taken
+bool UGenGraphBuilder::try_lock_thread(){
+  return audio_lock_.tryLock();
+}
 
 
 
-// Passes any audio samples to the Input ugens. 
-void UGenGraphBuilder::handoff_audio(double sample){
-  int i = 0;
-  // Process each effect in chain
-  while (i < inputs_.size()) {
-    static_cast<Input *>(inputs_.at(i)->get_ugen())->set_sample( sample );
-    ++i;
-  }
-}
 
-// Passes any audio samples to the Input ugens. 
-void UGenGraphBuilder::handoff_audio_buffer(double buffer[], int length){
-  int i = 0;
-  // Process each effect in chain
-  while (i < inputs_.size()) {
-    static_cast<Input *>(inputs_.at(i)->get_ugen())->set_buffer( buffer, length );
-    ++i;
-  }
+// Shows the device's interleaved input to the Input ugens. Every input
+// reads the same block, picking out its own channel
+void UGenGraphBuilder::handoff_audio_buffer(const double *buffer, int frames, int channels){
+  Input::set_device_input(buffer, frames, channels);
 }
 
 // Passes any midi notes the MidiUnitGenerators. Decides using the
@@ -479,8 +698,6 @@ void UGenGraphBuilder::update_graphics_dependencies(){
   
   int inputs, outputs;
   for (int i = 0; i < num_nodes; ++i){
-    indexed(i)->excite(indexed(i)->get_ugen()->buffer_energy());
-
     // Shuffles Orbs around
     if (rand()%6 == 0){
       outputs = data_[indexed(i)].outputs_.size();
@@ -510,6 +727,29 @@ void UGenGraphBuilder::update_graphics_dependencies(){
   }
 }
 
+// Lights the discs with the levels of their latest buffers and shows the
+// loopers' beats. The levels and beats are published by the audio thread
+// without locking. Only this thread adds and removes discs, so the lists
+// can be read here without the lock too
+void UGenGraphBuilder::update_meters(){
+  int num_nodes = inputs_.size() + midi_modules_.size() + fx_.size();
+  double peak, rms;
+  for (int i = 0; i < num_nodes; ++i){
+    if (indexed(i)->get_ugen()->meter()->read(peak, rms)) indexed(i)->excite(rms);
+  }
+
+  // The looper may have been removed since its beat was posted, and
+  // another made in its place. A beat whose disc is gone is dropped
+  Looper::Beat beat;
+  while (Looper::next_beat(beat)){
+    for (int i = 0; i < fx_.size(); ++i){
+      if (fx_[i]->getID() == beat.disc_id && fx_[i]->get_ugen()->is_looper()){
+        static_cast<Looper *>(fx_[i]->get_ugen())->show_beat(beat.message);
+      }
+    }
+  }
+}
+
 // #------------ Modify Graph -------------#
 
 
@@ -559,6 +799,9 @@ bool UGenGraphBuilder::remove_disc(Disc *d){
     if ((*it) == d){
       to_delete_.push_back(*it);
       it = vec->erase(it);
+      // A disc without wires doesn't change the hash, but it still has to
+      // fade out and be deleted
+      ++epoch_;
       return true;
     } 
     else ++it;
@@ -566,6 +809,13 @@ bool UGenGraphBuilder::remove_disc(Disc *d){
   return false;
 }
 
+// Lists every disc in the graph, not counting ones waiting to be deleted
+void UGenGraphBuilder::get_discs(std::vector<Disc *> &discs){
+  discs.insert(discs.end(), inputs_.begin(), inputs_.end());
+  discs.insert(discs.end(), midi_modules_.begin(), midi_modules_.end());
+  discs.insert(discs.end(), fx_.begin(), fx_.end());
+}
+
 bool UGenGraphBuilder::finalize_delete(){
   if (to_delete_.size() == 0) return false;
 
@@ -583,7 +833,6 @@ bool UGenGraphBuilder::finalize_delete(){
         else ++itr;
       }
     }
-    
     delete *it;
     it = to_delete_.erase(it);
   } 
@@ -594,40 +843,35 @@ bool UGenGraphBuilder::finalize_delete(){
 // #--------------- FFT ----------------#
 
 
-// The graphics thread can grab this and display it. This keeps an average of the
-// most recent spectra
+// The graphics thread can grab this and display it. Runs the analyzer over
+// any new output of the spotlight disc and smooths the result
 void UGenGraphBuilder::calculate_fft(){
-  int num_fft_stored = 16;
-  if (Disc::spotlight_disc_ != NULL){
-    complex *fft_ = new complex[buffer_length_];
-    Disc::spotlight_disc_->get_ugen()->buffer_fft(buffer_length_, fft_);
-    fft_list_.push_back(fft_);
-    if (fft_list_.size() > num_fft_stored){
-      delete[] *fft_list_.begin();
-      fft_list_.pop_front();
-    }
-  }
-  
-  for (int i = 0; i < buffer_length_; ++i){
-    fft_visual_[i] = 0;
-  }
-  double weight, weight_total = 0;
-  int k = 0;
-  for (std::list<complex *>::iterator it = fft_list_.begin(); 
-      it!=fft_list_.end(); ++it){
-    weight = 1/(++k*1.0+7);
-    for (int i = 0; i < buffer_length_; ++i){
-      fft_visual_[i]+= (*it)[i] * weight;
-    }
-    weight_total += weight;
+  analyzer_->analyze();
+}
+
+double *UGenGraphBuilder::get_fft(){ return analyzer_->get_bands(); }
+
+// The analyzer can be configured independently of the buffer size.
+// Values of zero leave the current setting unchanged
+void UGenGraphBuilder::configure_analyzer(int fft_size, int hop_size){
+  lock_thread(true);
+  if (fft_size > 0) analyzer_->set_fft_size(fft_size);
+  if (hop_size > 0) analyzer_->set_hop_size(hop_size);
+  lock_thread(false);
+}
+
+// Copies the spotlight disc's most recent buffer into the analyzer. The
+// history is cleared whenever a different disc is selected
+void UGenGraphBuilder::feed_analyzer(int frames){
+  if (Disc::spotlight_disc_ != analyzed_disc_){
+    analyzer_->clear();
+    analyzed_disc_ = Disc::spotlight_disc_;
   }
-  for (int i = 0; i < buffer_length_; ++i){
-    fft_visual_[i] /= weight_total;
+  if (analyzed_disc_ != NULL){
+    analyzer_->push_samples(analyzed_disc_->get_ugen()->current_buffer(), frames);
   }
 }
 
-complex *UGenGraphBuilder::get_fft(){ return fft_visual_; }
-
 
 // #--------------- UI ----------------#
 
@@ -706,9 +950,24 @@ const char *UGenGraphBuilder::text_box_label(){
 
 
 
-// The distance between two discs
-double UGenGraphBuilder::get_edge_cost(Disc* a, Disc* b){
-  return (a->pos_ - b->pos_).length();
+// The distance between the discs at indices a and b
+double UGenGraphBuilder::get_edge_cost(int a, int b){
+  return (positions_[a] - positions_[b]).length();
+}
+
+// Copies every disc's position from the latest physics tick, all from the
+// same tick. If the physics keeps writing, the last try is used. rebuild()
+// captures first, so the list only grows there, or for a disc added since
+void UGenGraphBuilder::capture_positions(){
+  int num_nodes = inputs_.size() + midi_modules_.size() + fx_.size() + to_delete_.size();
+  if (positions_.size() < num_nodes) positions_.resize(num_nodes);
+  for (int attempt = 0; attempt < Physics::kMaxSnapshotRetries; ++attempt){
+    unsigned int sequence = Physics::begin_snapshot();
+    for (int i = 0; i < num_nodes; ++i){
+      positions_[i] = Physics::snapshot_position(indexed(i));
+    }
+    if (Physics::end_snapshot(sequence)) break;
+  }
 }
 
 
@@ -729,6 +988,14 @@ Disc *UGenGraphBuilder::indexed(int i){
 
 
 
+// Zeroes the first length samples of a node's scratch. It only grows if
+// the device hands us a bigger buffer than it promised
+double *UGenGraphBuilder::clear_scratch(std::vector<double> &buffer, int length){
+  if (buffer.size() < length) buffer.resize(length);
+  for (int i = 0; i < length; ++i) buffer[i] = 0;
+  return &buffer[0];
+}
+
 // Scales down due to fan out
 double UGenGraphBuilder::scale_factor(int factor){
   double scale = 1;
@@ -16,8 +16,11 @@
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <stdint.h>
 #include "UnitGenerator.h"
 #include "DigitalFilter.h" 
+#include "OutputStage.h"
+#include "SpectrumAnalyzer.h"
 #include "Disc.h"
 #include "Thread.h"
 
@@ -37,6 +40,10 @@ public:
 
   void initialize(int buffer_length, int sample_rate);
 
+  // Changes the buffer length and sample rate of every unit generator in
+  // the graph. The audio stream must be stopped while this is called
+  void reconfigure(int buffer_length, int sample_rate);
+
   // Prints all data about the graph, including the nodes,
   // their type and positions
   void print_all();
@@ -48,16 +55,25 @@ public:
   // Changes the mutex. Should be called when using anything related to the 
   // audio path
   void lock_thread(bool lock);
+  // Takes the mutex only if it is free. Returns true if it was taken
+  bool try_lock_thread();
 
   // Processes a single buffer. Note that you must first handoff audio 
   // and midi data to the graph by using the handoff_audio and 
-  // handoff midi functions
-  void load_buffer(double *out, int length);
+  // handoff midi functions. The mix is written to every channel of the
+  // interleaved output
+  void load_buffer(double *out, int length, int channels = 1);
+
+  // Filters, scales and limits the mix on its way out
+  OutputStage *output_stage(){ return &output_stage_; }
 
+  // Turns off bypassing silent nodes and fusing chains of filters, for
+  // comparison
+  void set_optimize(bool optimize){ optimize_ = optimize; }
 
-  // Passes any audio samples to the Input ugens. 
-  void handoff_audio(double samples);
-  void handoff_audio_buffer(double *buffer, int samples);
+  // Shows the device's interleaved input to the Input ugens. Nothing is
+  // copied, so the buffer must stay put until load_buffer has run
+  void handoff_audio_buffer(const double *buffer, int frames, int channels = 1);
 
   // Passes any midi notes the MidiUnitGenerators. Decides using the
   // value of velocity whether the event is a note on or a note off
@@ -67,6 +83,10 @@ public:
   // audio buffers. It is called from the graphics thread
   void update_graphics_dependencies();
 
+  // Lights the discs with the levels of their latest buffers and shows
+  // the loopers' beats. Called from the graphics thread without the lock
+  void update_meters();
+
   // Lets the other thread know that the FFT is ready to compute
   void signal_new_buffer();
   bool is_new_buffer(){return buffer_ready_;}
@@ -90,17 +110,25 @@ public:
   // Removes a disc from the graph and deletes the disc
   bool remove_disc(Disc *ugen);
 
+  // Lists every disc in the graph, not counting ones waiting to be deleted
+  void get_discs(std::vector<Disc *> &discs);
+
 
   
   // #--------------- FFT ----------------#
 
   
-  // The graphics thread can grab this and display it. This keeps an average of the
-  // most recent spectra
+  // The graphics thread can grab this and display it. Runs the analyzer over
+  // any new output of the spotlight disc and smooths the result
   void calculate_fft();
 
-  complex *get_fft();
-  int get_fft_length(){return buffer_length_/2;}
+  // The smoothed log-frequency bands of the spotlight disc's output
+  double *get_fft();
+  int get_fft_length(){return analyzer_->get_num_bands();}
+
+  // The analyzer can be configured independently of the buffer size.
+  // Values of zero leave the current setting unchanged
+  void configure_analyzer(int fft_size, int hop_size);
   
   // #--------------- UI ----------------#
 
@@ -124,13 +152,18 @@ public:
 
 private:
 
-  // Finds the signature for the current graph
-  std::string compute_signature();
+  // Hashes a directed wire. The hash of a graph is the sum over its wires,
+  // so it doesn't depend on the order they were found in
+  static uint64_t wire_hash(Disc *from, Disc *to);
   // All discs scheduled for deletion are removed (called after buffer is generated)
   bool finalize_delete();
 
-  // The distance between two discs
-  double get_edge_cost(Disc* a, Disc* b);
+  // The distance between the discs at indices a and b
+  double get_edge_cost(int a, int b);
+
+  // Copies every disc's position from the latest physics tick, all from
+  // the same tick. The physics may be moving them on another thread
+  void capture_positions();
 
   // Reverses the push architecture of "out = tick(in)" to recursively pull
   // samples to the output sinks from the inputs. past_data allows us to use
@@ -139,15 +172,36 @@ private:
   // State - 0: Normal, 1: Prepare, 2: Recall
   double *pull_result_buffer(Disc *k, int length, int state = 0);
 
+  // Mixes a node's inputs into its wet and dry buffers
+  void mix_inputs(Disc *k, int length, int state, double *wet, double *dry);
+
+  // Runs a chain of filters that ends at k in one pass
+  double *pull_chain(Disc *k, int length);
+
+  // Plans the next buffer. Finds the nodes that get no wet signal and the
+  // chains of filters that can run in one pass
+  void optimize();
+
+  // True if b can run right after a in a chain of filters
+  bool fuses_with(Disc *a, Disc *b);
+
+  // True if every sample is below UnitGenerator::kTailLevel
+  static bool is_silent(double *buffer, int length);
+  // Counts how long a node's input has been silent. True once that is
+  // longer than the tail, so the node's output has decayed to nothing
+  bool update_silence(Disc *k, bool silent, int length, int tail);
+
   // Reverses the "to" and "from" ends of a wire
   void switch_wire_direction(Wire &w);
 
-  // Finds the mix level for two discs based on their proximity
-  double compute_mix_level(Disc *a, Disc *b);
-  // Computes all mix levels pairwise
+  // Finds the mix level for the discs at indices a and b based on their
+  // proximity
+  double compute_mix_level(int a, int b);
+  // Computes the mix level and the gains of every wire
   void find_mix_levels();
-  //Returns the calculated mix level
-  double get_mix_level(Disc *a, Disc *b);
+
+  // Zeroes the first length samples of a node's scratch and returns it
+  static double *clear_scratch(std::vector<double> &buffer, int length);
 
   // Returns 1/sqrt(factor)
   double scale_factor(int factor);
@@ -155,9 +209,13 @@ private:
   // Allows all ugens to be called uniformly
   Disc *indexed(int i);
 
+  // Copies the spotlight disc's most recent buffer into the analyzer
+  void feed_analyzer(int frames);
+
   int buffer_length_;
-  std::list<complex *> fft_list_;
-  complex *fft_visual_;
+  SpectrumAnalyzer *analyzer_;
+  // The disc whose output is currently in the analyzer's history
+  Disc *analyzed_disc_;
   bool buffer_ready_;
 
   
@@ -171,19 +229,31 @@ private:
   
   // Data containing the current connections
   std::map < Disc *, GraphData > data_;
-  std::map < Disc *, std::map <Disc *, double> > wet_levels_;
+  // The discs' positions, as of capture_positions(), in the order of
+  // indexed()
+  std::vector<Vector3d> positions_;
   // Protects the audio and graphics thread from
   // concurrency issues
   Mutex audio_lock_;
 
 
-  //Filters to process the output. Just for quality's sake...
-  DigitalLowpassFilter *anti_aliasing_;
-  DigitalHighpassFilter *low_pass_;
+  // The sum of the sinks, before the output stage
+  std::vector<double> mix_;
+  OutputStage output_stage_;
+
+  // Whether optimize() bypasses and fuses nodes
+  bool optimize_;
+  // The biquads of the chain being run
+  std::vector<Biquad> chain_biquads_;
 
   // Comparable description of graph
-  std::string signature_;
-  std::string past_signature_;
+  uint64_t topology_hash_;
+  // Counts the changes to the graph. The buffer after a change crossfades
+  // from the old graph to the new one
+  unsigned int epoch_, buffer_epoch_;
+  // The epoch and the physics snapshot the mix levels were last found for
+  bool planned_;
+  unsigned int planned_epoch_, planned_sequence_;
   
 };
 
@@ -201,8 +271,33 @@ struct GraphData{
   bool past_computed;
 
   bool need_crossfade_;
-  double *crossfade_dry_;
-  double *crossfade_wet_;
+  // The old graph's mix into the node, sized by rebuild()
+  std::vector<double> crossfade_dry_;
+  std::vector<double> crossfade_wet_;
+
+  // The wet and dry mix of the node's inputs, sized by rebuild()
+  std::vector<double> wet_;
+  std::vector<double> dry_;
+
+  // Samples since the input was last above UnitGenerator::kTailLevel
+  int silent_samples_;
+
+  // The node's place in indexed(), as of find_mix_levels()
+  int index_;
+  // Set by find_mix_levels() for each of the past inputs, which the
+  // prepare pass mixes as the old graph did
+  std::vector<double> past_wet_levels_;
+  // Each input's mix level and fan out folded into one gain for the wet
+  // and one for the dry
+  std::vector<double> wet_gains_;
+  std::vector<double> dry_gains_;
+  // No wet signal reaches the node, only its dry path is heard
+  bool bypass_;
+  // The node's biquads can run as part of a chain
+  bool fusible_;
+  // The filters that run in one pass and end at this node, first to last.
+  // Empty unless this node ends a chain
+  std::vector<Disc *> chain_;
   
 };
 
@@ -14,9 +14,6 @@
 int UnitGenerator::sample_rate = 44100;
 int UnitGenerator::buffer_length = 512;
 
-float interpolate(float *array, int length, double index);
-double interpolate(double *array, int length, double index);
-
 
 // #--------------Unit Generator Base Classes ----------------#
 
@@ -26,12 +23,39 @@ void UnitGenerator::set_audio_settings(int bl, int sr){
   DigitalFilter::set_sample_rate(sr);
 }
 
+// Reallocates the block buffer and recomputes anything that depends on
+// the sample rate. Must only be called while the audio stream is stopped
+void UnitGenerator::prepare(int bl, int sr){
+  if (bl != ugen_buffer_size_){
+    delete[] ugen_buffer_;
+    ugen_buffer_size_ = bl;
+    ugen_buffer_ = new double[ugen_buffer_size_];
+  }
+  for (int i = 0; i < ugen_buffer_size_; i++){
+    ugen_buffer_[i] = 0;
+  }
+}
+
 // Allows user to set the generic parameters, bounds must already be set
 void UnitGenerator::set_params(double p1, double p2){
   param1_ = clamp(p1, 1);
   param2_ = clamp(p2, 2);
 }
 
+// Writes the parameters to a session. Subclasses with audio history
+// write it after these
+void UnitGenerator::write_session(SessionWriter &w){
+  w.write_double(param1_);
+  w.write_double(param2_);
+}
+
+// Reads back the parameters
+void UnitGenerator::read_session(SessionReader &r){
+  double p1 = r.read_double();
+  double p2 = r.read_double();
+  set_params(p1, p2);
+}
+
 // Allows entire buffers to be processed at once
 double *UnitGenerator::process_buffer(double *buffer, int length){
   if (length != ugen_buffer_size_) printf("Buffer size mismatch! Input: %d  internal: %d\n", length, ugen_buffer_size_);
@@ -55,13 +79,11 @@ double UnitGenerator::buffer_energy(){
 void UnitGenerator::buffer_fft(int full_length, complex *out){
   if (full_length != ugen_buffer_size_) printf("FFT Buffer size mismatch! Input: %d  internal: %d\n", full_length, ugen_buffer_size_);
   complex *complex_arr_ = new complex[ugen_buffer_size_];
+  // Hann window is applied to the samples before the transform
   for (int i = 0; i < ugen_buffer_size_; ++i){
-    complex_arr_[i] = ugen_buffer_[i];
+    complex_arr_[i] = ugen_buffer_[i] * 0.5 * (1 - cos(6.2831853 * i/(ugen_buffer_size_-1)));
   }
   CFFT::Forward(complex_arr_, out, full_length);
-    for (int i = 0; i < ugen_buffer_size_; ++i){
-    out[i] = out[i] * 0.5 * (1 + cos(6.2831853 * i/(ugen_buffer_size_-1)));
-  }
   delete[] complex_arr_;
 }
 
@@ -101,6 +123,25 @@ double UnitGenerator::clamp(double param_in, int which){
   return param_in < min_param ? min_param : param_in;
 }
 
+// Samples for a feedback loop to decay to kTailLevel, counting the first
+// trip around it. -1 if it never does
+int UnitGenerator::feedback_tail(double loop_samples, double gain){
+  gain = fabs(gain);
+  if (gain >= 1) return -1;
+  double trips = 1;
+  if (gain > 0) trips += ceil(log(kTailLevel) / log(gain));
+  // Anything this long may as well ring forever
+  double tail = ceil(loop_samples * trips);
+  return tail > kMaxTail ? -1 : static_cast<int>(tail);
+}
+
+// Samples for a resonant second order filter to decay to kTailLevel. Its
+// envelope falls by a factor of e every Q / (pi * f) seconds
+int UnitGenerator::resonance_tail(double frequency, double Q){
+  double tau = std::max(Q, 0.5) / (3.14159265 * frequency);
+  return static_cast<int>(ceil(tau * log(1 / kTailLevel) * sample_rate));
+}
+
 const char *UnitGenerator::report_param(int which){
   std::stringstream s;
   if (which == 1 & report_param1_ != NULL) {
@@ -148,6 +189,12 @@ double MidiUnitGenerator::tick(){
   return myCW_->tick();
 }
 
+// Keeps the envelope times the same at the new sample rate
+void MidiUnitGenerator::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  myCW_->set_sample_rate(sr);
+}
+
 UGenState *MidiUnitGenerator::save_state(){
   MidiInputState *s = new MidiInputState();
   s->buffer_length_ = ugen_buffer_size_;
@@ -172,13 +219,17 @@ MidiInputState::~MidiInputState(){delete[] buffer_;}
 
 // #------------Unit Generator Inherited Classes --------------#
 
+const double *Input::device_input_ = NULL;
+int Input::device_frames_ = 0;
+int Input::device_channels_ = 1;
+
 Input::Input(){
     name_ = "Input";
     param1_name_ = "Volume";
-    param2_name_ = "Not Used";
-    set_limits(0, 10, 0, 1);
-    set_params(1, 0);
-    define_printouts(&param1_, "", NULL, "");
+    param2_name_ = "Channel";
+    set_limits(0, 10, 1, kMaxChannels);
+    set_params(1, 1);
+    define_printouts(&param1_, "", &param2_, "");
     ugen_buffer_size_ = UnitGenerator::buffer_length;
     ugen_buffer_ = new double[ugen_buffer_size_];
     for (int i = 0; i < ugen_buffer_size_; i++){
@@ -190,33 +241,55 @@ Input::Input(){
   }
 Input::~Input(){}
 
-// Pulls the current sample out of the buffer and advances the read index
+// Pulls the current sample out of the device input and advances the
+// read index
 double Input::tick(double in){ 
-  double out = ugen_buffer_[current_index_];
+  double out = 0;
+  if (device_input_ != NULL && current_index_ < device_frames_){
+    out = device_input_[current_index_ * device_channels_ + channel()];
+  }
   current_index_ = (current_index_ + 1) % ugen_buffer_size_;
   return param1_*out; 
 }  
 
-// Sets the sample at the current index in the buffer
-void Input::set_sample(double val){ 
-  ugen_buffer_[current_index_] = val; 
+// Reads the whole block of the chosen channel, applying the volume. The
+// input to the disc is ignored
+double *Input::process_buffer(double *buffer, int length){
+  if (length != ugen_buffer_size_) printf("Buffer size mismatch! Input: %d  internal: %d\n", length, ugen_buffer_size_);
+  int frames = device_input_ == NULL ? 0 : std::min(length, device_frames_);
+  const double *in = device_input_ + channel();
+  int stride = device_channels_;
+  for (int i = 0; i < frames; ++i) ugen_buffer_[i] = param1_ * in[i * stride];
+  for (int i = frames; i < length; ++i) ugen_buffer_[i] = 0;
+  current_index_ = 0;
+  return ugen_buffer_;
 }
 
-// Sets the entire buffer
-void Input::set_buffer(double buffer[], int length){ 
-  if (length != ugen_buffer_size_) {
-    printf("Resizing input buffer\n");
-    ugen_buffer_size_ = length;
-    delete[] ugen_buffer_;
-    ugen_buffer_ = new double[ugen_buffer_size_];
-  }
-  for (int i = 0; i < length; ++i){
-    ugen_buffer_[i] = buffer[i];
-  }
-  // Reset read buffer 
+// The channel is a whole number
+void Input::set_params(double p1, double p2){
+  UnitGenerator::set_params(p1, floor(p2 + 0.5));
+}
+
+// Resizes the buffer and resets the read index
+void Input::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
   current_index_ = 0;
 }
 
+// Points every input at the device's interleaved input for the current
+// callback
+void Input::set_device_input(const double *buffer, int frames, int channels){
+  device_input_ = buffer;
+  device_frames_ = frames;
+  device_channels_ = std::max(channels, 1);
+}
+
+// The channel to read. Channels the device doesn't have fall back to its
+// last one
+int Input::channel(){
+  return std::min(static_cast<int>(param2_) - 1, device_channels_ - 1);
+}
+
 UGenState* Input::save_state(){
   InputState *s = new InputState();
   s->buffer_length_ = ugen_buffer_size_;
@@ -494,7 +567,6 @@ Chorus::~Chorus(){
 // https://ccrma.stanford.edu/~dattorro/EffectDesignPart2.pdf
 double Chorus::tick(double in){
   double blend =  0.7071;//1.0;
-  double feedback = 0.7071;
   double feedforward = 1.0;
   //feedback
   double buf_fb = buf_write_ - sample_rate_ * kDelayCenter + buffer_size_;
@@ -505,7 +577,7 @@ double Chorus::tick(double in){
         depth_* sin(rate_hz_ * sample_count_)) + buffer_size_;
   buf_read = fmod(buf_read,buffer_size_);
   
-  buffer_[buf_write_] = in - feedback * interpolate(buffer_, buffer_size_, buf_fb);
+  buffer_[buf_write_] = DENORMAL_GUARD(in - kFeedback * interpolate(buffer_, buffer_size_, buf_fb));
   double output = feedforward * interpolate(buffer_, buffer_size_, buf_read) + blend * buffer_[buf_write_];
   
   //Wrap variables to prevent out-of-bounds/overflow
@@ -533,6 +605,27 @@ void Chorus::set_params(double p1, double p2){
   
 }
 
+// The feedback loop rings at the center delay, the swept tap adds up to
+// the maximum delay on top of that
+int Chorus::tail_length(){
+  return feedback_tail(kDelayCenter * sample_rate_, kFeedback) + ceil(kMaxDelay * sample_rate_);
+}
+
+// Reallocates the delay line for the new sample rate
+void Chorus::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  // Keeps the LFO in phase
+  sample_count_ *= sr / (1.0 * sample_rate_);
+  sample_rate_ = sr;
+  set_params(param1_, param2_);
+
+  delete[] buffer_;
+  buffer_size_ = ceil((kMaxDelay + kDelayCenter)*sample_rate_);
+  buffer_ = new double[buffer_size_];
+  for (int i = 0; i < buffer_size_; ++i) buffer_[i] = 0;
+  buf_write_ = 0;
+}
+
 UGenState* Chorus::save_state(){
   ChorusState *s = new ChorusState();
   s->buf_write_ = buf_write_;
@@ -557,6 +650,26 @@ void Chorus::recall_state(UGenState *state){
   delete state;
 }
 
+// Writes the delay line and the phase of the LFO after the parameters
+void Chorus::write_session(SessionWriter &w){
+  UnitGenerator::write_session(w);
+  w.write_int(buf_write_);
+  w.write_double(sample_count_);
+  w.write_block(buffer_, buffer_size_ * sizeof(double));
+}
+void Chorus::read_session(SessionReader &r){
+  UnitGenerator::read_session(r);
+  int buf_write = r.read_int();
+  double sample_count = r.read_double();
+  int bytes;
+  const void *buffer = r.read_block(bytes);
+  // The delay line is a different length at other sample rates
+  if (bytes != buffer_size_ * sizeof(double) || buf_write >= buffer_size_) return;
+  buf_write_ = buf_write;
+  sample_count_ = sample_count;
+  memcpy(buffer_, buffer, bytes);
+}
+
 
 
 
@@ -594,16 +707,6 @@ Delay::Delay(double p1, double p2){
 Delay::~Delay(){
   delete[] buffer_;
 }
-// Processes a single sample in the unit generator
-double Delay::tick(double in){
-  float buf_read = fmod(buf_write_ - buffer_size_ + max_buffer_size_, max_buffer_size_);
-  float read_sample = interpolate(buffer_, max_buffer_size_, buf_read);
-  buffer_[buf_write_] = in + param2_ * read_sample;
-  double out =  in + read_sample;
-  ++buf_write_;
-  buf_write_ %= max_buffer_size_;
-  return out;
-}
 
 void Delay::set_params(double p1, double p2){
   param1_ = clamp(p1, 1);
@@ -613,6 +716,23 @@ void Delay::set_params(double p1, double p2){
   
 }
 
+// Each repeat is quieter by the feedback
+int Delay::tail_length(){
+  return feedback_tail(buffer_size_, param2_);
+}
+
+// Reallocates the delay line for the new sample rate
+void Delay::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  sample_rate_ = sr;
+  delete[] buffer_;
+  max_buffer_size_= ceil(sample_rate_ * max_param1_);
+  buffer_size_ = ceil(sample_rate_ * param1_);
+  buffer_ = new float[max_buffer_size_];
+  for (int i = 0; i < max_buffer_size_; ++i) buffer_[i] = 0;
+  buf_write_ = 0;
+}
+
 
 UGenState* Delay::save_state(){
   DelayState *s = new DelayState();
@@ -636,6 +756,23 @@ void Delay::recall_state(UGenState *state){
   delete state;
 }
 
+// Writes the delay line after the parameters
+void Delay::write_session(SessionWriter &w){
+  UnitGenerator::write_session(w);
+  w.write_int(buf_write_);
+  w.write_block(buffer_, max_buffer_size_ * sizeof(float));
+}
+void Delay::read_session(SessionReader &r){
+  UnitGenerator::read_session(r);
+  int buf_write = r.read_int();
+  int bytes;
+  const void *buffer = r.read_block(bytes);
+  // The delay line is a different length at other sample rates
+  if (bytes != max_buffer_size_ * sizeof(float) || buf_write >= max_buffer_size_) return;
+  buf_write_ = buf_write;
+  memcpy(buffer_, buffer, bytes);
+}
+
 
 
 
@@ -671,21 +808,14 @@ Distortion::~Distortion(){
   delete f_;
   delete inv_;
 }
-// Processes a single sample in the unit generator
-double Distortion::tick(double in){
-  double gain_adj = f_->dc_gain();
-  double offset = 0.00;//4;
-  //in = f_->tick(in).re() / gain_adj;
-  in = param1_ * in + offset;
-  double out = 0;
-  // Cubic transfer function
-  if (in > 1) out = 2/3.0;
-  else if (in < -1) out = -2/3.0;
-  else out = in - pow(in, 3)/3.0;
-  out -= offset - pow(offset, 3)/3.0;
-  //out = inv_->tick(out).re() * gain_adj;
-  return param2_ * out;
-}  
+
+// Recomputes the filters for the new sample rate
+void Distortion::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  f_->reset_coefficients();
+  delete inv_;
+  inv_ = f_->create_inverse();
+}
 
 UGenState* Distortion::save_state(){
   DistortionState *s = new DistortionState();
@@ -740,15 +870,6 @@ Filter::~Filter(){
   delete f2_;
 }
 
-// Processes a single sample in the unit generator
-double Filter::tick(double in){
-  double factor = 1;
-  if (currently_lowpass_)
-    factor = 1/f_->dc_gain();
-  else
-    factor = 1/f_->hf_gain();
-  return factor * f2_->tick(factor * f_->tick(in)).re();
-}
 
 // Tells the filter to change parameters
 void Filter::set_params(double p1, double p2){
@@ -758,6 +879,23 @@ void Filter::set_params(double p1, double p2){
   f2_->change_parameters(param1_, param2_, 1);
 }
 
+// The two sections ring one after the other
+int Filter::tail_length(){
+  return 2 * resonance_tail(param1_, param2_);
+}
+
+// The two sections, each normalized the same way tick does it
+bool Filter::load_biquads(Biquad *b){
+  double factor = currently_lowpass_ ? 1 / f_->dc_gain() : 1 / f_->hf_gain();
+  bool settled = f_->load_biquad(b[0], factor);
+  return f2_->load_biquad(b[1], factor) && settled;
+}
+
+void Filter::store_biquads(const Biquad *b){
+  f_->store_biquad(b[0]);
+  f2_->store_biquad(b[1]);
+}
+
 // The filter can be either high or low pass.
 // True for lowpass, False for highpass
 void Filter::set_lowpass(bool lowpass){
@@ -782,6 +920,13 @@ void Filter::set_lowpass(bool lowpass){
 
 }
 
+// Recomputes the filters for the new sample rate
+void Filter::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  f_->reset_coefficients();
+  f2_->reset_coefficients();
+}
+
 UGenState* Filter::save_state(){
   FilterState *s = new FilterState();
   s->f_state_ = f_->get_state();
@@ -795,6 +940,16 @@ void Filter::recall_state(UGenState *state){
   delete state;
 }
 
+// Writes the type of filter after the parameters
+void Filter::write_session(SessionWriter &w){
+  UnitGenerator::write_session(w);
+  w.write_int(currently_lowpass_);
+}
+void Filter::read_session(SessionReader &r){
+  UnitGenerator::read_session(r);
+  set_lowpass(r.read_int() != 0);
+}
+
 
 
 
@@ -836,6 +991,24 @@ void Bandpass::set_params(double p1, double p2){
   f_->change_parameters(param1_, param2_, 1);
 }
 
+int Bandpass::tail_length(){
+  return resonance_tail(param1_, param2_);
+}
+
+bool Bandpass::load_biquads(Biquad *b){
+  return f_->load_biquad(b[0], 1);
+}
+
+void Bandpass::store_biquads(const Biquad *b){
+  f_->store_biquad(b[0]);
+}
+
+// Recomputes the filter for the new sample rate
+void Bandpass::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  f_->reset_coefficients();
+}
+
 UGenState* Bandpass::save_state(){
   BandpassState *s = new BandpassState();
   s->f_state_ = f_->get_state();
@@ -926,6 +1099,23 @@ void Granular::set_params(double p1, double p2){
   
 }
 
+// A granule can start anywhere in the history and plays out in full
+int Granular::tail_length(){
+  return buffer_size_ + static_cast<int>(param1_);
+}
+
+// Reallocates the one second history for the new sample rate
+void Granular::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  sample_rate_ = sr;
+  delete[] buffer_;
+  buffer_size_= ceil(sample_rate_);
+  buffer_ = new double[buffer_size_];
+  for (int i = 0; i < buffer_size_; ++i) buffer_[i] = 0;
+  buf_write_ = 0;
+  granules_.clear();
+}
+
 UGenState* Granular::save_state(){
   GranularState *s = new GranularState();
   s->buf_write_ = buf_write_;
@@ -950,6 +1140,27 @@ void Granular::recall_state(UGenState *state){
   delete state;
 }
 
+// Writes the history and the granules that are playing after the 
+// parameters
+void Granular::write_session(SessionWriter &w){
+  UnitGenerator::write_session(w);
+  w.write_int(buf_write_);
+  w.write_block(buffer_, buffer_size_ * sizeof(double));
+  w.write_block(granules_.empty() ? NULL : &granules_[0], granules_.size() * sizeof(Granule));
+}
+void Granular::read_session(SessionReader &r){
+  UnitGenerator::read_session(r);
+  int buf_write = r.read_int();
+  int bytes, granule_bytes;
+  const void *buffer = r.read_block(bytes);
+  const Granule *granules = static_cast<const Granule *>(r.read_block(granule_bytes));
+  // The history is a different length at other sample rates
+  if (bytes != buffer_size_ * sizeof(double) || buf_write >= buffer_size_) return;
+  buf_write_ = buf_write;
+  memcpy(buffer_, buffer, bytes);
+  granules_.assign(granules, granules + granule_bytes / sizeof(Granule));
+}
+
 
 
 
@@ -960,6 +1171,8 @@ The looper effect keeps a section of the input in a buffer and loops it back
   param1 = beats per minute
   param2 = number of beats
 */
+SpscQueue<Looper::Beat, Looper::kBeatQueueSize> Looper::beats_;
+
 Looper::Looper(){
   name_ = "Looper";
   param1_name_ = "BPM";
@@ -986,18 +1199,23 @@ Looper::Looper(){
     ugen_buffer_[i] = 0;
   }
 
-  buffer_ = NULL;
+  storage_ = NULL;
 
   click_data.first = 0;
+  pulsefnc = NULL;
+  data = NULL;
+  disc_id = -1;
   click_data.second = 0;
 }
 Looper::~Looper(){
-  //destroy float buffer
-  if (params_set_) delete[] buffer_;
+  //destroy the recording
+  delete storage_;
 }
 // Processes a single sample in the unit generator
 double Looper::tick(double in){
   if (!params_set_) return 0;
+  // Lets streamed storage fetch ahead of the heads
+  storage_->follow(buf_read_, buf_write_);
   //Keeps track of beats
   ++beat_count_;
   if (beat_count_ > 60 * sample_rate_ / param1_) {
@@ -1008,7 +1226,7 @@ double Looper::tick(double in){
   }
   //Stores the current input
   if (is_recording_){
-    buffer_[buf_write_] = in;
+    if (buf_write_ < buffer_size_) storage_->write(buf_write_, in);
     ++buf_write_;
   }
   //Plays back the recording
@@ -1021,7 +1239,7 @@ double Looper::tick(double in){
     if (buffer_size_ - buf_read_ < 10){
       fadeout = (buffer_size_ - buf_read_)/10.0;
     }
-    double out =  buffer_[buf_read_] * fadeout;
+    double out =  storage_->read(buf_read_) * fadeout;
     ++buf_read_;
     buf_read_ %= buffer_size_;
     return out;
@@ -1036,10 +1254,35 @@ void Looper::set_params(double a, double b){
   
 }
 
+// Resamples any recording so that it plays back at the same tempo
+void Looper::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  double ratio = sr / (1.0 * sample_rate_);
+  sample_rate_ = sr;
+  beat_count_ = beat_count_ * ratio;
+  if (!params_set_) return;
+
+  int new_size = ceil(60* sample_rate_ * param2_ / param1_);
+  float *recording = new float[buffer_size_];
+  storage_->read_block(0, buffer_size_, recording);
+  float *resampled = new float[new_size];
+  for (int i = 0; i < new_size; ++i){
+    resampled[i] = interpolate(recording, buffer_size_, i / ratio);
+  }
+  delete storage_;
+  storage_ = LoopStorage::create(new_size);
+  storage_->write_block(0, new_size, resampled);
+  delete[] recording;
+  delete[] resampled;
+  buffer_size_ = new_size;
+  buf_write_ = std::min(static_cast<int>(buf_write_ * ratio), buffer_size_ - 1);
+  buf_read_ = std::min(static_cast<int>(buf_read_ * ratio), buffer_size_ - 1);
+}
+
 void Looper::pulse(){
   //printf("Pulse! %d\n",this_beat_);
   if (counting_down_){
-    if (pulsefnc!=NULL) pulsefnc(data, this_beat_);
+    post_beat(this_beat_);
     this_beat_ = (this_beat_ - 1);
     if (this_beat_ < 0){
       this_beat_ = 0;
@@ -1049,9 +1292,8 @@ void Looper::pulse(){
   else {
     this_beat_ = (this_beat_+1);//count either way
     //tells it when to stop
-    if ((is_recording_ || has_recording_) 
-                        && pulsefnc!=NULL){ 
-      pulsefnc(data, -100);
+    if (is_recording_ || has_recording_){ 
+      post_beat(-100);
     }
 
     if (this_beat_ == round(param2_)){
@@ -1059,22 +1301,40 @@ void Looper::pulse(){
       if (is_recording_){
         
         stop_recording();
-        if (pulsefnc!=NULL) pulsefnc(data, -4);
+        post_beat(-4);
       }
     }
   }
 }
 
+// Queues a beat for the graphics thread. A beat that doesn't fit is
+// dropped, the disc just misses a flash
+void Looper::post_beat(int message){
+  Beat beat;
+  beat.disc_id = disc_id;
+  beat.message = message;
+  beats_.push(beat);
+}
+
+// Takes the oldest beat from any looper. Called only from the graphics
+// thread
+bool Looper::next_beat(Beat &beat){
+  return beats_.pop(beat);
+}
+
+// Passes a beat on to the disc
+void Looper::show_beat(int message){
+  if (pulsefnc != NULL) pulsefnc(data, message);
+}
+
 // Starts counting down beats until recording starts 
 void Looper::start_countdown(){
   if (!params_set_){
     buffer_size_ = ceil(60* sample_rate_ * param2_ / param1_);
-    //Makes empty buffer
-    buffer_ = new float[buffer_size_];
-  }
-  for (int i = 0; i < buffer_size_; ++i) {
-    buffer_[i] = 0;
+    //Makes empty storage, long loops may be streamed to disk
+    storage_ = LoopStorage::create(buffer_size_);
   }
+  else storage_->clear();
   params_set_ = true;
 
   this_beat_ = start_counter_;
@@ -1124,13 +1384,22 @@ UGenState* Looper::save_state(){
   s->this_beat_ = this_beat_;
   s->beat_count_ = beat_count_;
   s->start_counter_ = start_counter_;
-  if (buffer_ != NULL){
-    s->buffer_ = new float[s->buffer_size_];
-    for (int i = 0; i < s->buffer_size_; ++i){
-      s->buffer_[i] = buffer_[i];
+  s->counting_down_ = counting_down_;
+  s->is_recording_ = is_recording_;
+  s->has_recording_ = has_recording_;
+
+  // The state is recalled after a single buffer, so only the samples that
+  // could be recorded over in that time are kept. A count in may end and
+  // start recording from the top during the buffer
+  s->checkpoint_length_ = 0;
+  if (storage_ != NULL && (is_recording_ || counting_down_)){
+    s->checkpoint_start_ = is_recording_ ? buf_write_ : 0;
+    s->checkpoint_length_ = std::max(0, std::min(ugen_buffer_size_, buffer_size_ - s->checkpoint_start_));
+    s->checkpoint_ = new float[s->checkpoint_length_];
+    for (int i = 0; i < s->checkpoint_length_; ++i){
+      s->checkpoint_[i] = storage_->read(s->checkpoint_start_ + i);
     }
   }
-  else s->buffer_ = NULL;
   return s;
 }
 
@@ -1145,16 +1414,73 @@ void Looper::recall_state(UGenState *state){
     this_beat_ = s->this_beat_;
     beat_count_ = s->beat_count_;
     start_counter_ = s->start_counter_;
-    if (s->buffer_ != NULL){
-      for (int i = 0; i < s->buffer_size_; ++i){
-        buffer_[i] = s->buffer_[i];
-      }
+    counting_down_ = s->counting_down_;
+    is_recording_ = s->is_recording_;
+    has_recording_ = s->has_recording_;
+    for (int i = 0; i < s->checkpoint_length_; ++i){
+      storage_->write(s->checkpoint_start_ + i, s->checkpoint_[i]);
     }
   } else { printf("Mismatched buffer size (Looper::Recall_State)\n"); }
   
   delete state;
 }
 
+// Writes the recording and where the loop is in its cycle after the
+// parameters
+void Looper::write_session(SessionWriter &w){
+  UnitGenerator::write_session(w);
+  w.write_int(start_counter_);
+  w.write_int(params_set_);
+  w.write_int(counting_down_);
+  w.write_int(is_recording_);
+  w.write_int(has_recording_);
+  w.write_int(buf_write_);
+  w.write_int(buf_read_);
+  w.write_int(this_beat_);
+  w.write_int(beat_count_);
+  int length = params_set_ ? buffer_size_ : 0;
+  float *recording = static_cast<float *>(w.reserve_block(length * sizeof(float)));
+  // The audio thread is waiting, so what a streamed loop has only on the
+  // disk is read later, once it has been let go
+  if (length > 0) w.defer(storage_->copy_out(0, length, recording));
+}
+
+// The recording is restored at the rate it was made, then resampled like 
+// any other change of sample rate
+void Looper::read_session(SessionReader &r){
+  UnitGenerator::read_session(r);
+  start_counter_ = r.read_int();
+  bool params_set = r.read_int() != 0;
+  bool counting_down = r.read_int() != 0;
+  bool is_recording = r.read_int() != 0;
+  bool has_recording = r.read_int() != 0;
+  int buf_write = r.read_int();
+  int buf_read = r.read_int();
+  int this_beat = r.read_int();
+  int beat_count = r.read_int();
+  int bytes;
+  const float *recording = static_cast<const float *>(r.read_block(bytes));
+  if (!params_set || bytes < sizeof(float) || r.failed()) return;
+
+  delete storage_;
+  buffer_size_ = bytes / sizeof(float);
+  storage_ = LoopStorage::create(buffer_size_);
+  storage_->write_block(0, buffer_size_, recording);
+  params_set_ = true;
+  counting_down_ = counting_down;
+  is_recording_ = is_recording;
+  has_recording_ = has_recording;
+  buf_write_ = std::max(0, buf_write);
+  buf_read_ = std::min(std::max(0, buf_read), buffer_size_ - 1);
+  this_beat_ = this_beat;
+  beat_count_ = beat_count;
+  sample_rate_ = r.sample_rate();
+  if (sample_rate_ != UnitGenerator::sample_rate){
+    prepare(ugen_buffer_size_, UnitGenerator::sample_rate);
+  }
+  storage_->prefetch(buf_read_, buf_write_);
+}
+
 
 
 
@@ -1205,6 +1531,14 @@ void RingMod::set_params(double p1, double p2){
   rate_hz_ = 6.2831853 / (1.0 * sample_rate_) * p1;
 }
 
+// Keeps the modulation frequency and phase at the new sample rate
+void RingMod::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  sample_count_ = sample_count_ * (sr / (1.0 * sample_rate_));
+  sample_rate_ = sr;
+  set_params(param1_, param2_);
+}
+
 UGenState* RingMod::save_state(){
   RingModState *s = new RingModState();
   s->sample_count_ = sample_count_;
@@ -1224,7 +1558,8 @@ void RingMod::recall_state(UGenState *state){
 
 
 /*
-The reverb effect convolves the signal with an impulse response
+The reverb effect is a network of parallel comb filters followed by 
+allpass filters, after Freeverb
   param1 = room size
   param2 = damping
 */
@@ -1241,24 +1576,37 @@ Reverb::Reverb(double p1, double p2){
 
   param1_ = p1;
   param2_ = p2;
+  build_filters();
+  ugen_buffer_size_ = UnitGenerator::buffer_length;
+  ugen_buffer_ = new double[ugen_buffer_size_];
+  for (int i = 0; i < ugen_buffer_size_; i++){
+    ugen_buffer_[i] = 0;
+  }
+}
+
+Reverb::~Reverb(){
+  delete_filters();
+}
+
+// Creates the comb and allpass filters. The delays are tuned for
+// 44.1kHz and are scaled to the current sample rate
+void Reverb::build_filters(){
   // Comb filtering
   fb_ = new FilterBank();
   for (int i = 0; i < 8; ++i){
-    FilteredFeedbackCombFilter *k = new FilteredFeedbackCombFilter(kCombDelays[i], param1_, param2_);
+    FilteredFeedbackCombFilter *k = new FilteredFeedbackCombFilter(scaled_delay(kCombDelays[i]), param1_, param2_);
     fb_->add_filter(k);  
+    combs_[i] = k;
   }
   // Allpass filtering  
   for (int i = 0; i < 4; ++i){
-    aaf_.push_back(new AllpassApproximationFilter(kAllPassDelays[i], 0.5));
+    aaf_.push_back(new AllpassApproximationFilter(scaled_delay(kAllPassDelays[i]), kAllPassGain));
+    allpasses_[i] = aaf_.back();
   }  
-  ugen_buffer_size_ = UnitGenerator::buffer_length;
-  ugen_buffer_ = new double[ugen_buffer_size_];
-  for (int i = 0; i < ugen_buffer_size_; i++){
-    ugen_buffer_[i] = 0;
-  }
 }
 
-Reverb::~Reverb(){
+// Frees the comb and allpass filters
+void Reverb::delete_filters(){
   std::list<AllpassApproximationFilter *>::iterator it;
   it = aaf_.begin();
   // Deletes all filters
@@ -1266,23 +1614,33 @@ Reverb::~Reverb(){
     delete (*it);
     ++it;
   }
+  aaf_.clear();
   delete fb_;
 }
 
-// Processes a single sample in the unit generator
-double Reverb::tick(double in){
-  // This should probably use 1/sqrt(8), but it's too loud as it is...
-  complex sample = fb_->tick(.125*in);
-  
-  // Ticks each allpass
-  std::list<AllpassApproximationFilter *>::iterator it;
-  it = aaf_.begin();
-  while (aaf_.size() > 0 && it != aaf_.end()) {
-    sample = (*it)->tick(sample);
-    ++it;
-  }
-  return sample.re();
-}  
+// Number of samples in a delay tuned for 44.1kHz
+int Reverb::scaled_delay(int samples){
+  return static_cast<int>(round(samples * UnitGenerator::sample_rate / 44100.0));
+}
+
+// The longest comb rings for the longest, its output then runs through
+// each allpass in turn
+int Reverb::tail_length(){
+  int longest = 0;
+  for (int i = 0; i < 8; ++i) longest = std::max(longest, scaled_delay(kCombDelays[i]));
+  int tail = feedback_tail(longest, param1_);
+  if (tail < 0) return -1;
+  for (int i = 0; i < 4; ++i) tail += feedback_tail(scaled_delay(kAllPassDelays[i]), kAllPassGain);
+  return tail;
+}
+
+// Rebuilds the delay lines, scaled for the new sample rate
+void Reverb::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  delete_filters();
+  build_filters();
+}
+
 
 void Reverb::set_params(double p1, double p2){
   param1_ = clamp(p1, 1);
@@ -1293,7 +1651,7 @@ void Reverb::set_params(double p1, double p2){
   it = fb_->filters_.begin();
   while (fb_->filters_.size() > 0 && it != fb_->filters_.end()) {
     FilteredFeedbackCombFilter *apf = static_cast<FilteredFeedbackCombFilter *>(*it);
-    apf->change_parameters(kCombDelays[i++], param1_, param2_);
+    apf->change_parameters(scaled_delay(kCombDelays[i++]), param1_, param2_);
     apf->sp_->change_parameters(param2_, 1 - param2_, 1.0);
     ++it;
   }
@@ -1347,6 +1705,178 @@ void Reverb::recall_state(UGenState *state){
 
 
 
+/*
+The convolution reverb convolves the signal with an impulse response 
+loaded from a WAV file
+  param1 = level
+  param2 = damping
+*/
+double *ConvolutionReverb::impulse_response_ = NULL;
+int ConvolutionReverb::ir_length_ = 0;
+int ConvolutionReverb::ir_sample_rate_ = 44100;
+
+// Loads the impulse response that every ConvolutionReverb uses. 
+// Returns false if the file could not be read
+bool ConvolutionReverb::load_impulse_response(const char *path){
+  int length, rate;
+  double *samples = WavFile::read_mono(path, length, rate);
+  if (samples == NULL) return false;
+  if (length < 1){
+    printf("%s has no samples\n", path);
+    delete[] samples;
+    return false;
+  }
+  int max_length = static_cast<int>(kMaxLength * rate);
+  if (length > max_length){
+    printf("Impulse response cut off after %.0f s\n", kMaxLength);
+    length = max_length;
+  }
+  delete[] impulse_response_;
+  impulse_response_ = samples;
+  ir_length_ = length;
+  ir_sample_rate_ = rate;
+  printf("Impulse response: %s, %.2f s at %d Hz\n", path, length / (1.0 * rate), rate);
+  return true;
+}
+
+ConvolutionReverb::ConvolutionReverb(double p1, double p2){
+  name_ = "IR Reverb";
+  param1_name_ = "Level";
+  param2_name_ = "Damping";
+  set_limits(0, 1, 0, 1);
+  define_printouts(&param1_, "", &report_hz_, "Hz");
+
+  convolver_ = NULL;
+  damping_state_ = 0;
+  ugen_buffer_size_ = UnitGenerator::buffer_length;
+  ugen_buffer_ = new double[ugen_buffer_size_];
+  for (int i = 0; i < ugen_buffer_size_; i++){
+    ugen_buffer_[i] = 0;
+  }
+  build_convolver();
+  set_params(p1, p2);
+}
+
+ConvolutionReverb::~ConvolutionReverb(){
+  delete convolver_;
+}
+
+// Processes a single sample in the unit generator. This delays the 
+// output by one block, process_buffer does not
+double ConvolutionReverb::tick(double in){
+  double out;
+  convolver_->process(&in, &out, 1);
+  apply_damping(&out, 1);
+  return out;
+}
+
+// Convolves a whole buffer at once
+double *ConvolutionReverb::process_buffer(double *buffer, int length){
+  if (length != ugen_buffer_size_) printf("Buffer size mismatch! Input: %d  internal: %d\n", length, ugen_buffer_size_);
+  convolver_->process(buffer, ugen_buffer_, length);
+  apply_damping(ugen_buffer_, length);
+  return ugen_buffer_;
+}
+
+void ConvolutionReverb::set_params(double p1, double p2){
+  param1_ = clamp(p1, 1);
+  param2_ = clamp(p2, 2);
+  gain_ = kMaxGain * param1_;
+
+  // Non linear scaling, most of the travel is spent on the darker end
+  double cutoff = kMinCutoff + (kMaxCutoff - kMinCutoff) * pow(1 - param2_, 2);
+  cutoff = std::min(cutoff, 0.45 * UnitGenerator::sample_rate);
+  report_hz_ = cutoff;
+  damping_coeff_ = 1 - exp(-6.2831853 * cutoff / UnitGenerator::sample_rate);
+}
+
+// The response, then the damping filter settling
+int ConvolutionReverb::tail_length(){
+  return response_length_ + feedback_tail(1, 1 - damping_coeff_);
+}
+
+// Repartitions the impulse response for the new block size and 
+// resamples it to the new sample rate
+void ConvolutionReverb::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  damping_state_ = 0;
+  build_convolver();
+  set_params(param1_, param2_);
+}
+
+UGenState* ConvolutionReverb::save_state(){
+  ConvolutionReverbState *s = new ConvolutionReverbState();
+  s->convolver_state_ = convolver_->save_state();
+  s->damping_state_ = damping_state_;
+  return s;
+}
+
+void ConvolutionReverb::recall_state(UGenState *state){
+  ConvolutionReverbState *s = static_cast<ConvolutionReverbState *>(state);
+  convolver_->recall_state(s->convolver_state_);
+  s->convolver_state_ = NULL;
+  damping_state_ = s->damping_state_;
+  delete state;
+}
+
+// Resamples and normalizes the impulse response and builds the 
+// convolver for the current block size
+void ConvolutionReverb::build_convolver(){
+  delete convolver_;
+
+  // The convolver adds no latency as long as its blocks line up with the
+  // buffers, so it uses the largest power of two that fits
+  int block = 1;
+  while (2 * block <= ugen_buffer_size_) block *= 2;
+
+  // Without a file, the response is a single impulse
+  int length = 1;
+  double *ir;
+  if (impulse_response_ == NULL){
+    ir = new double[1];
+    ir[0] = 1;
+  }
+  else {
+    // Linear interpolation is enough here, the response is mostly noise
+    double step = ir_sample_rate_ / (1.0 * UnitGenerator::sample_rate);
+    length = std::max(1, static_cast<int>(ir_length_ / step));
+    ir = new double[length];
+    for (int i = 0; i < length; ++i){
+      double index = i * step;
+      int j = static_cast<int>(index);
+      double next = j + 1 < ir_length_ ? impulse_response_[j + 1] : 0;
+      ir[i] = impulse_response_[j] + (index - j) * (next - impulse_response_[j]);
+    }
+  }
+
+  // Scaled to unit energy so that every response is about as loud
+  double energy = 0;
+  for (int i = 0; i < length; ++i) energy += ir[i] * ir[i];
+  if (energy > 0){
+    double scale = 1.0 / sqrt(energy);
+    for (int i = 0; i < length; ++i) ir[i] *= scale;
+  }
+
+  convolver_ = new PartitionedConvolver(ir, length, block);
+  response_length_ = length + block;
+  delete[] ir;
+}
+
+// Applies the level and damping to the convolved buffer
+void ConvolutionReverb::apply_damping(double *buffer, int length){
+  for (int i = 0; i < length; ++i){
+    damping_state_ += damping_coeff_ * (buffer[i] - damping_state_);
+    damping_state_ = DENORMAL_GUARD(damping_state_);
+    buffer[i] = gain_ * damping_state_;
+  }
+}
+
+
+
+
+
+
+
 /*
 The Tremolo effect modulates the amplitude of the signal
   param1 = rate
@@ -1392,6 +1922,14 @@ void Tremolo::set_params(double p1, double p2){
   rate_hz_ = 6.2831853 / (1.0 * sample_rate_) * p1;
 }
 
+// Keeps the rate and phase at the new sample rate
+void Tremolo::prepare(int bl, int sr){
+  UnitGenerator::prepare(bl, sr);
+  sample_count_ = sample_count_ * (sr / (1.0 * sample_rate_));
+  sample_rate_ = sr;
+  set_params(param1_, param2_);
+}
+
 UGenState* Tremolo::save_state(){
   TremoloState *s = new TremoloState();
   s->sample_count_ = sample_count_;
@@ -1408,22 +1946,4 @@ void Tremolo::recall_state(UGenState *state){
 
 
 
-// Gets the interpolated value between two samples of array
-double interpolate(double *array, int length, double index){
-  int trunc_index = static_cast<int>(floor(index));
-  double leftover = index-1.0*trunc_index;
-  double sample_one = array[(trunc_index + length)%length];
-  double sample_two = array[(trunc_index + length + 1)%length];
-  double output = sample_one*(1-leftover) + sample_two*leftover;
-  return output;
-}
-
-// Gets the interpolated value between two samples of array
-float interpolate(float *array, int length, double index){
-  int trunc_index = floor(index);
-  float leftover = index-trunc_index;
-  float sample_one = array[(trunc_index + length)%length];
-  float sample_two = array[(trunc_index + length + 1)%length];
-  return sample_one*(1-leftover) + sample_two*leftover;
-}
 
@@ -19,6 +19,12 @@
 #include <sstream>
 #include "ClassicWaveform.h"
 #include "DigitalFilter.h"
+#include "LevelMeter.h"
+#include "SpscQueue.h"
+#include "LoopStorage.h"
+#include "PartitionedConvolver.h"
+#include "SessionFile.h"
+#include "WavFile.h"
 #include "complex.h"
 #include "fft.h"
 
@@ -34,9 +40,18 @@ public:
   static int sample_rate;
   static int buffer_length;
 
+  // Level at which a decaying tail counts as silent (-80 dB)
+  static const double kTailLevel = 1e-4;
+  // Tails longer than this many samples are treated as endless
+  static const double kMaxTail = 1e8;
+
   //Set the buffer length and sample rate
   static void set_audio_settings(int bl, int sr);
 
+  // Reallocates the block buffer and recomputes anything that depends on
+  // the sample rate. Must only be called while the audio stream is stopped
+  virtual void prepare(int bl, int sr);
+
   // Processes a single sample in the unit generator
   virtual double tick(double in) = 0;
 
@@ -47,18 +62,42 @@ public:
   virtual bool is_input() = 0;
   virtual bool is_midi() = 0;
   virtual bool is_looper() = 0;
+
+  // The number of samples of output that can follow the last input that
+  // wasn't silent. Unit generators that make sound on their own return -1
+  // and are never put to sleep
+  virtual int tail_length(){ return 0; }
+
+  // Linear time invariant unit generators can be run as a cascade of
+  // biquads, so the graph can run a chain of them in one pass.
+  // load_biquads returns false while the coefficients are still gliding
+  virtual int num_biquads(){ return 0; }
+  virtual bool load_biquads(Biquad *b){ return false; }
+  // Takes the history back after the graph has run the biquads
+  virtual void store_biquads(const Biquad *b){}
   
   virtual UGenState *save_state() = 0;
   virtual void recall_state(UGenState *state) = 0;
+
+  // Writes the parameters and any audio history to a session
+  virtual void write_session(SessionWriter &w);
+  // Reads back what write_session wrote. History that doesn't fit the
+  // current sample rate is skipped
+  virtual void read_session(SessionReader &r);
   
   // Allows entire buffers to be processed at once
-  double *process_buffer(double *buffer, int length);
+  virtual double *process_buffer(double *buffer, int length);
   double *current_buffer(){return ugen_buffer_;}
 
   // The absolute average of the samples in the buffer. Used to 
   // calculate brightness
   double buffer_energy();
 
+  // Measures the latest buffer. Called from the audio thread, the levels
+  // can be read from any other thread through meter()
+  void update_meter(){ meter_.measure(ugen_buffer_, ugen_buffer_size_); }
+  LevelMeter *meter(){ return &meter_; }
+
   // Get the fft of the buffer's current contents
   void buffer_fft(int full_length, complex *out);
 
@@ -81,9 +120,18 @@ protected:
   // valid range
   double clamp(double param_in, int which);
 
+  // Samples for a feedback loop to decay to kTailLevel, counting the first
+  // trip around it. -1 if it never does
+  static int feedback_tail(double loop_samples, double gain);
+
+  // Samples for a resonant second order filter to decay to kTailLevel
+  static int resonance_tail(double frequency, double Q);
+
   // Used for block processing of buffer
   int ugen_buffer_size_;
   double *ugen_buffer_;
+  // The levels of the latest buffer, for the graphics thread
+  LevelMeter meter_;
 
   void define_printouts(double *report_param1, const char *p1_units, 
                         double *report_param2, const char *p2_units);
@@ -115,10 +163,14 @@ public:
   // A wrapper for the UnitGenerator's tick function
   double tick(double in){ return tick(); }
 
+  // Keeps the envelope times the same at the new sample rate
+  void prepare(int bl, int sr);
+
   // Allows outside world to distinguish between types of UnitGenerators
   bool is_input(){ return true; }
   bool is_looper(){ return false; }
   bool is_midi(){ return true; }
+  int tail_length(){ return -1; }
 
   UGenState *save_state();
   void recall_state(UGenState *state);
@@ -137,27 +189,48 @@ public:
 
 
 /*
-The input unit gen just returns what it was given
-  parameters are ignored
+The input unit gen reads one channel of the sound card's input
+  param1 = volume
+  param2 = channel, counting from one
+Every input disc reads the same block of the device's input, which is
+handed off once per callback rather than copied into each disc
 */
 class Input : public UnitGenerator {
 public:
+  // The most input channels a disc can choose from
+  static const int kMaxChannels = 8;
+
   Input();
   ~Input();
-  // Pulls the current sample out of the buffer and advances the read index
+  // Pulls the current sample out of the device input and advances the
+  // read index
   double tick(double in);
+  // Reads the whole block of the chosen channel, applying the volume
+  double *process_buffer(double *buffer, int length);
+  // The channel is a whole number
+  void set_params(double p1, double p2);
   bool is_input(){ return true; }
   bool is_looper(){ return false; }
   bool is_midi(){ return false; }
-  // Sets the sample at the current index in the buffer
-  void set_sample(double val);
-  // Sets the entire buffer
-  void set_buffer(double buffer[], int length);
+  int tail_length(){ return -1; }
+  // Resizes the buffer and resets the read index
+  void prepare(int bl, int sr);
+
+  // Points every input at the device's interleaved input for the current
+  // callback. The samples aren't copied, so they must stay put until the
+  // graph has been processed. NULL reads as silence
+  static void set_device_input(const double *buffer, int frames, int channels);
   
   UGenState *save_state();
   void recall_state(UGenState *state);
 
 private:
+  // The channel to read, within what the device provides
+  int channel();
+
+  static const double *device_input_;
+  static int device_frames_, device_channels_;
+
   double current_value_;
   int current_index_; 
 };
@@ -240,6 +313,8 @@ public:
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
   bool is_midi(){ return false; }
+  // The last sample is held for up to the downsampling factor
+  int tail_length(){ return static_cast<int>(param2_); }
 
   UGenState *save_state();
   void recall_state(UGenState *state);
@@ -273,6 +348,7 @@ public:
   static const double kDelayCenter = 0.0175;// s
   static const double kMaxFreq = 10.0;// Hz
   static const double kMinFreq = .020;// Hz
+  static const double kFeedback = 0.7071;
   
   Chorus(double p1 = 0.5, double p2 = 0.5);
   ~Chorus();
@@ -282,15 +358,21 @@ public:
   // restricts parameters to range (0,1) and calculates other parameters,
   // including the rate in Hz and the max delay change
   void set_params(double p1, double p2);
+  // Reallocates the delay line for the new sample rate
+  void prepare(int bl, int sr);
 
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
   bool is_midi(){ return false; }
+  int tail_length();
   bool needs_buffer_patch(){ return true; }
 
   UGenState *save_state();
   void recall_state(UGenState *state);
 
+  void write_session(SessionWriter &w);
+  void read_session(SessionReader &r);
+
 private:
   int buf_write_;
   int buffer_size_;
@@ -329,14 +411,20 @@ public:
   double tick(double in);  
   // reallocates the buffer if the delay length changes
   void set_params(double p1, double p2);
+  // Reallocates the delay line for the new sample rate
+  void prepare(int bl, int sr);
 
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
   bool is_midi(){ return false; }
+  int tail_length();
   bool needs_buffer_patch(){ return true; }
 
   UGenState *save_state();
   void recall_state(UGenState *state);
+
+  void write_session(SessionWriter &w);
+  void read_session(SessionReader &r);
   
 private:
   int buf_write_;
@@ -370,6 +458,8 @@ public:
 
   // Processes a single sample in the unit generator
   double tick(double in);  
+  // Recomputes the filters for the new sample rate
+  void prepare(int bl, int sr);
   
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
@@ -412,14 +502,23 @@ public:
   // True for lowpass, False for highpass
   void set_lowpass(bool lowpass);
   bool is_lowpass(){return currently_lowpass_;};
+  // Recomputes the filters for the new sample rate
+  void prepare(int bl, int sr);
 
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
   bool is_midi(){ return false; }
+  int tail_length();
+  int num_biquads(){ return 2; }
+  bool load_biquads(Biquad *b);
+  void store_biquads(const Biquad *b);
 
   UGenState *save_state();
   void recall_state(UGenState *state);
 
+  void write_session(SessionWriter &w);
+  void read_session(SessionReader &r);
+
 private:
   DigitalFilter *f_, *f2_;
   bool currently_lowpass_;
@@ -447,10 +546,16 @@ public:
   double tick(double in);
   // casts the parameters to ints and restricts them to a certain value
   void set_params(double p1, double p2);
+  // Recomputes the filter for the new sample rate
+  void prepare(int bl, int sr);
 
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
   bool is_midi(){ return false; }
+  int tail_length();
+  int num_biquads(){ return 1; }
+  bool load_biquads(Biquad *b);
+  void store_biquads(const Biquad *b);
 
   UGenState *save_state();
   void recall_state(UGenState *state);
@@ -488,14 +593,20 @@ public:
   double tick(double in);  
   // reallocates the buffer if the delay length changes
   void set_params(double p1, double p2);
+  // Reallocates the one second history for the new sample rate
+  void prepare(int bl, int sr);
 
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
   bool is_midi(){ return false; }
+  int tail_length();
   bool needs_buffer_patch(){ return true; }
 
   UGenState *save_state();
   void recall_state(UGenState *state);
+
+  void write_session(SessionWriter &w);
+  void read_session(SessionReader &r);
   
 private:
   int buf_write_;
@@ -534,6 +645,9 @@ public:
   
   // reallocates the buffer if the delay length changes
   void set_params(double p1, double p2);
+
+  // Resamples any recording so that it plays back at the same tempo
+  void prepare(int bl, int sr);
   
   // Starts counting down beats until recording starts 
   void start_countdown();
@@ -544,10 +658,29 @@ public:
   bool is_input(){ return has_recording_; }
   bool is_looper(){ return true; }
   bool is_midi(){ return false; }
+  bool has_recording(){ return has_recording_; }
+  int tail_length(){ return -1; }
   
   UGenState *save_state();
   void recall_state(UGenState *state);
+
+  void write_session(SessionWriter &w);
+  void read_session(SessionReader &r);
   void patch_buffer(double *buffer, int length);
+
+  // A beat that the disc has yet to show. The message is the one passed
+  // to pulsefnc. The looper is known by its disc's ID rather than its
+  // address, which a looper made after this one was deleted could reuse
+  struct Beat {
+    int disc_id;
+    int message;
+  };
+  static const int kBeatQueueSize = 64;
+  // Takes the oldest beat from any looper. Called only from the graphics
+  // thread
+  static bool next_beat(Beat &beat);
+  // Passes a beat on to the disc
+  void show_beat(int message);
   
   // Used in the disc. Stored here so that we don't allocate
   // this memory for every disc. Used only for state transitions
@@ -555,6 +688,8 @@ public:
   std::pair<long, long> click_data;
   void (*pulsefnc)(void *,int);
   void *data;
+  // The ID of the disc in data, which each beat is tagged with
+  int disc_id;
   
   char param3_str_[8];
   
@@ -567,10 +702,16 @@ private:
   
   // Cue for a single beat
   void pulse();
+  // Queues a beat for the graphics thread. The audio thread never calls
+  // into the disc itself
+  void post_beat(int message);
+
+  // Every looper ticks on the audio thread, so they can share one queue
+  static SpscQueue<Beat, kBeatQueueSize> beats_;
 
   int start_counter_;
   bool params_set_;
-  float *buffer_;
+  LoopStorage *storage_;
   int buf_write_, buf_read_;
   int buffer_size_;
   int sample_rate_;
@@ -583,9 +724,9 @@ private:
 
 class LooperState : public UGenState {
 public:
-  LooperState(){buffer_ = NULL;};
+  LooperState(){checkpoint_ = NULL;};
   ~LooperState(){
-    if (buffer_!=NULL) delete[] buffer_;
+    if (checkpoint_!=NULL) delete[] checkpoint_;
   }
   bool params_set_;
   bool counting_down_;
@@ -596,7 +737,9 @@ public:
   int sample_rate_;
   int this_beat_;
   int beat_count_;
-  float *buffer_;
+  // Only the samples that the next buffer could record over
+  float *checkpoint_;
+  int checkpoint_start_, checkpoint_length_;
 };
 
 
@@ -618,6 +761,8 @@ public:
   double tick(double in);
   // casts the parameters to ints and restricts them to a certain value
   void set_params(double p1, double p2);
+  // Keeps the modulation frequency and phase at the new sample rate
+  void prepare(int bl, int sr);
 
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
@@ -641,7 +786,8 @@ public:
 
 
 /*
-The reverb effect convolves the signal with an impulse response
+The reverb effect is a network of parallel comb filters followed by 
+allpass filters, after Freeverb
   param1 = room size
   param2 = damping
 */
@@ -649,6 +795,7 @@ class Reverb : public UnitGenerator {
 public:
   static const int kCombDelays[];
   static const int kAllPassDelays[];
+  static const double kAllPassGain = 0.5;
   
   Reverb(double p1 = 0.8, double p2 = 0.2);
   ~Reverb();
@@ -656,18 +803,33 @@ public:
   double tick(double in);  
   //Updates the filter variables
   void set_params(double p1, double p2);
+  // Rebuilds the delay lines, scaled for the new sample rate
+  void prepare(int bl, int sr);
 
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
   bool is_midi(){ return false; }
+  int tail_length();
   bool needs_buffer_patch(){ return true; }
 
   UGenState *save_state();
   void recall_state(UGenState *state);
   
 private:
+  // Creates the comb and allpass filters. The delays are tuned for
+  // 44.1kHz and are scaled to the current sample rate
+  void build_filters();
+  // Frees the comb and allpass filters
+  void delete_filters();
+  // Number of samples in a delay tuned for 44.1kHz
+  int scaled_delay(int samples);
+
   FilterBank *fb_;
   std::list<AllpassApproximationFilter *> aaf_;
+  // The same filters as in fb_ and aaf_, by their own types, so that tick
+  // can call them directly
+  FilteredFeedbackCombFilter *combs_[8];
+  AllpassApproximationFilter *allpasses_[4];
 };
 
 class ReverbState : public UGenState {
@@ -683,6 +845,75 @@ public:
 
 
 
+/*
+The convolution reverb convolves the signal with an impulse response 
+loaded from a WAV file
+  param1 = level
+  param2 = damping
+*/
+class ConvolutionReverb : public UnitGenerator {
+public:
+  // Longer responses are cut off
+  static const double kMaxLength = 10.0; // s
+  static const double kMaxGain = 2.0;
+  // Range of the damping filter's cutoff
+  static const double kMinCutoff = 500.0; // Hz
+  static const double kMaxCutoff = 20000.0; // Hz
+
+  // Loads the impulse response that every ConvolutionReverb uses. 
+  // Returns false if the file could not be read
+  static bool load_impulse_response(const char *path);
+  static bool has_impulse_response(){ return impulse_response_ != NULL; }
+
+  ConvolutionReverb(double p1 = 0.5, double p2 = 0.2);
+  ~ConvolutionReverb();
+  // Processes a single sample in the unit generator. This delays the 
+  // output by one block, process_buffer does not
+  double tick(double in);
+  // Convolves a whole buffer at once
+  double *process_buffer(double *buffer, int length);
+  //Updates the level and damping
+  void set_params(double p1, double p2);
+  // Repartitions the impulse response for the new block size and 
+  // resamples it to the new sample rate
+  void prepare(int bl, int sr);
+
+  bool is_input(){ return false; }
+  bool is_looper(){ return false; }
+  bool is_midi(){ return false; }
+  int tail_length();
+  bool needs_buffer_patch(){ return true; }
+
+  UGenState *save_state();
+  void recall_state(UGenState *state);
+
+private:
+  // Resamples and normalizes the impulse response and builds the 
+  // convolver for the current block size
+  void build_convolver();
+  // Applies the level and damping to the convolved buffer
+  void apply_damping(double *buffer, int length);
+
+  // Shared by all instances, at the sample rate of the file
+  static double *impulse_response_;
+  static int ir_length_, ir_sample_rate_;
+
+  PartitionedConvolver *convolver_;
+  // The length of the response plus any queueing in the convolver
+  int response_length_;
+  double gain_, damping_coeff_, damping_state_, report_hz_;
+};
+
+class ConvolutionReverbState : public UGenState {
+public:
+  ConvolutionReverbState(){}
+  ~ConvolutionReverbState(){ delete convolver_state_; }
+  PartitionedConvolverState *convolver_state_;
+  double damping_state_;
+};
+
+
+
 /*
 The tremolo effect modulates the amplitude of the signal
   param1 = rate
@@ -701,6 +932,8 @@ public:
   
   //Updates the parameters
   void set_params(double p1, double p2);
+  // Keeps the rate and phase at the new sample rate
+  void prepare(int bl, int sr);
 
   bool is_input(){ return false; }
   bool is_looper(){ return false; }
@@ -721,4 +954,80 @@ public:
   long sample_count_;
 };
 
+// #------------- Inline kernels --------------#
+// The effects a FrozenChain is usually built from tick here rather than
+// in UnitGenerator.cpp, so that a chain holding them by value can inline
+// the whole of its per-sample loop
+
+// Gets the interpolated value between two samples of array
+inline double interpolate(double *array, int length, double index){
+  int trunc_index = static_cast<int>(floor(index));
+  double leftover = index-1.0*trunc_index;
+  double sample_one = array[(trunc_index + length)%length];
+  double sample_two = array[(trunc_index + length + 1)%length];
+  double output = sample_one*(1-leftover) + sample_two*leftover;
+  return output;
+}
+
+// Gets the interpolated value between two samples of array
+inline float interpolate(float *array, int length, double index){
+  int trunc_index = floor(index);
+  float leftover = index-trunc_index;
+  float sample_one = array[(trunc_index + length)%length];
+  float sample_two = array[(trunc_index + length + 1)%length];
+  return sample_one*(1-leftover) + sample_two*leftover;
+}
+
+// Processes a single sample in the unit generator
+inline double Delay::tick(double in){
+  float buf_read = fmod(buf_write_ - buffer_size_ + max_buffer_size_, max_buffer_size_);
+  float read_sample = interpolate(buffer_, max_buffer_size_, buf_read);
+  buffer_[buf_write_] = DENORMAL_GUARD(in + param2_ * read_sample);
+  double out =  in + read_sample;
+  ++buf_write_;
+  buf_write_ %= max_buffer_size_;
+  return out;
+}
+
+// Processes a single sample in the unit generator
+inline double Distortion::tick(double in){
+  double gain_adj = f_->dc_gain();
+  double offset = 0.00;//4;
+  //in = f_->tick(in).re() / gain_adj;
+  in = param1_ * in + offset;
+  double out = 0;
+  // Cubic transfer function
+  if (in > 1) out = 2/3.0;
+  else if (in < -1) out = -2/3.0;
+  else out = in - pow(in, 3)/3.0;
+  out -= offset - pow(offset, 3)/3.0;
+  //out = inv_->tick(out).re() * gain_adj;
+  return param2_ * out;
+}
+
+// Processes a single sample in the unit generator
+inline double Filter::tick(double in){
+  double factor = 1;
+  if (currently_lowpass_)
+    factor = 1/f_->dc_gain();
+  else
+    factor = 1/f_->hf_gain();
+  // Both sections are plain lowpass or highpass filters, which tick as
+  // any DigitalFilter does
+  return factor * f2_->DigitalFilter::tick(factor * f_->DigitalFilter::tick(in)).re();
+}
+
+// Processes a single sample in the unit generator
+inline double Reverb::tick(double in){
+  // This should probably use 1/sqrt(8), but it's too loud as it is...
+  // The combs are summed in parallel, as fb_->tick would do it, but
+  // without its gain control, which nothing here reads
+  complex sample = 0;
+  for (int i = 0; i < 8; ++i) sample += combs_[i]->FilteredFeedbackCombFilter::tick(.125*in);
+  
+  // Ticks each allpass
+  for (int i = 0; i < 4; ++i) sample = allpasses_[i]->AllpassApproximationFilter::tick(sample);
+  return sample.re();
+}
+
 #endif
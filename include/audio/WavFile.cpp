@@ -0,0 +1,122 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  WavFile.cpp
+  Reads RIFF WAV files.
+*/
+
+#include "WavFile.h"
+
+// Format tags from the fmt chunk
+static const int kFormatPCM = 1;
+static const int kFormatFloat = 3;
+static const int kFormatExtensible = 0xFFFE;
+
+// Reads the file and mixes all of its channels down to mono. Returns a
+// new array of samples between -1 and 1, or NULL if the file could not
+// be read
+double *WavFile::read_mono(const char *path, int &length, int &sample_rate){
+  FILE *file = fopen(path, "rb");
+  if (file == NULL){
+    printf("Could not open %s\n", path);
+    return NULL;
+  }
+
+  unsigned char header[12];
+  if (fread(header, 1, 12, file) != 12 || memcmp(header, "RIFF", 4) != 0
+      || memcmp(header + 8, "WAVE", 4) != 0){
+    printf("%s is not a WAV file\n", path);
+    fclose(file);
+    return NULL;
+  }
+
+  // Walks the chunks until the format and the data have both been found
+  int format = 0, channels = 0, rate = 0, bits = 0;
+  unsigned char chunk[8], fmt[40];
+  unsigned char *data = NULL;
+  uint32_t data_size = 0, size;
+  while (data == NULL && fread(chunk, 1, 8, file) == 8){
+    size = read_u32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && size <= sizeof(fmt)){
+      if (fread(fmt, 1, size, file) != size) break;
+      format = read_u16(fmt);
+      channels = read_u16(fmt + 2);
+      rate = read_u32(fmt + 4);
+      bits = read_u16(fmt + 14);
+      // The real format is the start of the sub format GUID
+      if (format == kFormatExtensible && size >= 26) format = read_u16(fmt + 24);
+    }
+    else if (memcmp(chunk, "data", 4) == 0 && format != 0){
+      data_size = size;
+      data = new unsigned char[data_size];
+      // Files written while recording are often cut short
+      data_size = fread(data, 1, data_size, file);
+    }
+    else if (fseek(file, size, SEEK_CUR) != 0) break;
+    // Chunks are padded to an even number of bytes
+    if (data == NULL && size % 2 == 1) fseek(file, 1, SEEK_CUR);
+  }
+  fclose(file);
+
+  bool supported = (format == kFormatPCM && (bits == 8 || bits == 16 || bits == 24 || bits == 32))
+                   || (format == kFormatFloat && (bits == 32 || bits == 64));
+  if (data == NULL || !supported || channels < 1 || rate < 1){
+    printf("Unsupported WAV file %s (format %d, %d bits, %d channels)\n", path,
+           format, bits, channels);
+    delete[] data;
+    return NULL;
+  }
+
+  int frame_bytes = channels * bits / 8;
+  length = data_size / frame_bytes;
+  sample_rate = rate;
+  double *samples = new double[length];
+  for (int i = 0; i < length; ++i){
+    double sum = 0;
+    for (int j = 0; j < channels; ++j){
+      sum += decode(data + i * frame_bytes + j * bits / 8, format, bits);
+    }
+    samples[i] = sum / channels;
+  }
+  delete[] data;
+  return samples;
+}
+
+// #------------- Private --------------#
+
+// Little endian integers from raw bytes
+uint32_t WavFile::read_u32(const unsigned char *bytes){
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+uint16_t WavFile::read_u16(const unsigned char *bytes){
+  return bytes[0] | (bytes[1] << 8);
+}
+
+// Decodes one sample of the given format to the range -1 to 1
+double WavFile::decode(const unsigned char *bytes, int format, int bits){
+  if (format == kFormatFloat){
+    if (bits == 32){
+      uint32_t raw = read_u32(bytes);
+      float value;
+      memcpy(&value, &raw, 4);
+      return value;
+    }
+    uint64_t raw = read_u32(bytes) | ((uint64_t) read_u32(bytes + 4) << 32);
+    double value;
+    memcpy(&value, &raw, 8);
+    return value;
+  }
+  switch (bits){
+    // 8 bit samples are the only unsigned ones
+    case 8: return (bytes[0] - 128) / 128.0;
+    case 16: return static_cast<int16_t>(read_u16(bytes)) / 32768.0;
+    case 24: {
+      int32_t value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16);
+      if (value & 0x800000) value -= 0x1000000;
+      return value / 8388608.0;
+    }
+    default: return static_cast<int32_t>(read_u32(bytes)) / 2147483648.0;
+  }
+}
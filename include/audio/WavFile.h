@@ -0,0 +1,33 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  WavFile.h
+  Reads RIFF WAV files. Handles 8, 16, 24 and 32 bit integer samples and
+  32 and 64 bit floating point samples with any number of channels.
+*/
+
+#ifndef _WAVFILE_H_
+#define _WAVFILE_H_
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+class WavFile {
+public:
+  // Reads the file and mixes all of its channels down to mono. Returns a
+  // new array of samples between -1 and 1, or NULL if the file could not
+  // be read. length and sample_rate are set on success
+  static double *read_mono(const char *path, int &length, int &sample_rate);
+
+private:
+  // Little endian integers from raw bytes
+  static uint32_t read_u32(const unsigned char *bytes);
+  static uint16_t read_u16(const unsigned char *bytes);
+
+  // Decodes one sample of the given format to the range -1 to 1
+  static double decode(const unsigned char *bytes, int format, int bits);
+};
+
+#endif
@@ -0,0 +1,264 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  OrbSystem.cpp
+  Moves every orb at once.
+*/
+
+#include "OrbSystem.h"
+
+std::vector<float> OrbSystem::px_, OrbSystem::py_, OrbSystem::pz_;
+std::vector<float> OrbSystem::vx_, OrbSystem::vy_, OrbSystem::vz_;
+std::vector<float> OrbSystem::wx_, OrbSystem::wy_, OrbSystem::wz_;
+std::vector<float> OrbSystem::ax_, OrbSystem::ay_, OrbSystem::az_;
+std::vector<float> OrbSystem::lx_, OrbSystem::ly_, OrbSystem::lz_;
+std::vector<float> OrbSystem::hover_;
+std::vector<float> OrbSystem::force_, OrbSystem::damping_, OrbSystem::wander_;
+std::vector<float> OrbSystem::transit_timer_;
+std::vector<float> OrbSystem::death_timer_;
+std::vector<unsigned int> OrbSystem::seed_;
+std::vector<const Vector3d *> OrbSystem::anchor_;
+std::vector<int *> OrbSystem::slots_;
+
+// Adds an orb that hovers around the anchor, starting beside it
+int OrbSystem::add(int *slot_ref, const Vector3d *anchor, double hover){
+  int slot = slots_.size();
+  double x = anchor == NULL ? 0 : anchor->x + hover;
+  double y = anchor == NULL ? 0 : anchor->y;
+  px_.push_back(x); py_.push_back(y); pz_.push_back(0);
+  lx_.push_back(x); ly_.push_back(y); lz_.push_back(0);
+  vx_.push_back(0); vy_.push_back(0); vz_.push_back(0);
+  wx_.push_back(16.0*(rand()/(1.0*RAND_MAX)-.5));
+  wy_.push_back(16.0*(rand()/(1.0*RAND_MAX)-.5));
+  wz_.push_back(16.0*(rand()/(1.0*RAND_MAX)-.5));
+  ax_.push_back(0); ay_.push_back(0); az_.push_back(0);
+  hover_.push_back(hover);
+  force_.push_back(0); damping_.push_back(0); wander_.push_back(0);
+  transit_timer_.push_back(0);
+  death_timer_.push_back(kDeathTime);
+  seed_.push_back(rand() | 1);
+  anchor_.push_back(NULL);
+  slots_.push_back(slot_ref);
+  *slot_ref = slot;
+  set_anchor(slot, anchor);
+  return slot;
+}
+
+// Removes the orb in the slot. The last orb takes its place
+void OrbSystem::remove(int slot){
+  int last = slots_.size() - 1;
+  if (slot != last){
+    px_[slot] = px_[last]; py_[slot] = py_[last]; pz_[slot] = pz_[last];
+    lx_[slot] = lx_[last]; ly_[slot] = ly_[last]; lz_[slot] = lz_[last];
+    vx_[slot] = vx_[last]; vy_[slot] = vy_[last]; vz_[slot] = vz_[last];
+    wx_[slot] = wx_[last]; wy_[slot] = wy_[last]; wz_[slot] = wz_[last];
+    ax_[slot] = ax_[last]; ay_[slot] = ay_[last]; az_[slot] = az_[last];
+    hover_[slot] = hover_[last];
+    force_[slot] = force_[last]; damping_[slot] = damping_[last]; wander_[slot] = wander_[last];
+    transit_timer_[slot] = transit_timer_[last];
+    death_timer_[slot] = death_timer_[last];
+    seed_[slot] = seed_[last];
+    anchor_[slot] = anchor_[last];
+    slots_[slot] = slots_[last];
+    *slots_[slot] = slot;
+  }
+  px_.pop_back(); py_.pop_back(); pz_.pop_back();
+  lx_.pop_back(); ly_.pop_back(); lz_.pop_back();
+  vx_.pop_back(); vy_.pop_back(); vz_.pop_back();
+  wx_.pop_back(); wy_.pop_back(); wz_.pop_back();
+  ax_.pop_back(); ay_.pop_back(); az_.pop_back();
+  hover_.pop_back();
+  force_.pop_back(); damping_.pop_back(); wander_.pop_back();
+  transit_timer_.pop_back();
+  death_timer_.pop_back();
+  seed_.pop_back();
+  anchor_.pop_back();
+  slots_.pop_back();
+}
+
+// Moves the orb to another anchor. NULL lets it fly off and fade
+void OrbSystem::set_anchor(int slot, const Vector3d *anchor){
+  anchor_[slot] = anchor;
+  if (anchor == NULL) death_timer_[slot] = kDeathTime;
+  update_gains(slot);
+}
+
+// Moves the orb more quickly for a while, towards a new disc
+void OrbSystem::start_transit(int slot){
+  transit_timer_[slot] = kTransitTime;
+  update_gains(slot);
+}
+
+// Changes the equilibrium distance from the anchor
+void OrbSystem::set_hover(int slot, double hover){
+  hover_[slot] = hover;
+}
+
+// Fades from 1 to 0 after the anchor is taken away
+double OrbSystem::opacity(int slot){
+  if (anchor_[slot] != NULL) return 1;
+  return fmax(0, death_timer_[slot] / kDeathTime);
+}
+
+// Where the orb is drawn, fraction of the way from where it was before
+// the latest tick to where it is now
+void OrbSystem::get_position(int slot, double &x, double &y, double &z, double fraction){
+  x = lx_[slot] + (px_[slot] - lx_[slot]) * fraction;
+  y = ly_[slot] + (py_[slot] - ly_[slot]) * fraction;
+  z = lz_[slot] + (pz_[slot] - lz_[slot]) * fraction;
+}
+
+// Remembers where the orbs are before they are moved
+void OrbSystem::begin_tick(){
+  lx_ = px_;
+  ly_ = py_;
+  lz_ = pz_;
+}
+
+// Moves every orb through one step of the integration. Each orb is pulled
+// along the line to its anchor by
+//   force * ((d/hover)^2 - (hover/d)^2)
+// which is zero at the hover distance, then damped and pushed by its wander
+void OrbSystem::integrate(double timestep){
+  float dt = timestep;
+  int n = slots_.size();
+  // Split into blocks of four so that the same orbs share a vector
+  // however many threads there are
+  if (n >= kMinParallelOrbs) WorkerPool::run(integrate_task, &dt, n, 4);
+  else integrate_task(&dt, 0, 0, n);
+}
+
+// Advances the transit and fading timers and lets the orbs wander. Called
+// once a frame
+void OrbSystem::advance_time(double t){
+  int n = slots_.size();
+  for (int i = 0; i < n; ++i){
+    if (transit_timer_[i] > 0){
+      transit_timer_[i] -= t;
+      if (transit_timer_[i] <= 0){
+        transit_timer_[i] = 0;
+        update_gains(i);
+      }
+    }
+
+    float rx = next_random(i), ry = next_random(i), rz = next_random(i);
+    if (anchor_[i] == NULL){
+      death_timer_[i] -= t;
+      // Flies up!
+      wx_[i] += .6*rx - .3;
+      wy_[i] += .6*ry - .3;
+      wz_[i] += rz - .45;
+    }
+    else {
+      // Random wandering
+      wx_[i] += rx - .5;
+      wy_[i] += ry - .5;
+      wz_[i] += rz - .5;
+    }
+    wx_[i] = fmin(kMaxWander, fmax(-kMaxWander, wx_[i]));
+    wy_[i] = fmin(kMaxWander, fmax(-kMaxWander, wy_[i]));
+    wz_[i] = fmin(kMaxWander, fmax(-kMaxWander, wz_[i]));
+  }
+}
+
+// #------------- Private --------------#
+
+// Sets the gains of the force for the orb's state. An orb without an
+// anchor only feels its wander
+void OrbSystem::update_gains(int slot){
+  if (anchor_[slot] == NULL){
+    force_[slot] = 0; damping_[slot] = 0; wander_[slot] = 1;
+  }
+  else if (transit_timer_[slot] > 0){
+    force_[slot] = kTransitForce; damping_[slot] = kTransitDamping; wander_[slot] = kTransitWander;
+  }
+  else {
+    force_[slot] = kStationaryForce; damping_[slot] = kStationaryDamping; wander_[slot] = kStationaryWander;
+  }
+}
+
+// Copies the anchors' positions next to the orbs. An orb without an
+// anchor gets one exactly a hover distance away, where it feels no pull
+void OrbSystem::gather_anchors(int first, int last){
+  for (int i = first; i < last; ++i){
+    const Vector3d *a = anchor_[i];
+    if (a != NULL){
+      ax_[i] = a->x; ay_[i] = a->y; az_[i] = a->z;
+    }
+    else {
+      ax_[i] = px_[i] + hover_[i]; ay_[i] = py_[i]; az_[i] = pz_[i];
+    }
+  }
+}
+
+// Moves the orbs of one part of the split
+void OrbSystem::integrate_task(void *data, int part, int first, int last){
+  gather_anchors(first, last);
+  integrate_block(first, last, *static_cast<float *>(data));
+}
+
+// Moves orbs [first, last), four at a time where it can
+void OrbSystem::integrate_block(int first, int last, float dt){
+  int i = first;
+#ifdef HAS_SSE2
+  __m128 t = _mm_set1_ps(dt);
+  __m128 tiny = _mm_set1_ps(1e-12f);
+  __m128 one = _mm_set1_ps(1);
+  for (; i + 4 <= last; i += 4){
+    __m128 px = _mm_loadu_ps(&px_[i]), py = _mm_loadu_ps(&py_[i]), pz = _mm_loadu_ps(&pz_[i]);
+    __m128 vx = _mm_loadu_ps(&vx_[i]), vy = _mm_loadu_ps(&vy_[i]), vz = _mm_loadu_ps(&vz_[i]);
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(&ax_[i]), px);
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(&ay_[i]), py);
+    __m128 dz = _mm_sub_ps(_mm_loadu_ps(&az_[i]), pz);
+    __m128 d2 = _mm_max_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)), tiny);
+    __m128 d = _mm_sqrt_ps(d2);
+    __m128 h = _mm_loadu_ps(&hover_[i]);
+    __m128 n2 = _mm_div_ps(d2, _mm_mul_ps(h, h));
+    __m128 parabolic = _mm_sub_ps(n2, _mm_div_ps(one, n2));
+    // The pull along the unit vector to the anchor
+    __m128 s = _mm_div_ps(_mm_mul_ps(_mm_loadu_ps(&force_[i]), parabolic), d);
+    __m128 damping = _mm_loadu_ps(&damping_[i]);
+    __m128 wander = _mm_loadu_ps(&wander_[i]);
+    __m128 fx = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(dx, s), _mm_mul_ps(vx, damping)), _mm_mul_ps(_mm_loadu_ps(&wx_[i]), wander));
+    __m128 fy = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(dy, s), _mm_mul_ps(vy, damping)), _mm_mul_ps(_mm_loadu_ps(&wy_[i]), wander));
+    __m128 fz = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(dz, s), _mm_mul_ps(vz, damping)), _mm_mul_ps(_mm_loadu_ps(&wz_[i]), wander));
+    // Orbs weigh one, so the force is the acceleration
+    vx = _mm_add_ps(vx, _mm_mul_ps(fx, t));
+    vy = _mm_add_ps(vy, _mm_mul_ps(fy, t));
+    vz = _mm_add_ps(vz, _mm_mul_ps(fz, t));
+    _mm_storeu_ps(&vx_[i], vx); _mm_storeu_ps(&vy_[i], vy); _mm_storeu_ps(&vz_[i], vz);
+    _mm_storeu_ps(&px_[i], _mm_add_ps(px, _mm_mul_ps(vx, t)));
+    _mm_storeu_ps(&py_[i], _mm_add_ps(py, _mm_mul_ps(vy, t)));
+    _mm_storeu_ps(&pz_[i], _mm_add_ps(pz, _mm_mul_ps(vz, t)));
+  }
+#endif
+  integrate_range(i, last, dt);
+}
+
+// Moves orbs [first, last) one at a time, the same way as the SSE loop
+void OrbSystem::integrate_range(int first, int last, float dt){
+  for (int i = first; i < last; ++i){
+    float dx = ax_[i] - px_[i], dy = ay_[i] - py_[i], dz = az_[i] - pz_[i];
+    float d2 = fmaxf(dx*dx + dy*dy + dz*dz, 1e-12f);
+    float d = sqrtf(d2);
+    float n2 = d2 / (hover_[i] * hover_[i]);
+    float s = force_[i] * (n2 - 1 / n2) / d;
+    vx_[i] += (dx*s - vx_[i]*damping_[i] + wx_[i]*wander_[i]) * dt;
+    vy_[i] += (dy*s - vy_[i]*damping_[i] + wy_[i]*wander_[i]) * dt;
+    vz_[i] += (dz*s - vz_[i]*damping_[i] + wz_[i]*wander_[i]) * dt;
+    px_[i] += vx_[i] * dt;
+    py_[i] += vy_[i] * dt;
+    pz_[i] += vz_[i] * dt;
+  }
+}
+
+// A uniform random number in [0, 1) from the orb's own xorshift generator
+float OrbSystem::next_random(int slot){
+  unsigned int x = seed_[slot];
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  seed_[slot] = x;
+  return (x >> 8) * (1.0f / 16777216.0f);
+}
@@ -0,0 +1,115 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  OrbSystem.h
+  Moves every orb at once. Each orb is pulled towards a hover distance
+  from its disc, damped, and pushed around by a wandering force. The
+  state of all of the orbs lives in parallel arrays of floats, so one
+  loop with no virtual calls moves them all, four at a time where SSE is
+  available. The orbs themselves only keep their slot in the arrays.
+*/
+
+#ifndef _ORBSYSTEM_H_
+#define _ORBSYSTEM_H_
+
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+#include "vmath.h"
+#include "WorkerPool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define HAS_SSE2
+#endif
+
+class OrbSystem {
+public:
+  // Seconds that an orb without a disc takes to fade away
+  static const double kDeathTime = 15.0;
+  // Seconds that an orb is in transit after changing discs
+  static const double kTransitTime = 2.5;
+  // The pull towards the hover distance, the damping and the wander for
+  // orbs moving between discs and orbs staying put
+  static const double kTransitForce = 50.0;
+  static const double kTransitDamping = 45.0;
+  static const double kTransitWander = 8.0;
+  static const double kStationaryForce = 40.0;
+  static const double kStationaryDamping = 2.0;
+  static const double kStationaryWander = 2.0;
+  // The wander force never grows past this in any direction
+  static const double kMaxWander = 10.0;
+  // Fewer orbs than this are moved on one thread
+  static const int kMinParallelOrbs = 512;
+
+  // Adds an orb that hovers around the anchor, starting beside it. The
+  // slot is written through slot_ref now and whenever the orb is moved
+  // to another slot. A NULL anchor makes an orb that is already fading
+  static int add(int *slot_ref, const Vector3d *anchor, double hover);
+
+  // Removes the orb in the slot. The last orb takes its place
+  static void remove(int slot);
+
+  // Moves the orb to another anchor. NULL lets it fly off and fade
+  static void set_anchor(int slot, const Vector3d *anchor);
+  // Moves the orb more quickly for a while, towards a new disc
+  static void start_transit(int slot);
+  // Changes the equilibrium distance from the anchor
+  static void set_hover(int slot, double hover);
+
+  static bool in_transit(int slot){ return transit_timer_[slot] > 0; }
+  // True once an orb without an anchor has faded away completely
+  static bool is_dead(int slot){ return death_timer_[slot] < 0; }
+  // Fades from 1 to 0 after the anchor is taken away
+  static double opacity(int slot);
+  // Where the orb is drawn, fraction of the way from where it was before
+  // the latest tick to where it is now
+  static void get_position(int slot, double &x, double &y, double &z, double fraction = 1);
+  static int size(){ return slots_.size(); }
+
+  // Remembers where the orbs are before they are moved, so that frames can
+  // be drawn between ticks
+  static void begin_tick();
+
+  // Moves every orb through one step of the integration, split between
+  // the worker pool's threads
+  static void integrate(double timestep);
+
+  // Advances the transit and fading timers and lets the orbs wander.
+  // Called once a frame
+  static void advance_time(double t);
+
+private:
+  // Sets the gains of the force for the orb's state
+  static void update_gains(int slot);
+  // Copies the anchors' positions next to the orbs. An orb without an
+  // anchor gets one exactly a hover distance away, where it feels no pull
+  static void gather_anchors(int first, int last);
+  // Moves the orbs of one part of the split. data points to the timestep
+  static void integrate_task(void *data, int part, int first, int last);
+  // Moves orbs [first, last), four at a time where it can
+  static void integrate_block(int first, int last, float dt);
+  // Moves orbs [first, last) one at a time
+  static void integrate_range(int first, int last, float dt);
+  // A uniform random number in [0, 1) from the orb's own generator
+  static float next_random(int slot);
+
+  // Position, velocity, wander and anchor position
+  static std::vector<float> px_, py_, pz_, vx_, vy_, vz_, wx_, wy_, wz_, ax_, ay_, az_;
+  // Position before the latest tick
+  static std::vector<float> lx_, ly_, lz_;
+  static std::vector<float> hover_;
+  // Gains of the pull, damping and wander for the orb's current state
+  static std::vector<float> force_, damping_, wander_;
+  // Positive while in transit, counts down to zero
+  static std::vector<float> transit_timer_;
+  // Counts down once the anchor is gone, the orb is dead below zero
+  static std::vector<float> death_timer_;
+  // State of each orb's xorshift generator, never zero
+  static std::vector<unsigned int> seed_;
+  static std::vector<const Vector3d *> anchor_;
+  static std::vector<int *> slots_;
+};
+
+#endif
@@ -15,7 +15,12 @@ class Physical{
 
 public:
 
+  Physical() : asleep_(false), rest_time_(0), physics_handle_(-1) {}
+
   virtual bool has_collisions() = 0;
+  // False for objects that never collide, whatever their state. The
+  // engine leaves them out of collision detection altogether
+  virtual bool can_collide(){ return true; }
   virtual bool uses_friction() = 0;
   virtual double intersection_distance() = 0;
   virtual bool rotates() = 0;
@@ -29,6 +34,18 @@ public:
   Vector3d ang_pos_;
   Vector3d ang_vel_;
   Vector3d ang_acc_;
+  // Set by the engine. A body that has been still for a while is put to
+  // sleep and isn't moved again until something wakes it
+  bool asleep_;
+  double rest_time_; // seconds
+  // Where the body was before the latest tick, for drawing between ticks
+  Vector3d prev_pos_;
+  Vector3d prev_ang_pos_;
+  // Where the body was after the latest tick, for other threads. Read it
+  // through Physics::snapshot_position
+  Vector3d snapshot_pos_;
+  // Where the body is in the engine's list, -1 while it has no physics
+  int physics_handle_;
   
 };
 
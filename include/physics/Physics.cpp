@@ -7,66 +7,198 @@
   */
 
 #include "Physics.h"
+#include "OrbSystem.h"
 
 typedef std::pair< Physical *, Physical *> Collision;
-std::list<Physical *> Physics::all_;
+SlotRegistry<Physical *> Physics::all_;
+std::vector<Physical *> Physics::bodies_;
+std::vector<Physical *> Physics::colliders_;
+bool Physics::lists_stale_ = false;
+bool Physics::broad_phase_ = true;
+bool Physics::adaptive_ = true;
+Physics::Stats Physics::stats_ = {0, 0, 0, 0};
+pthread_t Physics::thread_;
+pthread_mutex_t Physics::lock_ = PTHREAD_MUTEX_INITIALIZER;
+int Physics::running_ = 0;
+long long Physics::tick_ns_ = 0;
+long long Physics::last_tick_ns_ = 0;
+unsigned int Physics::snapshot_sequence_ = 0;
+double Physics::cell_size_ = 1;
+std::vector<int> Physics::bucket_head_;
+std::vector<int> Physics::cell_next_;
+std::vector<long> Physics::cell_x_;
+std::vector<long> Physics::cell_y_;
+std::vector<std::vector<int> > Physics::neighbors_(1);
+std::vector<std::vector<std::pair<int, int> > > Physics::part_pairs_(1);
+std::vector<std::pair<int, int> > Physics::pairs_;
+std::vector<std::pair<int, int> > Physics::colored_;
+std::vector<unsigned long long> Physics::color_mask_;
+std::vector<int> Physics::pair_color_;
+std::vector<int> Physics::color_start_;
 double Physics::x_min_ = -10e10, Physics::x_max_ = 10e10;
 double Physics::y_min_ = -10e10, Physics::y_max_ = -10e10;
 
 // Removes physics from an object
 bool Physics::take_physics(Physical *object){
-
-  if (all_.size() > 0) {
-    std::list<Physical *>::iterator it;
-    it = all_.begin();
-    while (it != all_.end()) {
-      if (*it == object){
-        all_.erase(it);
-        return true;
-      }
-      ++it;
-    }
-  }
-  return false;
+  int h = object->physics_handle_;
+  if (!all_.contains(h) || all_.get(h) != object) return false;
+  all_.remove(h);
+  object->physics_handle_ = SlotRegistry<Physical *>::kNone;
+  lists_stale_ = true;
+  return true;
 }
 
 // Adds an object for which physics will be computed
 void Physics::give_physics(Physical *object){
-  all_.push_back(object); 
+  wake(object);
+  object->prev_pos_ = object->pos_;
+  object->prev_ang_pos_ = object->ang_pos_;
+  // Readers may see it before the next tick. The sequence is bumped as in
+  // publish_snapshot, so a reader can't take a half written position
+  unsigned int s = __atomic_load_n(&snapshot_sequence_, __ATOMIC_RELAXED);
+  __atomic_store_n(&snapshot_sequence_, s + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  store_snapshot(object);
+  __atomic_store_n(&snapshot_sequence_, s + 2, __ATOMIC_RELEASE);
+  if (all_.contains(object->physics_handle_) && all_.get(object->physics_handle_) == object) return;
+  object->physics_handle_ = all_.push_back(object);
+  lists_stale_ = true;
 }
 
 
-// Updates the positions of all objects 
+// Updates the positions of all objects. Sleeping bodies are left where
+// they are, though others can still run into them
 void Physics::update(double update_time){
-  int standard_iterations = 20.0;
+  // Before anything reads the lists, which may still hold bodies that
+  // were taken out and deleted since the last update
+  refresh_lists();
+
+  int standard_iterations = adaptive_ ? count_substeps(update_time) : kFixedSubsteps;
   double update = update_time/(1.0*standard_iterations);
+
+  // Remembered so that frames can be drawn between this update and the next
+  for (int h = all_.first(); h != SlotRegistry<Physical *>::kNone; h = all_.next(h)){
+    Physical *p = all_.get(h);
+    p->prev_pos_ = p->pos_;
+    p->prev_ang_pos_ = p->ang_pos_;
+  }
+  OrbSystem::begin_tick();
   
   //Numerical Integration
+  stats_.steps += standard_iterations;
   for (int i = 0; i < standard_iterations; ++i){
 
-    if (all_.size() > 0) {
-      std::list<Physical *>::iterator it = all_.begin();
-      while (it != all_.end()) {
-        (*it)->acc_ = (*it)->external_forces()/(*it)->m_;
-        (*it)->ang_acc_ = (*it)->external_torques()/(*it)->I_;
-        ++it;
-      }
-    }
+    split(force_task, NULL, bodies_.size(), kMinParallelBodies);
+    // The orbs only feel their discs, as they were before this step
+    OrbSystem::integrate(update);
 
     collision_prevention();
+
+    split(integrate_task, &update, bodies_.size(), kMinParallelBodies);
+    // Last, so that every step ends with everything inside the walls
     check_in_bounds();
+  }
+  if (adaptive_) settle(update_time);
+  OrbSystem::advance_time(update_time);
+  publish_snapshot();
+}
 
-    if (all_.size() > 0) {
-      std::list<Physical *>::iterator it = all_.begin();
-      while (it != all_.end()) {
-        integrate_translational(update, *it); 
-        if (!(*it)->rotates()) integrate_rotational(update, *it); 
-        ++it;
-      }
-    }
+// Runs update on a thread of its own, rate times a second, instead of
+// from the frame
+bool Physics::start_thread(double rate){
+  if (threaded()) return true;
+  if (rate <= 0) return false;
+  tick_ns_ = static_cast<long long>(1e9 / rate);
+  last_tick_ns_ = now_ns();
+  __atomic_store_n(&running_, 1, __ATOMIC_RELEASE);
+  if (pthread_create(&thread_, NULL, run_thread, NULL) != 0){
+    printf("Could not start the physics thread, moving the discs every frame instead\n");
+    __atomic_store_n(&running_, 0, __ATOMIC_RELEASE);
+    return false;
+  }
+  return true;
+}
+
+// Stops the thread after the tick it is on. Don't hold the lock
+void Physics::stop_thread(){
+  if (!threaded()) return;
+  __atomic_store_n(&running_, 0, __ATOMIC_RELEASE);
+  pthread_join(thread_, NULL);
+}
+
+void Physics::lock(){ pthread_mutex_lock(&lock_); }
+
+void Physics::unlock(){ pthread_mutex_unlock(&lock_); }
+
+// How far the present is between the last two ticks, from 0 to 1
+double Physics::render_fraction(){
+  if (!threaded()) return 1;
+  double fraction = (now_ns() - last_tick_ns_) / (1.0 * tick_ns_);
+  return fmax(0, fmin(1, fraction));
+}
+
+// Where to draw a body now, between its last two ticks
+Vector3d Physics::render_position(Physical *object){
+  return object->prev_pos_.lerp(render_fraction(), object->pos_);
+}
+
+Vector3d Physics::render_rotation(Physical *object){
+  return object->prev_ang_pos_.lerp(render_fraction(), object->ang_pos_);
+}
+
+// Starts a read of the snapshot. Waits out a write under way
+unsigned int Physics::begin_snapshot(){
+  unsigned int sequence = __atomic_load_n(&snapshot_sequence_, __ATOMIC_ACQUIRE);
+  for (int i = 0; i < kMaxSnapshotRetries && (sequence & 1); ++i){
+    sequence = __atomic_load_n(&snapshot_sequence_, __ATOMIC_ACQUIRE);
+  }
+  return sequence;
+}
+
+// True if nothing was written since begin_snapshot
+bool Physics::end_snapshot(unsigned int sequence){
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return !(sequence & 1) && __atomic_load_n(&snapshot_sequence_, __ATOMIC_RELAXED) == sequence;
+}
+
+Vector3d Physics::snapshot_position(Physical *object){
+  Vector3d p;
+  __atomic_load(&object->snapshot_pos_.x, &p.x, __ATOMIC_RELAXED);
+  __atomic_load(&object->snapshot_pos_.y, &p.y, __ATOMIC_RELAXED);
+  __atomic_load(&object->snapshot_pos_.z, &p.z, __ATOMIC_RELAXED);
+  return p;
+}
+
+void Physics::reset_stats(){
+  stats_.steps = 0;
+  stats_.collide_calls = 0;
+  stats_.contacts = 0;
+  stats_.wall_hits = 0;
+}
+
+// Turns off sleeping and adaptive steps, so every frame takes the fixed
+// number of steps over every body, for comparison
+void Physics::set_adaptive(bool adaptive){
+  adaptive_ = adaptive;
+  for (int h = all_.first(); h != SlotRegistry<Physical *>::kNone; h = all_.next(h)){
+    wake(all_.get(h));
   }
 }
 
+// Lets a sleeping body move again
+void Physics::wake(Physical *object){
+  object->asleep_ = false;
+  object->rest_time_ = 0;
+}
+
+// Splits each step between this many threads
+int Physics::set_threads(int threads){
+  int started = WorkerPool::start(threads);
+  neighbors_.resize(started);
+  part_pairs_.resize(started);
+  return started;
+}
+
 // Uses Velocity Verlet integration to compute the next positions of the object
 void Physics::integrate_translational(double timestep, Physical* obj){
   //kinetic friction
@@ -100,25 +232,26 @@ void Physics::integrate_rotational(double timestep, Physical* obj){
 
 // Uses vector projections to make sure things don't get too close to each other
 void Physics::collision_prevention(){
-    //int to_remove = recent_collisions_.size();
-    
-    if (all_.size() > 1) {
-      std::list<Physical *>::iterator it_a = all_.begin();
-      std::list<Physical *>::iterator it_b = all_.begin();
-      while (it_a != all_.end()) {
-        if ( (*it_a)->has_collisions() ){ // Only if A can collide
-          it_b = it_a;
-          ++it_b;
-          while (it_b != all_.end()) {
-            if ((*it_b)->has_collisions()) { // Only if B can collide
-              collide(*it_a, *it_b);
-              
-            } ++it_b;
-          } 
-        } ++it_a;
-      }
+  refresh_lists();
+  if (!broad_phase_){
+    collision_prevention_all_pairs();
+    return;
+  }
+  // A table of sleeping discs needs no attention at all
+  if (!any_awake_collider() || !build_grid()) return;
+
+  split(find_pairs_task, NULL, colliders_.size(), kMinParallelBodies);
+  // Put together in the order of the first collider, as one thread would
+  pairs_.clear();
+  for (int part = 0; part < part_pairs_.size(); ++part){
+    pairs_.insert(pairs_.end(), part_pairs_[part].begin(), part_pairs_[part].end());
+    part_pairs_[part].clear();
+  }
+  stats_.collide_calls += pairs_.size();
 
-    }
+  if (pairs_.empty()) return;
+  if (WorkerPool::threads() > 1) collide_colored();
+  else collide_task(&pairs_[0], 0, 0, pairs_.size());
 }
 
 // Handles a collision using conservation of linear momentum;
@@ -134,6 +267,11 @@ void Physics::collide(Physical* a, Physical* b){
   if (between.length() < rb + ra && 
      (between.dotProduct(a->vel_)>0 || between.dotProduct(b->vel_)<0)){
 
+      __atomic_add_fetch(&stats_.contacts, 1, __ATOMIC_RELAXED);
+      // Anything that is struck wakes up
+      wake(a);
+      wake(b);
+
       // Separate the discs from each other
       double move_dist = between.length() - rb - ra;
       a->pos_ += between * move_dist/2.0;
@@ -200,80 +338,10 @@ void Physics::collide(Physical* a, Physical* b){
 
 
 
+// Handles collision detection with world
 void Physics::check_in_bounds(){
-  if (all_.size() > 0) {
-      double mu = .2;
-      std::list<Physical *>::iterator it = all_.begin();
-      double impulse, r;
-      Vector3d tang_v, fric_dir, f_fric_max, dw_fric_max, dv_fric_max;
-      
-      while (it != all_.end()) {
-        Physical *p = (*it);
-        r = p->intersection_distance();
-        if (p->has_collisions()){
-          // Wall Normal Vector    
-          Vector3d n;
-          bool collides = false;
-          //Left Wall
-          if (p->pos_.x - p->intersection_distance() < x_min_ && p->vel_.x < 0){
-            p->pos_.x =  x_min_ + p->intersection_distance();
-            p->vel_.x = -p->vel_.x;
-            if(p->acc_.x < 0) p->acc_.x = 0;
-
-            n = Vector3d(1, 0, 0); // Normal vector for wall
-            collides = true;
-          }
-
-          //Right Wall
-          else if (p->pos_.x + p->intersection_distance() > x_max_ && p->vel_.x > 0){
-            p->pos_.x =  x_max_ - p->intersection_distance();
-            p->vel_.x = -p->vel_.x;
-            if(p->acc_.x > 0) p->acc_.x = 0;
-
-            n = Vector3d(-1, 0, 0); // Normal vector for wall
-            collides = true;
-            
-          }
-
-          //Bottom Wall
-          if (p->pos_.y - p->intersection_distance() < y_min_ && p->vel_.y < 0){
-            p->pos_.y =  y_min_ + p->intersection_distance();
-            p->vel_.y = -p->vel_.y;
-            if(p->acc_.y < 0) p->acc_.y = 0;
-            n = Vector3d(0, 1, 0); // Normal vector for wall
-            collides = true;
-          }
-
-          //Top Wall
-          else if (p->pos_.y + p->intersection_distance() > y_max_ && p->vel_.y > 0){
-            p->pos_.y =  y_max_ - p->intersection_distance();
-            p->vel_.y = -p->vel_.y;
-            if(p->acc_.y > 0) p->acc_.y = 0;
-            n = Vector3d(0, -1, 0); // Normal vector for wall
-            collides = true;
-          }
-          
-          if (collides && p->vel_.dotProduct(n) != p->vel_.length()){// Handles divide by zero cases
-            // The impulse in the direction normal to the wall
-            impulse = p->vel_.dotProduct(n) * 2 * p->m_ ;
-            // The direction of the friction
-            tang_v = -(p->vel_ + n.crossProduct(p->ang_vel_) * r);
-            fric_dir = tang_v - n.projectOnto(tang_v);
-            fric_dir.normalize();
-            // Amount of rotation and velocity change to add
-            f_fric_max = fric_dir * impulse * mu;
-            dw_fric_max = -n.crossProduct(f_fric_max) * r / p->I_;
-            dv_fric_max = fric_dir * dw_fric_max.length() * r;
-            // Limit friction              
-            dv_fric_max = fric_dir * fmin(fabs(dv_fric_max.length()), fabs(p->vel_.dotProduct(fric_dir)));
-  
-            p->ang_vel_ +=  dw_fric_max;
-            p->vel_ += dv_fric_max; 
-          }
-        } 
-        ++it;
-      }
-    }
+  refresh_lists();
+  split(bounds_task, NULL, colliders_.size(), kMinParallelBodies);
 }
 
 void Physics::set_bounds(double size_x, double size_y, double x, double y){
@@ -285,21 +353,395 @@ void Physics::set_bounds(double size_x, double size_y, double x, double y){
 }
 
 
+// Checks to see if an area is within the bounds of the world and also
+// clear of discs
 bool Physics::is_clear_area(double x, double y, double r){
   if (x-r<x_min_ || x+r>x_max_ || y+r>y_max_ || y-r<y_min_){
     return false;
   }
-  if (all_.size() > 1) {
-    std::list<Physical *>::iterator it_a = all_.begin();
-    while (it_a != all_.end()) {
-      if ( (*it_a)->has_collisions()){
-        Vector3d between = Vector3d(x,y,0) - (*it_a)->pos_;
-        if (between.length() < 1.05*(r + (*it_a)->intersection_distance())){
+  refresh_lists();
+  if (all_.size() <= 1 || !build_grid()) return true;
+
+  // No collider reaches further than half a cell
+  double reach = 1.05 * (r + cell_size_ / 2.0);
+  for (long cx = cell_of(x - reach); cx <= cell_of(x + reach); ++cx){
+    for (long cy = cell_of(y - reach); cy <= cell_of(y + reach); ++cy){
+      for (int j = bucket_head_[bucket_of(cx, cy)]; j >= 0; j = cell_next_[j]){
+        if (cell_x_[j] != cx || cell_y_[j] != cy) continue;
+        Vector3d between = Vector3d(x,y,0) - colliders_[j]->pos_;
+        if (between.length() < 1.05*(r + colliders_[j]->intersection_distance())){
           return false;  
         }
-      } ++it_a;
+      }
     }
   }
   return true;
+}
+
+// #------------- Private --------------#
+
+// Bounces one body off the walls
+void Physics::check_wall(Physical *p){
+  double mu = .2;
+  double impulse, r;
+  Vector3d tang_v, fric_dir, f_fric_max, dw_fric_max, dv_fric_max;
+  r = p->intersection_distance();
+  if (p->has_collisions() && !p->asleep_){
+    // Wall Normal Vector    
+    Vector3d n;
+    bool collides = false;
+    // Anything past a wall is put back inside, whichever way it is
+    // heading, so a long step can't carry it through. It only
+    // bounces if it is still heading out
+    //Left Wall
+    if (p->pos_.x - p->intersection_distance() < x_min_){
+      p->pos_.x =  x_min_ + p->intersection_distance();
+      if (p->vel_.x < 0){
+        p->vel_.x = -p->vel_.x;
+        if(p->acc_.x < 0) p->acc_.x = 0;
+
+        n = Vector3d(1, 0, 0); // Normal vector for wall
+        collides = true;
+      }
+    }
+
+    //Right Wall
+    else if (p->pos_.x + p->intersection_distance() > x_max_){
+      p->pos_.x =  x_max_ - p->intersection_distance();
+      if (p->vel_.x > 0){
+        p->vel_.x = -p->vel_.x;
+        if(p->acc_.x > 0) p->acc_.x = 0;
+
+        n = Vector3d(-1, 0, 0); // Normal vector for wall
+        collides = true;
+      }
+    }
+
+    //Bottom Wall
+    if (p->pos_.y - p->intersection_distance() < y_min_){
+      p->pos_.y =  y_min_ + p->intersection_distance();
+      if (p->vel_.y < 0){
+        p->vel_.y = -p->vel_.y;
+        if(p->acc_.y < 0) p->acc_.y = 0;
+        n = Vector3d(0, 1, 0); // Normal vector for wall
+        collides = true;
+      }
+    }
+
+    //Top Wall
+    else if (p->pos_.y + p->intersection_distance() > y_max_){
+      p->pos_.y =  y_max_ - p->intersection_distance();
+      if (p->vel_.y > 0){
+        p->vel_.y = -p->vel_.y;
+        if(p->acc_.y > 0) p->acc_.y = 0;
+        n = Vector3d(0, -1, 0); // Normal vector for wall
+        collides = true;
+      }
+    }
+
+    if (collides) __atomic_add_fetch(&stats_.wall_hits, 1, __ATOMIC_RELAXED);
+    if (collides && p->vel_.dotProduct(n) != p->vel_.length()){// Handles divide by zero cases
+      // The impulse in the direction normal to the wall
+      impulse = p->vel_.dotProduct(n) * 2 * p->m_ ;
+      // The direction of the friction
+      tang_v = -(p->vel_ + n.crossProduct(p->ang_vel_) * r);
+      fric_dir = tang_v - n.projectOnto(tang_v);
+      fric_dir.normalize();
+      // Amount of rotation and velocity change to add
+      f_fric_max = fric_dir * impulse * mu;
+      dw_fric_max = -n.crossProduct(f_fric_max) * r / p->I_;
+      dv_fric_max = fric_dir * dw_fric_max.length() * r;
+      // Limit friction              
+      dv_fric_max = fric_dir * fmin(fabs(dv_fric_max.length()), fabs(p->vel_.dotProduct(fric_dir)));
+
+      p->ang_vel_ +=  dw_fric_max;
+      p->vel_ += dv_fric_max; 
+    }
+  }
+}
+
+
+// Enough steps that no two bodies close on each other by more than the
+// collision margin in one, and none longer than kMaxTimestep
+int Physics::count_substeps(double update_time){
+  double fastest = 0, smallest = 0;
+  for (int i = 0; i < colliders_.size(); ++i){
+    Physical *p = colliders_[i];
+    if (!p->has_collisions() || p->asleep_) continue;
+    fastest = fmax(fastest, p->vel_.length());
+    double r = p->intersection_distance();
+    if (smallest == 0 || r < smallest) smallest = r;
+  }
+  double steps = ceil(update_time / kMaxTimestep);
+  if (fastest > 0 && smallest > 0){
+    // Two bodies heading at each other close twice as fast
+    steps = fmax(steps, ceil(2 * fastest * update_time / (kCollisionMargin * smallest)));
+  }
+  return static_cast<int>(fmax(1, fmin(kMaxSubsteps, steps)));
+}
+
+// Puts bodies that have been still for long enough to sleep
+void Physics::settle(double update_time){
+  for (int h = all_.first(); h != SlotRegistry<Physical *>::kNone; h = all_.next(h)){
+    Physical *p = all_.get(h);
+    if (p->asleep_) continue;
+    bool still = p->vel_.length() < kSleepSpeed &&
+                 p->ang_vel_.length() < kSleepSpin &&
+                 p->external_forces().length() / p->m_ < kSleepAcceleration;
+    p->rest_time_ = still ? p->rest_time_ + update_time : 0;
+    if (p->rest_time_ >= kSleepTime){
+      p->asleep_ = true;
+      p->vel_ = Vector3d(0, 0, 0);
+      p->ang_vel_ = Vector3d(0, 0, 0);
+    }
+  }
+}
+
+// Copies every body's position out for readers on other threads. An odd
+// sequence number means a write is under way
+void Physics::publish_snapshot(){
+  unsigned int s = __atomic_load_n(&snapshot_sequence_, __ATOMIC_RELAXED);
+  __atomic_store_n(&snapshot_sequence_, s + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  for (int h = all_.first(); h != SlotRegistry<Physical *>::kNone; h = all_.next(h)){
+    store_snapshot(all_.get(h));
+  }
+  __atomic_store_n(&snapshot_sequence_, s + 2, __ATOMIC_RELEASE);
+}
+
+// Copies one body's position out
+void Physics::store_snapshot(Physical *p){
+  __atomic_store(&p->snapshot_pos_.x, &p->pos_.x, __ATOMIC_RELAXED);
+  __atomic_store(&p->snapshot_pos_.y, &p->pos_.y, __ATOMIC_RELAXED);
+  __atomic_store(&p->snapshot_pos_.z, &p->pos_.z, __ATOMIC_RELAXED);
+}
+
+// Runs the ticks on the physics thread. Each tick is a fixed step of the
+// simulation, however often the frames are drawn. A late thread runs the
+// ticks it missed back to back
+void *Physics::run_thread(void *){
+  long long next = last_tick_ns_ + tick_ns_;
+  double timestep = tick_ns_ * 1e-9;
+  while (__atomic_load_n(&running_, __ATOMIC_ACQUIRE)){
+    long long wait = next - now_ns();
+    if (wait > 0){
+      usleep(static_cast<useconds_t>(wait / 1000));
+      continue;
+    }
+    lock();
+    for (int i = 0; i < kMaxCatchUpTicks && next <= now_ns(); ++i){
+      update(timestep);
+      last_tick_ns_ = next;
+      next += tick_ns_;
+    }
+    // Too far behind, the lost time is dropped
+    if (next <= now_ns()){
+      last_tick_ns_ = now_ns();
+      next = last_tick_ns_ + tick_ns_;
+    }
+    unlock();
+  }
+  return NULL;
+}
+
+// Monotonic time in nanoseconds
+long long Physics::now_ns(){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// True if any colliding body is awake
+bool Physics::any_awake_collider(){
+  for (int i = 0; i < colliders_.size(); ++i){
+    if (colliders_[i]->has_collisions() && !colliders_[i]->asleep_) return true;
+  }
+  return false;
+}
+
+// Lists the objects, and those that can collide, again in the order they
+// were given physics, after some have come or gone
+void Physics::refresh_lists(){
+  if (!lists_stale_) return;
+  bodies_.clear();
+  colliders_.clear();
+  for (int h = all_.first(); h != SlotRegistry<Physical *>::kNone; h = all_.next(h)){
+    bodies_.push_back(all_.get(h));
+    if (all_.get(h)->can_collide()) colliders_.push_back(all_.get(h));
+  }
+  lists_stale_ = false;
+}
+
+// Finds the forces on the awake bodies
+void Physics::force_task(void *, int, int first, int last){
+  for (int i = first; i < last; ++i){
+    Physical *p = bodies_[i];
+    if (!p->asleep_){
+      p->acc_ = p->external_forces()/p->m_;
+      p->ang_acc_ = p->external_torques()/p->I_;
+    }
+  }
+}
+
+// Moves the awake bodies through one step
+void Physics::integrate_task(void *data, int, int first, int last){
+  double update = *static_cast<double *>(data);
+  for (int i = first; i < last; ++i){
+    Physical *p = bodies_[i];
+    if (!p->asleep_){
+      integrate_translational(update, p); 
+      if (!p->rotates()) integrate_rotational(update, p); 
+    }
+  }
+}
+
+// Bounces the colliders off the walls
+void Physics::bounds_task(void *, int, int first, int last){
+  for (int i = first; i < last; ++i){
+    check_wall(colliders_[i]);
+  }
+}
+
+// Lists the pairs of colliders in neighboring cells of the grid, for
+// the colliders [first, last)
+void Physics::find_pairs_task(void *, int part, int first, int last){
+  std::vector<int> &neighbors = neighbors_[part];
+  std::vector<std::pair<int, int> > &pairs = part_pairs_[part];
+  for (int i = first; i < last; ++i){
+    if (!colliders_[i]->has_collisions()) continue;
+    bool asleep = colliders_[i]->asleep_;
+    // Anything touching this collider is in one of the nine cells around it
+    neighbors.clear();
+    for (long cx = cell_x_[i] - 1; cx <= cell_x_[i] + 1; ++cx){
+      for (long cy = cell_y_[i] - 1; cy <= cell_y_[i] + 1; ++cy){
+        for (int j = bucket_head_[bucket_of(cx, cy)]; j >= 0; j = cell_next_[j]){
+          if (j > i && cell_x_[j] == cx && cell_y_[j] == cy &&
+              !(asleep && colliders_[j]->asleep_)) neighbors.push_back(j);
+        }
+      }
+    }
+    // The pairs are handled in the same order as testing every pair would
+    std::sort(neighbors.begin(), neighbors.end());
+    for (int k = 0; k < neighbors.size(); ++k){
+      pairs.push_back(std::make_pair(i, neighbors[k]));
+    }
+  }
+}
+
+// Resolves the pairs [first, last) of those that data points to
+void Physics::collide_task(void *data, int, int first, int last){
+  std::pair<int, int> *pairs = static_cast<std::pair<int, int> *>(data);
+  for (int k = first; k < last; ++k){
+    collide(colliders_[pairs[k].first], colliders_[pairs[k].second]);
+  }
+}
+
+// Runs a task over count items, on one thread if there are few
+void Physics::split(WorkerPool::Task task, void *data, int count, int fewest){
+  if (count >= fewest) WorkerPool::run(task, data, count);
+  else task(data, 0, 0, count);
+}
+
+// Gives each pair the first color that neither of its colliders has yet,
+// in the order the pairs were found. No two pairs of a color share a
+// collider, so a color is resolved by all of the threads at once, and the
+// colors one after another. The coloring doesn't depend on the threads
+void Physics::collide_colored(){
+  int n = colliders_.size(), m = pairs_.size();
+  color_mask_.assign(n, 0);
+  color_start_.assign(kMaxColors + 2, 0);
+  pair_color_.resize(m);
+  for (int k = 0; k < m; ++k){
+    int a = pairs_[k].first, b = pairs_[k].second;
+    unsigned long long free = ~(color_mask_[a] | color_mask_[b]);
+    int c = free == 0 ? kMaxColors : __builtin_ctzll(free);
+    if (c < kMaxColors){
+      color_mask_[a] |= 1ULL << c;
+      color_mask_[b] |= 1ULL << c;
+    }
+    pair_color_[k] = c;
+    ++color_start_[c + 1];
+  }
+  // Sorted by color, keeping the order within each
+  for (int c = 0; c <= kMaxColors; ++c) color_start_[c + 1] += color_start_[c];
+  colored_.resize(m);
+  for (int k = 0; k < m; ++k) colored_[color_start_[pair_color_[k]]++] = pairs_[k];
+  for (int c = kMaxColors; c > 0; --c) color_start_[c] = color_start_[c - 1];
+  color_start_[0] = 0;
+
+  for (int c = 0; c < kMaxColors; ++c){
+    int first = color_start_[c], count = color_start_[c + 1] - first;
+    if (count == 0) break;
+    split(collide_task, &colored_[first], count, kMinParallelPairs);
+  }
+  // Pairs left over may share colliders
+  collide_task(&colored_[0], 0, color_start_[kMaxColors], m);
+}
+
+// Tests every pair of objects, the way it was done before the grid
+void Physics::collision_prevention_all_pairs(){
+    if (all_.size() > 1) {
+      int a = all_.first();
+      while (a != SlotRegistry<Physical *>::kNone) {
+        if ( all_.get(a)->has_collisions() ){ // Only if A can collide
+          int b = all_.next(a);
+          while (b != SlotRegistry<Physical *>::kNone) {
+            if (all_.get(b)->has_collisions()) { // Only if B can collide
+              ++stats_.collide_calls;
+              collide(all_.get(a), all_.get(b));
+              
+            } b = all_.next(b);
+          } 
+        } a = all_.next(a);
+      }
+
+    }
+}
+
+// Sorts the colliders into square cells as wide as the largest collider,
+// so that any two that touch are in neighboring cells. Returns false if
+// nothing is colliding
+bool Physics::build_grid(){
+  int n = colliders_.size();
+  double largest = 0;
+  bool any = false;
+  for (int i = 0; i < n; ++i){
+    if (!colliders_[i]->has_collisions()) continue;
+    largest = fmax(largest, colliders_[i]->intersection_distance());
+    any = true;
+  }
+  if (!any) return false;
+  cell_size_ = largest > 0 ? 2 * largest : 1;
+
+  int buckets = 1;
+  while (buckets < kBucketsPerCollider * n) buckets *= 2;
+  bucket_head_.assign(buckets, -1);
+  cell_next_.resize(n);
+  cell_x_.resize(n);
+  cell_y_.resize(n);
+  for (int i = 0; i < n; ++i){
+    // Objects that aren't colliding right now aren't in any cell
+    cell_next_[i] = -1;
+    if (!colliders_[i]->has_collisions()) continue;
+    cell_x_[i] = cell_of(colliders_[i]->pos_.x);
+    cell_y_[i] = cell_of(colliders_[i]->pos_.y);
+    int b = bucket_of(cell_x_[i], cell_y_[i]);
+    cell_next_[i] = bucket_head_[b];
+    bucket_head_[b] = i;
+  }
+  return true;
+}
+
+// The cell a coordinate falls into. Far away coordinates share the
+// outermost cells rather than overflowing
+long Physics::cell_of(double coordinate){
+  double c = floor(coordinate / cell_size_);
+  return static_cast<long>(fmax(-1e9, fmin(1e9, c)));
+}
 
+// The bucket of the hash table that holds a cell
+int Physics::bucket_of(long cx, long cy){
+  unsigned long h = static_cast<unsigned long>(cx) * 73856093UL
+                  ^ static_cast<unsigned long>(cy) * 19349663UL;
+  return h & (bucket_head_.size() - 1);
 }
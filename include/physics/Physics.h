@@ -9,13 +9,55 @@
 #ifndef _PHYSICS_H_
 #define _PHYSICS_H_
 
-#include <list>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include "Physical.h"
+#include "SlotRegistry.h"
+#include "WorkerPool.h"
 
 class Physics {
 public:
+  // Counts of the engine's work since reset_stats()
+  struct Stats {
+    long steps;         // steps of the integration
+    long collide_calls; // pairs handed to collide()
+    long contacts;      // pairs that were touching and closing in
+    long wall_hits;     // bounces off the walls
+  };
+
   static const double kTimestep = 0.01; // seconds
   static const double kGravity = 9.81; // m/s^2 
+  // The longest step of the integration, which keeps the springs stable
+  static const double kMaxTimestep = 1 / 240.0; // seconds
+  static const int kMaxSubsteps = 64;
+  // The steps used when the engine isn't adaptive
+  static const int kFixedSubsteps = 20;
+  // How far, as a fraction of the smallest radius, two bodies may close
+  // on each other in one step
+  static const double kCollisionMargin = 0.5;
+  // Bodies slower than this, for this long, are put to sleep
+  static const double kSleepSpeed = 0.02; // units/s
+  static const double kSleepSpin = 0.02; // rad/s
+  static const double kSleepAcceleration = 0.05; // units/s^2
+  static const double kSleepTime = 0.5; // seconds
+  // Ticks per second of the physics thread
+  static const double kTickRate = 200.0;
+  // Ticks run back to back to catch up after a stall. Time lost beyond
+  // these is dropped, so the simulation slows instead of spiralling
+  static const int kMaxCatchUpTicks = 8;
+  // How many times a snapshot reader tries before it settles for what it has
+  static const int kMaxSnapshotRetries = 8;
+  // Fewer bodies or pairs than this are handled on one thread, where
+  // waking the others would cost more than it saves
+  static const int kMinParallelBodies = 64;
+  static const int kMinParallelPairs = 32;
+  // Colors of the pairs resolved in parallel. Pairs that can't be given
+  // one are resolved afterwards on one thread
+  static const int kMaxColors = 64;
 
   // Adds an object for which physics will be computed
   static void give_physics(Physical *object);
@@ -26,6 +68,33 @@ public:
   // Updates the positions of all objects 
   static void update(double timestep);
 
+  // Runs update on a thread of its own, rate times a second, instead of
+  // from the frame. Returns false if the thread couldn't be started
+  static bool start_thread(double rate = kTickRate);
+  // Stops the thread after the tick it is on. Don't hold the lock
+  static void stop_thread();
+  static bool threaded(){ return __atomic_load_n(&running_, __ATOMIC_ACQUIRE) != 0; }
+
+  // The physics thread holds this through each tick. Whatever adds,
+  // removes, moves or draws bodies and orbs from another thread holds it
+  // too
+  static void lock();
+  static void unlock();
+
+  // How far the present is from the tick before the latest one to the
+  // latest one, from 0 to 1. Always 1 without the thread. Hold the lock
+  static double render_fraction();
+  // Where to draw a body now, between its last two ticks. Hold the lock
+  static Vector3d render_position(Physical *object);
+  static Vector3d render_rotation(Physical *object);
+
+  // Reads positions from the same tick without the lock, for threads
+  // that can't wait for it. Copy what is needed between the two calls
+  // and start again if end_snapshot returns false
+  static unsigned int begin_snapshot();
+  static bool end_snapshot(unsigned int sequence);
+  static Vector3d snapshot_position(Physical *object);
+
   // Uses Velocity Verlet integration to compute the next positions of the object
   static void integrate_translational(double timestep, Physical* object);
 
@@ -48,10 +117,117 @@ public:
   // clear of discs
   static bool is_clear_area(double x, double y, double r);
 
+  // Turns off the grid, so every pair of objects is tested, for comparison
+  static void set_broad_phase(bool grid){ broad_phase_ = grid; }
+
+  static const Stats &stats(){ return stats_; }
+  static void reset_stats();
+
+  // Turns off sleeping and adaptive steps, so every frame takes the fixed
+  // number of steps over every body, for comparison
+  static void set_adaptive(bool adaptive);
+
+  // Lets a sleeping body move again. Call this whenever something other
+  // than the engine moves a body or changes its forces
+  static void wake(Physical *object);
+
+  // Splits each step between this many threads, which are pinned with
+  // the hook of the WorkerPool. With one, the touching pairs are resolved
+  // in the order they were found. With more, they are colored so that no
+  // two pairs of a color share a body, and resolved a color at a time.
+  // The results are the same for any number above one. Returns the
+  // number of threads there are now. Don't call it during an update
+  static int set_threads(int threads);
+
 
 private:
-  static std::list<Physical *> all_;
+  // Buckets in the grid's hash table per collider
+  static const int kBucketsPerCollider = 2;
+
+  // Every object, in the order they were given physics. Each knows its
+  // handle, so it is taken out without a search
+  static SlotRegistry<Physical *> all_;
+  // Every object, and those that can collide, in the order they were
+  // given physics. Listed again before they are used if any have come or
+  // gone
+  static std::vector<Physical *> bodies_;
+  static std::vector<Physical *> colliders_;
+  static bool lists_stale_;
   static double x_max_,x_min_,y_max_,y_min_;
+
+  // Enough steps that no two bodies close on each other by more than the
+  // collision margin in one, and none longer than kMaxTimestep
+  static int count_substeps(double update_time);
+  // Puts bodies that have been still for long enough to sleep
+  static void settle(double update_time);
+  // Copies every body's position out for readers on other threads
+  static void publish_snapshot();
+  static void store_snapshot(Physical *p);
+  // Runs the ticks on the physics thread
+  static void *run_thread(void *);
+  // Monotonic time in nanoseconds
+  static long long now_ns();
+  // True if any colliding body is awake
+  static bool any_awake_collider();
+
+  // Lists the objects again, if any have come or gone
+  static void refresh_lists();
+
+  // The parts of a step that are split between threads. Each works on
+  // the bodies, colliders or pairs [first, last). data points to the
+  // timestep, or to the pairs for collide_task
+  static void force_task(void *data, int part, int first, int last);
+  static void integrate_task(void *data, int part, int first, int last);
+  static void bounds_task(void *data, int part, int first, int last);
+  static void find_pairs_task(void *data, int part, int first, int last);
+  static void collide_task(void *data, int part, int first, int last);
+  // Runs a task over count items, on one thread if there are few
+  static void split(WorkerPool::Task task, void *data, int count, int fewest);
+  // Resolves the pairs a color at a time
+  static void collide_colored();
+  // Bounces one body off the walls
+  static void check_wall(Physical *p);
+
+  // Tests every pair of objects, the way it was done before the grid
+  static void collision_prevention_all_pairs();
+
+  // Sorts the colliders into square cells as wide as the largest
+  // collider, so that any two that touch are in neighboring cells. Returns
+  // false if nothing is colliding
+  static bool build_grid();
+  // The cell a coordinate falls into
+  static long cell_of(double coordinate);
+  // The bucket of the hash table that holds a cell
+  static int bucket_of(long cx, long cy);
+
+  static bool broad_phase_;
+  static bool adaptive_;
+  static Stats stats_;
+
+  static pthread_t thread_;
+  static pthread_mutex_t lock_;
+  static int running_;
+  static long long tick_ns_;
+  // When the latest tick was due
+  static long long last_tick_ns_;
+  // Odd while a snapshot is being written
+  static unsigned int snapshot_sequence_;
+  static double cell_size_;
+  // Each bucket is a chain of colliders through cell_next_. Several cells
+  // can share a bucket, so each collider remembers its own cell
+  static std::vector<int> bucket_head_, cell_next_;
+  static std::vector<long> cell_x_, cell_y_;
+  // The colliders found near the one being tested, and the touching
+  // pairs of colliders found, for each part of the split
+  static std::vector<std::vector<int> > neighbors_;
+  static std::vector<std::vector<std::pair<int, int> > > part_pairs_;
+  // Every pair, in the order one thread would find them, then sorted by
+  // color
+  static std::vector<std::pair<int, int> > pairs_, colored_;
+  // The colors each collider's pairs have taken, and where each color
+  // starts among the sorted pairs
+  static std::vector<unsigned long long> color_mask_;
+  static std::vector<int> pair_color_, color_start_;
   
 };
 
@@ -0,0 +1,93 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  SlotRegistry.h
+  A list of objects that are added and removed all the time, such as the
+  orbs. Each entry gets a handle, an index into an array of slots, which
+  the object keeps so that it can be found and removed without searching.
+  The entries are linked in order through their slots, so iterating sees
+  them in the order they were put in, and removing one leaves the order
+  of the rest alone. Freed slots are given out again.
+*/
+
+#ifndef _SLOTREGISTRY_H_
+#define _SLOTREGISTRY_H_
+
+#include <vector>
+
+template <class T>
+class SlotRegistry {
+public:
+  // The handle of nothing, before the first entry and after the last
+  static const int kNone = -1;
+
+  SlotRegistry() : head_(kNone), tail_(kNone), free_(kNone), size_(0) {}
+
+  // Adds an entry right after another one, or at the front after kNone.
+  // Returns the new entry's handle
+  int insert_after(int after, const T &item){
+    int h = free_;
+    if (h != kNone) free_ = slots_[h].next;
+    else {
+      h = slots_.size();
+      slots_.push_back(Slot());
+    }
+    Slot &s = slots_[h];
+    s.item = item;
+    s.used = true;
+    s.prev = after;
+    s.next = after == kNone ? head_ : slots_[after].next;
+    if (s.prev == kNone) head_ = h;
+    else slots_[s.prev].next = h;
+    if (s.next == kNone) tail_ = h;
+    else slots_[s.next].prev = h;
+    ++size_;
+    return h;
+  }
+
+  int push_back(const T &item){ return insert_after(tail_, item); }
+
+  // Takes an entry out. Its handle may be given to a later entry
+  void remove(int h){
+    Slot &s = slots_[h];
+    if (s.prev == kNone) head_ = s.next;
+    else slots_[s.prev].next = s.next;
+    if (s.next == kNone) tail_ = s.prev;
+    else slots_[s.next].prev = s.prev;
+    s.used = false;
+    s.item = T();
+    s.next = free_;
+    free_ = h;
+    --size_;
+  }
+
+  // True if the handle is of an entry that is still in the list
+  bool contains(int h) const {
+    return h >= 0 && h < slots_.size() && slots_[h].used;
+  }
+
+  T &get(int h){ return slots_[h].item; }
+
+  // Walks the entries in order: for (h = first(); h != kNone; h = next(h))
+  int first() const { return head_; }
+  int last() const { return tail_; }
+  int next(int h) const { return slots_[h].next; }
+  int prev(int h) const { return slots_[h].prev; }
+  int size() const { return size_; }
+
+private:
+  struct Slot {
+    T item;
+    int prev, next;
+    bool used;
+  };
+
+  std::vector<Slot> slots_;
+  int head_, tail_;
+  // The unused slots, chained through next
+  int free_;
+  int size_;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  WorkerPool.cpp
+  A few threads that split a loop between them.
+*/
+
+#include "WorkerPool.h"
+
+std::vector<pthread_t> WorkerPool::workers_;
+int WorkerPool::threads_ = 1;
+bool (*WorkerPool::hook_)() = NULL;
+WorkerPool::Task WorkerPool::task_ = NULL;
+void *WorkerPool::data_ = NULL;
+int WorkerPool::count_ = 0;
+int WorkerPool::grain_ = 1;
+unsigned int WorkerPool::generation_ = 0;
+int WorkerPool::pending_ = 0;
+int WorkerPool::running_ = 0;
+pthread_mutex_t WorkerPool::lock_ = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t WorkerPool::wake_ = PTHREAD_COND_INITIALIZER;
+
+// Runs work on this many threads, counting the one that calls run
+int WorkerPool::start(int threads){
+  stop();
+  if (threads > kMaxThreads) threads = kMaxThreads;
+  if (threads <= 1) return threads_;
+
+  __atomic_store_n(&running_, 1, __ATOMIC_RELEASE);
+  for (long i = 1; i < threads; ++i){
+    pthread_t worker;
+    if (pthread_create(&worker, NULL, run_worker, reinterpret_cast<void *>(i)) != 0){
+      printf("Could only start %d of %d physics threads\n", static_cast<int>(i), threads);
+      break;
+    }
+    workers_.push_back(worker);
+  }
+  threads_ = workers_.size() + 1;
+  return threads_;
+}
+
+// Stops and joins the workers
+void WorkerPool::stop(){
+  if (workers_.empty()) return;
+  pthread_mutex_lock(&lock_);
+  __atomic_store_n(&running_, 0, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&wake_);
+  pthread_mutex_unlock(&lock_);
+  for (int i = 0; i < workers_.size(); ++i) pthread_join(workers_[i], NULL);
+  workers_.clear();
+  threads_ = 1;
+  // New workers start out having seen generation zero. Left as it was,
+  // they would run the last task again as soon as they started
+  generation_ = 0;
+  pending_ = 0;
+}
+
+// Splits [0, count) into one part per thread and waits for all of them
+void WorkerPool::run(Task task, void *data, int count, int grain){
+  if (count <= 0) return;
+  if (threads_ <= 1){
+    task(data, 0, 0, count);
+    return;
+  }
+  task_ = task;
+  data_ = data;
+  count_ = count;
+  grain_ = grain;
+  __atomic_store_n(&pending_, threads_ - 1, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&lock_);
+  __atomic_add_fetch(&generation_, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&wake_);
+  pthread_mutex_unlock(&lock_);
+
+  int last = part_start(1, count, grain);
+  if (last > 0) task(data, 0, 0, last);
+  while (__atomic_load_n(&pending_, __ATOMIC_ACQUIRE) > 0) sched_yield();
+}
+
+// The first item of a part. The parts are as even as the grain allows
+int WorkerPool::part_start(int part, int count, int grain){
+  int per_part = (count + threads_ - 1) / threads_;
+  per_part = (per_part + grain - 1) / grain * grain;
+  long first = static_cast<long>(part) * per_part;
+  return first < count ? first : count;
+}
+
+// #------------- Private --------------#
+
+// Waits for work, does its part and says so
+void *WorkerPool::run_worker(void *index){
+  int part = static_cast<int>(reinterpret_cast<long>(index));
+  if (hook_ != NULL) hook_();
+  unsigned int seen = 0;
+  while (true){
+    unsigned int generation = __atomic_load_n(&generation_, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < kSpinCount && generation == seen; ++i){
+      generation = __atomic_load_n(&generation_, __ATOMIC_ACQUIRE);
+    }
+    if (generation == seen){
+      pthread_mutex_lock(&lock_);
+      while ((generation = __atomic_load_n(&generation_, __ATOMIC_ACQUIRE)) == seen &&
+             __atomic_load_n(&running_, __ATOMIC_ACQUIRE)){
+        pthread_cond_wait(&wake_, &lock_);
+      }
+      pthread_mutex_unlock(&lock_);
+    }
+    if (!__atomic_load_n(&running_, __ATOMIC_ACQUIRE)) break;
+    seen = generation;
+
+    int first = part_start(part, count_, grain_);
+    int last = part_start(part + 1, count_, grain_);
+    if (first < last) task_(data_, part, first, last);
+    __atomic_sub_fetch(&pending_, 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
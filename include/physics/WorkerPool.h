@@ -0,0 +1,70 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  WorkerPool.h
+  A few threads that split a loop between them. The thread that calls run
+  takes the first part itself and waits for the others. Work is split the
+  same way every time for the same number of items and threads, so the
+  results don't depend on which thread got there first. Idle workers spin
+  for a moment, since the next piece of work usually follows right away,
+  then sleep until they are needed.
+*/
+
+#ifndef _WORKERPOOL_H_
+#define _WORKERPOOL_H_
+
+#include <cstdio>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+class WorkerPool {
+public:
+  // Works on the items [first, last), the part'th of the split
+  typedef void (*Task)(void *data, int part, int first, int last);
+
+  static const int kMaxThreads = 64;
+  // Times an idle worker looks for work before it sleeps
+  static const int kSpinCount = 20000;
+
+  // Runs work on this many threads, counting the one that calls run. One
+  // stops the workers. Returns the number of threads there are now
+  static int start(int threads);
+  static void stop();
+  static int threads(){ return threads_; }
+
+  // Called at the start of each worker, to pin it to the cores meant for
+  // it. Set it before start
+  static void set_thread_hook(bool (*hook)()){ hook_ = hook; }
+
+  // Splits [0, count) into one part per thread, each a multiple of grain
+  // long but the last, and returns when all of them are done. Not to be
+  // called from a task
+  static void run(Task task, void *data, int count, int grain = 1);
+
+  // The first item of a part
+  static int part_start(int part, int count, int grain);
+
+private:
+  static void *run_worker(void *index);
+
+  static std::vector<pthread_t> workers_;
+  static int threads_;
+  static bool (*hook_)();
+
+  // The work, written before generation_ is advanced
+  static Task task_;
+  static void *data_;
+  static int count_, grain_;
+  // Advanced once for every run. Workers wait for it to change. Back to
+  // zero when the workers are stopped
+  static unsigned int generation_;
+  // Workers still busy with the current run
+  static int pending_;
+  static int running_;
+  static pthread_mutex_t lock_;
+  static pthread_cond_t wake_;
+};
+
+#endif
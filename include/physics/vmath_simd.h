@@ -0,0 +1,182 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  vmath_simd.h
+  Float versions of the vector math that is run over many vectors at once:
+  lengths, normalizing and dot products of arrays of Vector2f and Vector4f,
+  four vectors at a time where SSE is available and one at a time
+  elsewhere. The sums are taken in the same order as vmath takes them, so
+  the answers are the same to the bit as calling vmath on each vector.
+  vmath's vectors hold nothing but their components, so an array of them
+  is read as an array of floats.
+
+  The world is flat, so code that wants to keep its state in floats can
+  hold a Vector2f and convert at the edges with to_float and to_double.
+*/
+
+#ifndef _VMATH_SIMD_H_
+#define _VMATH_SIMD_H_
+
+#include "vmath.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #include <emmintrin.h>
+  #define HAS_SSE2
+#endif
+
+class VectorSimd {
+public:
+  // One Vector4f fills a register
+  static float dot(const Vector4f &a, const Vector4f &b){
+#ifdef HAS_SSE2
+    __m128 m = _mm_mul_ps(_mm_loadu_ps(&a.x), _mm_loadu_ps(&b.x));
+    return sum(m);
+#else
+    return a.x*b.x + a.y*b.y + a.z*b.z + a.w*b.w;
+#endif
+  }
+
+  static float length(const Vector4f &v){ return sqrtf(dot(v, v)); }
+
+  static void normalize(Vector4f &v){
+#ifdef HAS_SSE2
+    __m128 r = _mm_loadu_ps(&v.x);
+    _mm_storeu_ps(&v.x, _mm_div_ps(r, _mm_set1_ps(sqrtf(sum(_mm_mul_ps(r, r))))));
+#else
+    v.normalize();
+#endif
+  }
+
+  // out[i] = |v[i]|
+  static void lengths(const Vector2f *v, float *out, int n){
+    int i = 0;
+#ifdef HAS_SSE2
+    for (; i + 4 <= n; i += 4){
+      __m128 x, y;
+      load(v + i, x, y);
+      _mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y))));
+    }
+#endif
+    for (; i < n; ++i) out[i] = v[i].length();
+  }
+
+  // Scales each vector to a length of one. Zero vectors come out as NaN,
+  // as they do from vmath
+  static void normalize(Vector2f *v, int n){
+    int i = 0;
+#ifdef HAS_SSE2
+    for (; i + 4 <= n; i += 4){
+      __m128 x, y;
+      load(v + i, x, y);
+      __m128 s = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+      store(v + i, _mm_div_ps(x, s), _mm_div_ps(y, s));
+    }
+#endif
+    for (; i < n; ++i) v[i].normalize();
+  }
+
+  // out[i] = a[i] . b[i]
+  static void dots(const Vector2f *a, const Vector2f *b, float *out, int n){
+    int i = 0;
+#ifdef HAS_SSE2
+    for (; i + 4 <= n; i += 4){
+      __m128 ax, ay, bx, by;
+      load(a + i, ax, ay);
+      load(b + i, bx, by);
+      _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)));
+    }
+#endif
+    for (; i < n; ++i) out[i] = a[i].x*b[i].x + a[i].y*b[i].y;
+  }
+
+  static void lengths(const Vector4f *v, float *out, int n){
+    int i = 0;
+#ifdef HAS_SSE2
+    for (; i + 4 <= n; i += 4){
+      __m128 x, y, z, w;
+      load(v + i, x, y, z, w);
+      _mm_storeu_ps(out + i, _mm_sqrt_ps(sum(_mm_mul_ps(x, x), _mm_mul_ps(y, y), _mm_mul_ps(z, z), _mm_mul_ps(w, w))));
+    }
+#endif
+    for (; i < n; ++i) out[i] = v[i].length();
+  }
+
+  static void normalize(Vector4f *v, int n){
+    int i = 0;
+#ifdef HAS_SSE2
+    for (; i + 4 <= n; i += 4){
+      __m128 x, y, z, w;
+      load(v + i, x, y, z, w);
+      __m128 s = _mm_sqrt_ps(sum(_mm_mul_ps(x, x), _mm_mul_ps(y, y), _mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+      x = _mm_div_ps(x, s); y = _mm_div_ps(y, s); z = _mm_div_ps(z, s); w = _mm_div_ps(w, s);
+      // Back to one vector per register
+      _MM_TRANSPOSE4_PS(x, y, z, w);
+      _mm_storeu_ps(&v[i].x, x);
+      _mm_storeu_ps(&v[i + 1].x, y);
+      _mm_storeu_ps(&v[i + 2].x, z);
+      _mm_storeu_ps(&v[i + 3].x, w);
+    }
+#endif
+    for (; i < n; ++i) v[i].normalize();
+  }
+
+  static void dots(const Vector4f *a, const Vector4f *b, float *out, int n){
+    int i = 0;
+#ifdef HAS_SSE2
+    for (; i + 4 <= n; i += 4){
+      __m128 ax, ay, az, aw, bx, by, bz, bw;
+      load(a + i, ax, ay, az, aw);
+      load(b + i, bx, by, bz, bw);
+      _mm_storeu_ps(out + i, sum(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by), _mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+    }
+#endif
+    for (; i < n; ++i) out[i] = a[i].x*b[i].x + a[i].y*b[i].y + a[i].z*b[i].z + a[i].w*b[i].w;
+  }
+
+  // The flat part of a body's state, in floats, and back
+  static Vector2f to_float(const Vector3d &v){ return Vector2f(v.x, v.y); }
+  static Vector3d to_double(const Vector2f &v, double z = 0){ return Vector3d(v.x, v.y, z); }
+
+private:
+#ifdef HAS_SSE2
+  // The four lanes added from first to last, as vmath adds components
+  static float sum(__m128 m){
+    __m128 s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+    s = _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2)));
+    s = _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(3, 3, 3, 3)));
+    return _mm_cvtss_f32(s);
+  }
+
+  static __m128 sum(__m128 a, __m128 b, __m128 c, __m128 d){
+    return _mm_add_ps(_mm_add_ps(_mm_add_ps(a, b), c), d);
+  }
+
+  // Four Vector2f, split into their x and y components
+  static void load(const Vector2f *v, __m128 &x, __m128 &y){
+    __m128 lo = _mm_loadu_ps(&v[0].x), hi = _mm_loadu_ps(&v[2].x);
+    x = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+    y = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+  }
+
+  static void store(Vector2f *v, __m128 x, __m128 y){
+    _mm_storeu_ps(&v[0].x, _mm_unpacklo_ps(x, y));
+    _mm_storeu_ps(&v[2].x, _mm_unpackhi_ps(x, y));
+  }
+
+  // Four Vector4f, split into their components
+  static void load(const Vector4f *v, __m128 &x, __m128 &y, __m128 &z, __m128 &w){
+    x = _mm_loadu_ps(&v[0].x);
+    y = _mm_loadu_ps(&v[1].x);
+    z = _mm_loadu_ps(&v[2].x);
+    w = _mm_loadu_ps(&v[3].x);
+    _MM_TRANSPOSE4_PS(x, y, z, w);
+  }
+#endif
+
+  // The arrays are only read as floats if vmath packs them that way
+  typedef char vector2f_is_packed[sizeof(Vector2f) == 2 * sizeof(float) ? 1 : -1];
+  typedef char vector4f_is_packed[sizeof(Vector4f) == 4 * sizeof(float) ? 1 : -1];
+};
+
+#endif
@@ -15,6 +15,7 @@ Disc* Disc::spotlight_disc_ = NULL;
 double Disc::spotlight_graphic_timer = 0;
 bool Disc::texture_loaded_ = false;
 GLuint *Disc::tex_ = new GLuint[23];
+GLuint Disc::meshes_ = 0;
 
 
 
@@ -33,6 +34,7 @@ Disc::Disc(UnitGenerator *u, double radius, bool ghost, int initial_orbs, int ma
   
   // Drawing and Orbs
   which_texture_ = -1;
+  type_ = -1;
   color_ = Vector3d(0,0,1);
   initial_orbs_ = initial_orbs;
   maintain_orbs_ = maintain_orbs;
@@ -41,15 +43,14 @@ Disc::Disc(UnitGenerator *u, double radius, bool ghost, int initial_orbs, int ma
   brightness_ = 0;
   pulse_timer_ = 100;
   ghost_ = ghost;
-  
-  quadratic = gluNewQuadric();
     
-  ID = Disc::NEXT_ID++;
+  // Scenes are read on the session's loader thread while the GUI may be
+  // placing discs of its own, so two of them can't take the same number
+  ID = __atomic_fetch_add(&Disc::NEXT_ID, 1, __ATOMIC_RELAXED);
 }
 
 // Cleans up the unit generator
 Disc::~Disc(){
-  delete quadratic;
   delete ugen_;
 }
 
@@ -70,6 +71,9 @@ void Disc::set_location(double x, double y){
   pos_.x = x;
   pos_.y = y;
   pos_.z = 0;
+  // Jumps straight there rather than sliding over from the last tick
+  prev_pos_ = pos_;
+  Physics::wake(this);
 }
 
 // Sets instantaneous velocity of the disc
@@ -77,6 +81,7 @@ void Disc::set_velocity(double x, double y){
   vel_.x = x;
   vel_.y = y;
   vel_.z = 0;
+  Physics::wake(this);
 }
 
 
@@ -102,8 +107,7 @@ void Disc::orb_create(int num_orbs){
     Orb *roy_orbison = new Orb(&pos_, 2*r_);
     roy_orbison->use_color_scheme(orb_color_scheme_);
     orbs_.push_back(roy_orbison);
-    Graphics::add_drawable(roy_orbison);
-    Physics::give_physics(roy_orbison);
+    OrbRenderer::add(roy_orbison);
   }
 }
 
@@ -158,8 +162,7 @@ void Disc::orb_limit(){
 // Deletes the orb after removing all instances of it
 bool Disc::orb_destroy(){
   if (orbs_.size() > 0) {
-    Graphics::remove_drawable(*orbs_.begin());
-    Physics::take_physics(*orbs_.begin());
+    OrbRenderer::remove(*orbs_.begin());
     delete *orbs_.begin();
     orbs_.erase(orbs_.begin());  
     return true;
@@ -189,32 +192,21 @@ void Disc::draw(){
 
  glPushMatrix();
     glScalef(r_, r_, 1);
-    int res = 24;
 
-    gluQuadricNormals(quadratic, GLU_SMOOTH);   // Create Smooth Normals ( NEW )
-    gluQuadricTexture(quadratic, GL_TRUE);
-    
-    // Animate the selected disc
+    // Animate the selected disc, outermost ring first
     if (this == spotlight_disc_){
+      static const double kRingAlpha[kNumSpotlightRings] = {.23, .1, .08, .04};
       double spot_alpha = .15*sin(8*spotlight_graphic_timer);
-      glColor4f(color_.x,color_.y,color_.z, 
-                .23 + spot_alpha);
-      gluDisk(quadratic,1.95f,2.0f,res,res);
-      glColor4f(color_.x,color_.y,color_.z,
-                .1 + spot_alpha);
-      gluDisk(quadratic,1.75f,1.8f,res,res);
-      glColor4f(color_.x,color_.y,color_.z, 
-                .08 + spot_alpha);
-      gluDisk(quadratic,1.55f,1.6f,res,res);
-      glColor4f(color_.x,color_.y,color_.z, 
-                .04 + spot_alpha);
-      gluDisk(quadratic,1.35f,1.4f,res,res);
+      for (int i = 0; i < kNumSpotlightRings; ++i){
+        glColor4f(color_.x,color_.y,color_.z, kRingAlpha[i] + spot_alpha);
+        glCallList(meshes_ + kFirstRingMesh + i);
+      }
     }
 
     glColor4f(color_.x,color_.y,color_.z, alpha);
-    gluCylinder(quadratic,1.0f,1.0f,1.0f,res,res);
+    glCallList(meshes_ + kSideMesh);
     //Draw the faces
-    gluDisk(quadratic,0.0f,1.0f,res,res);
+    glCallList(meshes_ + kFaceMesh);
     glTranslatef(0,0,1);
     
     // Prepare attributes for top face
@@ -230,21 +222,23 @@ void Disc::draw(){
       glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
     // Draw top design
-    gluDisk(quadratic,0.0f,1.0f,res,res);
+    glCallList(meshes_ + kFaceMesh);
 
     glPopAttrib();
     glPopMatrix();
 }
 
-// The current location of the disc's center
+// The current location of the disc's center, between the last two ticks
 void Disc::get_origin(double &x, double &y, double &z){
-  x=pos_.x; y=pos_.y; z=0;
+  Vector3d p = Physics::render_position(this);
+  x=p.x; y=p.y; z=0;
 }
 
 // The current orientation of the disk
 void Disc::get_rotation(double &w, double &x, double &y, double &z){
-  w=ang_pos_.length() * 180.0 / 3.1415926535; 
-  x=ang_pos_.x; y=ang_pos_.y; z=ang_pos_.z;
+  Vector3d a = Physics::render_rotation(this);
+  w=a.length() * 180.0 / 3.1415926535; 
+  x=a.x; y=a.y; z=a.z;
 }
 
 // Sets up the visual attributes for the Disc
@@ -325,6 +319,7 @@ void Disc::prepare_graphics(void){
     
     texture_loaded_ = true;
   }
+  if (meshes_ == 0) build_meshes();
 }
 
 void Disc::advance_time(double t){
@@ -349,6 +344,8 @@ void Disc::advance_time(double t){
 void Disc::move(double x, double y, double z){
   is_clicked_ = true;
   pull_point_ = Vector3d(x,y,0);
+  // A sleeping disc has to feel the pull
+  Physics::wake(this);
 
 }
 
@@ -370,6 +367,7 @@ bool Disc::check_clicked(double x, double y, double z){
 //Signals that the disc is no longer clicked.
 void Disc::unclicked(){ 
   is_clicked_ = false;
+  Physics::wake(this);
   if (ghost_){ 
     orb_create(initial_orbs_);
     ghost_ = false;
@@ -415,6 +413,36 @@ Vector3d Disc::external_torques(){
 
 // #-------------- Private ----------------#
 
+// Builds the meshes that every disc is drawn from, once. GLU makes them
+// with smooth normals and texture coordinates, as the discs always were
+void Disc::build_meshes(){
+  meshes_ = glGenLists(kFirstRingMesh + kNumSpotlightRings);
+  if (meshes_ == 0){
+    printf("Could not make display lists for the discs\n");
+    return;
+  }
+  GLUquadricObj *quadric = gluNewQuadric();
+  gluQuadricNormals(quadric, GLU_SMOOTH);
+  gluQuadricTexture(quadric, GL_TRUE);
+  int res = kMeshResolution;
+
+  glNewList(meshes_ + kSideMesh, GL_COMPILE);
+  gluCylinder(quadric, 1.0f, 1.0f, 1.0f, res, res);
+  glEndList();
+
+  glNewList(meshes_ + kFaceMesh, GL_COMPILE);
+  gluDisk(quadric, 0.0f, 1.0f, res, res);
+  glEndList();
+
+  // Rings from 2.0 inwards, a tenth of a radius wide a fifth apart
+  for (int i = 0; i < kNumSpotlightRings; ++i){
+    glNewList(meshes_ + kFirstRingMesh + i, GL_COMPILE);
+    gluDisk(quadric, 1.95f - .2f*i, 2.0f - .2f*i, res, res);
+    glEndList();
+  }
+  gluDeleteQuadric(quadric);
+}
+
 // Loads a texture from a file, must be in bmp format
 GLuint Disc::loadTextureFromFile( const char * filename ){
   GLuint texture;
@@ -458,6 +486,7 @@ void Disc::handle_looper_unclick(){
   if (loop->click_data.first<200000 && 
     loop->click_data.second<200000){
     loop->data = static_cast<void *>(this);
+    loop->disc_id = ID;
     loop->pulsefnc = loop_pulse_function;
     loop->start_countdown();
   }
@@ -466,6 +495,16 @@ void Disc::handle_looper_unclick(){
   loop->click_data.first = new_click;
 }
 
+// Lets a looper that was restored from a session pulse this disc. One 
+// that was already playing gets the orbs it would have had
+void Disc::attach_looper(){
+  Looper *loop = static_cast<Looper *>(get_ugen());
+  loop->data = static_cast<void *>(this);
+  loop->disc_id = ID;
+  loop->pulsefnc = loop_pulse_function;
+  if (loop->has_recording()) set_orb_maintain(100);
+}
+
 void loop_pulse_function(void *data, int message){
   Disc *d = static_cast<Disc *>(data);
   if (message != -100) d->set_texture(15 + message);
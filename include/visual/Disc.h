@@ -18,6 +18,7 @@
 #include "Drawable.h" //imports opengl stuff, too
 #include "Moveable.h"
 #include "Orb.h"
+#include "OrbRenderer.h"
 #include "Physical.h"
 #include "vmath.h"
 
@@ -25,6 +26,9 @@
 class Disc : public Drawable, public Moveable, public Physical{
 public:
   static const int kNumParticles = 5;
+  // Slices and loops of the meshes that the discs are drawn from
+  static const int kMeshResolution = 24;
+  static const int kNumSpotlightRings = 4;
   static int NEXT_ID;
 
   // Pairs the disc with a unit generator, can be set to ghost mode
@@ -56,6 +60,13 @@ public:
   // with the disc
   UnitGenerator *get_ugen(){  return ugen_;  }
 
+  // The menu button that made this disc, used to make it again
+  void set_type(int type){ type_ = type; }
+  int get_type(){ return type_; }
+
+  // Lets a looper that was restored from a session pulse this disc
+  void attach_looper();
+
   // Forwards request for parameter values
   double get_ugen_params(int param);
 
@@ -171,8 +182,18 @@ private:
   void handle_looper_click();
   void handle_looper_unclick();
 
+  // Builds the meshes that every disc is drawn from, once
+  static void build_meshes();
+
   static GLuint *tex_;
   static bool texture_loaded_;
+  // Display lists of a unit cylinder's side and face, and of the
+  // spotlight's rings. They hold only the shapes, so each disc draws them
+  // in its own color and texture
+  static const int kSideMesh = 0;
+  static const int kFaceMesh = 1;
+  static const int kFirstRingMesh = 2;
+  static GLuint meshes_;
   static double spotlight_graphic_timer;
 
 
@@ -184,11 +205,9 @@ private:
   Vector3d pull_point_;
   bool is_clicked_;
 
-  
-  //An object that is useful for drawing the cylinder
-  GLUquadricObj *quadratic; 
 
   int which_texture_;
+  int type_;
   std::list<Orb *> orbs_;
   Vector3d color_;
   int initial_orbs_;
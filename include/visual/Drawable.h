@@ -18,6 +18,7 @@
 
 class Drawable {
 public: 
+  Drawable() : draw_handle_(-1), draw_priority_(0) {}
   virtual void draw() = 0;
   virtual void get_origin(double &x, double &y, double &z) = 0;
   virtual void get_rotation(double &w, double &x, double &y, double &z) = 0;
@@ -26,6 +27,10 @@ public:
   virtual void prepare_graphics(void) = 0;
   virtual void advance_time(double t){};
   virtual void clean_up(){};
+
+  // Where the thing is in the draw list, -1 while it isn't drawn
+  int draw_handle_;
+  int draw_priority_;
 };
 
 
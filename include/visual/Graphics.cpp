@@ -17,9 +17,10 @@ void recoverClick(int, int, double &, double &);
 void keyboard(unsigned char key, int, int);
 void reshape(int width, int height);
 
-std::list<Drawable *> Graphics::draw_list_;
-std::list<int> Graphics::draw_priority_;
-std::list<Moveable *> Graphics::move_list_;
+SlotRegistry<Drawable *> Graphics::draw_list_;
+std::map<int, DrawBucket> Graphics::draw_buckets_;
+SlotRegistry<Moveable *> Graphics::move_list_;
+std::map<unsigned char, KeyListener> Graphics::key_listeners_;
 
 Moveable *clicked;
 bool valid_clicked;
@@ -80,65 +81,68 @@ int Graphics::initialize(int argc, char *argv[]){
 void Graphics::start_graphics(){ glutMainLoop(); }
 
 
+// Things of the same priority are drawn newest first, except at the
+// lowest priority where they are drawn in the order they were added
 void Graphics::add_drawable(Drawable * const k, int priority){ 
   k->prepare_graphics();
-  if (priority < 999999){
-
-    std::list<Drawable *>::iterator it;
-    std::list<int>::iterator pri_it;
-    it = Graphics::draw_list_.begin();
-    pri_it = Graphics::draw_priority_.begin();
-    while (it != Graphics::draw_list_.end()) {
-      if (*pri_it >= priority){
-        Graphics::draw_list_.insert(it, k);
-        Graphics::draw_priority_.insert(pri_it, priority); 
-        return;
-      }
-      ++it; ++pri_it;
-    }
+  if (draw_list_.contains(k->draw_handle_) && draw_list_.get(k->draw_handle_) == k) return;
+  k->draw_priority_ = priority;
+  std::map<int, DrawBucket>::iterator bucket = draw_buckets_.find(priority);
+  if (priority >= 999999){
+    k->draw_handle_ = draw_list_.push_back(k);
+    if (bucket == draw_buckets_.end()) draw_buckets_[priority] = DrawBucket(k->draw_handle_, k->draw_handle_);
+    else bucket->second.last = k->draw_handle_;
+    return;
   }
-  Graphics::draw_list_.push_back(k); 
-  Graphics::draw_priority_.push_back(priority); 
-  
+
+  // Goes in at the front of its bucket, right after the bucket before it
+  int after = SlotRegistry<Drawable *>::kNone;
+  std::map<int, DrawBucket>::iterator before = draw_buckets_.lower_bound(priority);
+  if (before != draw_buckets_.begin()){
+    --before;
+    after = before->second.last;
+  }
+  k->draw_handle_ = draw_list_.insert_after(after, k);
+  if (bucket == draw_buckets_.end()) draw_buckets_[priority] = DrawBucket(k->draw_handle_, k->draw_handle_);
+  else bucket->second.first = k->draw_handle_;
 }
 
 // Removes an item from the draw list
 bool Graphics::remove_drawable(Drawable * const k){ 
-  if (Graphics::draw_list_.size() > 0) {
-    std::list<Drawable *>::iterator it;
-    std::list<int>::iterator pri_it;
-    it = Graphics::draw_list_.begin();
-    pri_it = Graphics::draw_priority_.begin();
-    
-    while (it != Graphics::draw_list_.end()) {
-      if (*it == k){
-        Graphics::draw_list_.erase(it);
-        Graphics::draw_priority_.erase(pri_it);
-        return true;
-      }
-      ++it; ++pri_it;
-    }
-  }
-  return false;
+  int h = k->draw_handle_;
+  if (!draw_list_.contains(h) || draw_list_.get(h) != k) return false;
+
+  std::map<int, DrawBucket>::iterator bucket = draw_buckets_.find(k->draw_priority_);
+  DrawBucket &b = bucket->second;
+  if (b.first == h && b.last == h) draw_buckets_.erase(bucket);
+  else if (b.first == h) b.first = draw_list_.next(h);
+  else if (b.last == h) b.last = draw_list_.prev(h);
+
+  draw_list_.remove(h);
+  k->draw_handle_ = SlotRegistry<Drawable *>::kNone;
+  return true;
 }
 
 
-void Graphics::add_moveable(Moveable * const k){ move_list_.push_back(k); }
+void Graphics::add_moveable(Moveable * const k){
+  if (move_list_.contains(k->move_handle_) && move_list_.get(k->move_handle_) == k) return;
+  k->move_handle_ = move_list_.push_back(k);
+}
 
 // Removes an item from the move list
 bool Graphics::remove_moveable(Moveable * const k){ 
-  if (Graphics::move_list_.size() > 0) {
-    std::list<Moveable *>::iterator it;
-    it = Graphics::move_list_.begin();
-    while (it != Graphics::move_list_.end()) {
-      if (*it == k){
-        Graphics::move_list_.erase(it);
-        return true;
-      }
-      ++it;
-    }
-  }
-  return false;
+  int h = k->move_handle_;
+  if (!move_list_.contains(h) || move_list_.get(h) != k) return false;
+  move_list_.remove(h);
+  k->move_handle_ = SlotRegistry<Moveable *>::kNone;
+  return true;
+}
+
+// Calls fnc(data, key) whenever key is pressed. Replaces any
+// listener already registered for the key
+void Graphics::add_key_listener(unsigned char key, 
+                                void (*fnc)(void *, unsigned char), void *data){
+  Graphics::key_listeners_[key] = KeyListener(fnc, data);
 }
 
 
@@ -177,9 +181,11 @@ void display() {
     gettimeofday(&timer, NULL);  
     time_post = (long)(timer.tv_sec*1000000+timer.tv_usec);
     time_diff =  time_post - time_pre;
-    
-    Physics::update(time_diff*1.0e-6);
   }
+  // The physics thread waits while the frame is drawn
+  Physics::lock();
+  // Without the thread, the world moves by however long the frame took
+  if (time_pre > 0 && !Physics::threaded()) Physics::update(time_diff*1.0e-6);
   gettimeofday(&timer, NULL);  
   time_pre = (long)(timer.tv_sec*1000000+timer.tv_usec);
   
@@ -202,27 +208,25 @@ void display() {
   double w,x,y,z;
   //Draws every drawable that is on the list
   if (Graphics::draw_list_.size() > 0) {
-    std::list<Drawable *>::iterator it;
-    std::list<Drawable *>::iterator backup;
-    it = Graphics::draw_list_.begin();
+    int h = Graphics::draw_list_.first();
     //Process each effect in chain
-    int count = 0;
-    while (it != Graphics::draw_list_.end()) {
+    while (h != SlotRegistry<Drawable *>::kNone) {
+      Drawable *d = Graphics::draw_list_.get(h);
       if (time_pre > 0){
-        (*it)->advance_time(time_diff*1.0e-6);
+        d->advance_time(time_diff*1.0e-6);
       }
       glPushMatrix();
-      (*it)->set_attributes();
-      (*it)->get_origin(x,y,z);
+      d->set_attributes();
+      d->get_origin(x,y,z);
       glTranslatef(x,y,z);
-      (*it)->get_rotation(w,x,y,z);
+      d->get_rotation(w,x,y,z);
       glRotatef(w,x,y,z);
-      (*it)->draw();
-      (*it)->remove_attributes();
+      d->draw();
+      d->remove_attributes();
       // Handles the case where clean_up removes 
       // the instance from the list
-      backup = it++;
-      (*backup)->clean_up();
+      h = Graphics::draw_list_.next(h);
+      d->clean_up();
       glPopMatrix();
     }
   }
@@ -259,6 +263,7 @@ void display() {
 
   }
   glPopMatrix();
+  Physics::unlock();
 
   // flush!
   glFlush();
@@ -274,6 +279,7 @@ void display() {
 void mouse(int button, int state, int x, int y) {
     double coordX, coordY;
     recoverClick(x,y, coordX, coordY);
+    Physics::lock();
 
     if (button == GLUT_LEFT_BUTTON) {
     // when left mouse button is down, move left
@@ -284,17 +290,17 @@ void mouse(int button, int state, int x, int y) {
         //Graphics::splash_loaded_ = false;
 
         if (Graphics::move_list_.size() > 0) {
-          std::list<Moveable *>::iterator it;
-          it = Graphics::move_list_.begin();
-          while (it != Graphics::move_list_.end()) {
-            if ((*it)->check_clicked(coordX, coordY, -z_distance)){
+          int h = Graphics::move_list_.first();
+          while (h != SlotRegistry<Moveable *>::kNone) {
+            Moveable *m = Graphics::move_list_.get(h);
+            if (m->check_clicked(coordX, coordY, -z_distance)){
                 // Found the right object under the cursor
                 valid_clicked = true;
-                clicked = *it;
+                clicked = m;
                 clicked->prepare_move(coordX, coordY, -z_distance);
                 clicked->move(coordX, coordY, -z_distance);
                 break;
-            } ++it;
+            } h = Graphics::move_list_.next(h);
           }
         }
       } else {
@@ -309,18 +315,19 @@ void mouse(int button, int state, int x, int y) {
       // when right mouse button down, move right
       if (state == GLUT_DOWN) {
         if (Graphics::move_list_.size() > 0) {
-          std::list<Moveable *>::iterator it;
-          it = Graphics::move_list_.begin();
-          while (it != Graphics::move_list_.end()) {
-            if ((*it)->check_clicked(coordX, coordY, -z_distance)){
-                (*it)->right_clicked();
+          int h = Graphics::move_list_.first();
+          while (h != SlotRegistry<Moveable *>::kNone) {
+            Moveable *m = Graphics::move_list_.get(h);
+            if (m->check_clicked(coordX, coordY, -z_distance)){
+                m->right_clicked();
                 break;
-            } ++it;
+            } h = Graphics::move_list_.next(h);
           }
         }
       }
     } else {
     }
+  Physics::unlock();
 
   glutPostRedisplay();
 }
@@ -329,7 +336,9 @@ void mouseMotion(int x, int y){
     double oX, oY;
     recoverClick(x,y, oX, oY); 
     if (valid_clicked){
+      Physics::lock();
       clicked->move(oX, oY, -z_distance);
+      Physics::unlock();
     }
     glutPostRedisplay();
 }
@@ -361,6 +370,8 @@ void recoverClick(int iX, int iY, double &oX, double &oY){
 void keyboard(unsigned char key, int x, int y){
   switch (key){
     case ('x'):
+      // Static objects are destroyed on the way out, so nothing can be moving
+      Physics::stop_thread();
       exit(0);
     break;
     case ('f'):
@@ -374,6 +385,14 @@ void keyboard(unsigned char key, int x, int y){
         fullscreen = false;
       }
     break;
+    default:
+      if (Graphics::key_listeners_.count(key)){
+        KeyListener l = Graphics::key_listeners_[key];
+        Physics::lock();
+        l.first(l.second, key);
+        Physics::unlock();
+      }
+    break;
   }
 }
 
@@ -10,6 +10,7 @@
 #define _GRAPHICSBOX_H_
 
 #include <list>
+#include <map>
 #include <math.h>
 #include <sys/time.h>
 #include <time.h>
@@ -17,6 +18,7 @@
 #include "Drawable.h"
 #include "Moveable.h"
 #include "Physics.h"
+#include "SlotRegistry.h"
 #include "RgbImage.h"
 #include <unistd.h> //usleep
 #ifdef __MACOSX_CORE__
@@ -28,6 +30,16 @@
 #endif
 
 
+// A function that is called with its data when a key is pressed
+typedef std::pair<void (*)(void *, unsigned char), void *> KeyListener;
+
+// The handles of the first and last things drawn at one priority
+struct DrawBucket {
+  DrawBucket() : first(-1), last(-1) {}
+  DrawBucket(int f, int l) : first(f), last(l) {}
+  int first, last;
+};
+
 class Graphics{
 public: 
   Graphics(int w, int h);
@@ -47,10 +59,19 @@ public:
   static bool remove_drawable(Drawable * const);
   static void add_moveable(Moveable * const);
   static bool remove_moveable(Moveable * const);
+
+  // Calls fnc(data, key) whenever key is pressed. Replaces any
+  // listener already registered for the key
+  static void add_key_listener(unsigned char key, 
+                               void (*fnc)(void *, unsigned char), void *data);
   
-  static std::list<Drawable *> draw_list_;
-  static std::list<Moveable *> move_list_;
-  static std::list<int> draw_priority_;
+  // Drawn in order of priority. Each thing knows its handle, so it is
+  // taken out without a search
+  static SlotRegistry<Drawable *> draw_list_;
+  // Where each priority's things start and end in the draw list
+  static std::map<int, DrawBucket> draw_buckets_;
+  static std::map<unsigned char, KeyListener> key_listeners_;
+  static SlotRegistry<Moveable *> move_list_;
 
   static GLuint splash_;
   static bool show_splash_;
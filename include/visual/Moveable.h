@@ -11,12 +11,15 @@
 
 class Moveable {
 public: 
+  Moveable() : move_handle_(-1) {}
   virtual void move(double x, double y, double z) = 0;
   virtual void prepare_move(double x, double y, double z) = 0;
   virtual bool check_clicked(double x, double y, double z) = 0;
   virtual void unclicked() = 0;
   virtual void right_clicked() = 0;
- 
+
+  // Where the thing is in the move list, -1 while it can't be moved
+  int move_handle_;
 };
 
 
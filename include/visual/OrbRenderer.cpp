@@ -0,0 +1,135 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  OrbRenderer.cpp
+  Draws every orb at once.
+*/
+
+#include "OrbRenderer.h"
+
+OrbRenderer *OrbRenderer::renderer_ = NULL;
+SlotRegistry<Orb *> OrbRenderer::orbs_;
+std::vector<float> OrbRenderer::vertices_;
+std::vector<float> OrbRenderer::colors_;
+std::vector<float> OrbRenderer::tex_coords_;
+GLuint OrbRenderer::texture_ = 0;
+bool OrbRenderer::texture_loaded_ = false;
+
+// Starts drawing an orb. The first orb puts the renderer in the draw list
+void OrbRenderer::add(Orb *orb){
+  if (renderer_ == NULL){
+    renderer_ = new OrbRenderer();
+    Graphics::add_drawable(renderer_);
+  }
+  if (orbs_.contains(orb->render_handle_) && orbs_.get(orb->render_handle_) == orb) return;
+  orb->render_handle_ = orbs_.push_back(orb);
+}
+
+// Stops drawing an orb
+bool OrbRenderer::remove(Orb *orb){
+  int h = orb->render_handle_;
+  if (!orbs_.contains(h) || orbs_.get(h) != orb) return false;
+  orbs_.remove(h);
+  orb->render_handle_ = SlotRegistry<Orb *>::kNone;
+  return true;
+}
+
+// Draws every orb where it is now, in one call
+void OrbRenderer::draw(){
+  int n = orbs_.size();
+  if (n == 0) return;
+  reserve(n);
+  double fraction = Physics::render_fraction();
+  int k = 0;
+  for (int h = orbs_.first(); h != SlotRegistry<Orb *>::kNone; h = orbs_.next(h), ++k){
+    orbs_.get(h)->fill_quad(&vertices_[12 * k], &colors_[16 * k], fraction);
+  }
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, &vertices_[0]);
+  glColorPointer(4, GL_FLOAT, 0, &colors_[0]);
+  glTexCoordPointer(2, GL_FLOAT, 0, &tex_coords_[0]);
+  glDrawArrays(GL_QUADS, 0, 4 * n);
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// The orbs are placed in the world by their own quads
+void OrbRenderer::get_origin(double &x, double &y, double &z){
+  x = 0; y = 0; z = 0;
+}
+
+void OrbRenderer::get_rotation(double &w, double &x, double &y, double &z){
+  w = 0; x = 0; y = 0; z = 1;
+}
+
+// Sets up the blending and the texture, once for all of the orbs
+void OrbRenderer::set_attributes(void){
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+  glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+  glEnable(GL_TEXTURE_2D);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+  glBindTexture(GL_TEXTURE_2D, texture_);
+}
+
+//Pops the attributes stack in OpenGL
+void OrbRenderer::remove_attributes(void){
+  glPopClientAttrib();
+  glPopAttrib();
+}
+
+// Loads the texture of the orbs
+void OrbRenderer::prepare_graphics(void){
+  if (texture_loaded_) return;
+  GLubyte *tex = new GLubyte[256 * 256 * 3];
+  FILE *tf = fopen("graphics/dustbunny.raw", "rb");
+  if (tf == NULL) printf("Could not open graphics/dustbunny.raw\n");
+  else {
+    fread(tex, 256 * 256 * 3, 1, tf);
+    fclose(tf);
+  }
+
+  glGenTextures(1, &texture_);
+  glBindTexture(GL_TEXTURE_2D, texture_);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  gluBuild2DMipmaps(GL_TEXTURE_2D, 3, 256, 256, GL_RGB, GL_UNSIGNED_BYTE, tex);
+  delete [] tex;
+  texture_loaded_ = true;
+}
+
+// Deletes the orbs that have faded away. Each takes itself out of the list
+void OrbRenderer::clean_up(){
+  int h = orbs_.first();
+  while (h != SlotRegistry<Orb *>::kNone){
+    Orb *orb = orbs_.get(h);
+    h = orbs_.next(h);
+    if (orb->is_dead()) orb->self_destruct();
+  }
+}
+
+// #------------- Private --------------#
+
+// Grows the arrays to hold n orbs. The texture coordinates are the same
+// for every quad, so they are only written as the arrays grow
+void OrbRenderer::reserve(int n){
+  int had = tex_coords_.size() / 8;
+  if (n <= had) return;
+  vertices_.resize(12 * n);
+  colors_.resize(16 * n);
+  tex_coords_.resize(8 * n);
+  // Top right, top left, bottom left and bottom right, as in fill_quad
+  static const float kQuad[8] = {1, 1, 0, 1, 0, 0, 1, 0};
+  for (int k = had; k < n; ++k){
+    for (int i = 0; i < 8; ++i) tex_coords_[8 * k + i] = kQuad[i];
+  }
+}
@@ -0,0 +1,70 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  OrbRenderer.h
+  Draws every orb at once. Each frame the orbs' quads, colors and texture
+  coordinates are written into arrays, which OpenGL draws in one call with
+  one texture and one blend setup. Only vertex arrays from OpenGL 1.1 are
+  used, so this runs on Mesa's software rasterizers as it does anywhere.
+  The renderer puts itself in the draw list with the first orb, at the
+  lowest priority, where the orbs were always drawn.
+*/
+
+#ifndef _ORBRENDERER_H_
+#define _ORBRENDERER_H_
+
+#include <vector>
+#include "Drawable.h"
+#include "Graphics.h"
+#include "Orb.h"
+#include "SlotRegistry.h"
+
+class OrbRenderer : public Drawable {
+public:
+  // Starts drawing an orb
+  static void add(Orb *orb);
+
+  // Stops drawing an orb. Returns false if it wasn't drawn
+  static bool remove(Orb *orb);
+
+  static int size(){ return orbs_.size(); }
+
+  /* ----- Drawable ----- */
+
+  // Draws every orb where it is now
+  void draw();
+
+  // The orbs are placed in the world by their own quads
+  void get_origin(double &x, double &y, double &z);
+  void get_rotation(double &w, double &x, double &y, double &z);
+
+  // Sets up the blending and the texture, once for all of the orbs
+  void set_attributes(void);
+
+  // Pops the attributes off of the stack in OpenGL
+  void remove_attributes(void);
+
+  // Loads the texture of the orbs
+  void prepare_graphics(void);
+
+  // Deletes the orbs that have faded away
+  void clean_up();
+
+private:
+  OrbRenderer(){}
+
+  // Grows the arrays to hold n orbs
+  static void reserve(int n);
+
+  static OrbRenderer *renderer_;
+  static SlotRegistry<Orb *> orbs_;
+  // Four corners for each orb, of x, y and z, of r, g, b and a, and of
+  // texture coordinates
+  static std::vector<float> vertices_, colors_, tex_coords_;
+  // The mask and image for the particles
+  static GLuint texture_;
+  static bool texture_loaded_;
+};
+
+#endif
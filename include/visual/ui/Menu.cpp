@@ -10,6 +10,7 @@
 
 
 #include "Menu.h"
+#include "Session.h"
 
 // Converts a double from 0 to 1 to the visible light spectrum
 void spectrum(double w, double &R, double &G, double &B);
@@ -27,6 +28,7 @@ Menu::Menu(){
 
   // We have to link a graph
   graph_ = NULL;
+  session_ = NULL;
 
   // Candidate discs
   valid_disc_ = false;
@@ -51,6 +53,9 @@ void Menu::enable_midi(){ midi_active_ = true; }
 // Links the menu to the audio module
 void Menu::link_ugen_graph(UGenGraphBuilder *gb){ graph_= gb; }
 
+// Links the menu to the scenes, so that loaded scenes are swapped in
+void Menu::link_session(Session *s){ session_ = s; }
+
 
 // #-------------- Drawable ----------------#
 
@@ -162,38 +167,42 @@ void Menu::draw(){
     }
   
   if (!ctrl_menu_shown_ && Disc::spotlight_disc_ != NULL){
-    // Draws the FFT
-    complex *fft = graph_->get_fft();
+    // Draws the FFT. The bands are already spaced logarithmically
+    double *fft = graph_->get_fft();
     
     int bins = graph_->get_fft_length();
     double x = -9, y = -5.4;
-    double bar_width = 5.32 / (1.0 * bins);
+    double bar_width = 16.0 / (1.0 * bins);
     double y_scale = 2.3;
+    // Brings the normalized band levels up to the range of the display
+    double level_scale = 128;
     double R, G, B;
-    double y_coord;
+    double y_coord, level;
     glColor4f(1,1,1,0);
     glPushMatrix();
       glTranslatef(1, 4.25, 0);
       draw_text(Disc::spotlight_disc_->get_ugen()->name(), true);
       glPopMatrix();
     double col;
-    glLineWidth(2);
+    glLineWidth(20*bar_width);
     for (int i = 0; i < bins; ++i){
       // The color of the bin
       col = 0;
       for (int j = -5; j < 5; ++j){
-        if (i+j>0 && i+j < bins)
-        col += .4*log10(1+100*fft[i+j].normsq());
+        if (i+j>0 && i+j < bins){
+          level = level_scale * fft[i+j];
+          col += .4*log10(1+100*level*level);
+        }
       }
       spectrum(col/10.0,R, G, B);
       glColor3f(R,G,B);
-      glLineWidth(400*(log10(i*bar_width+1) -log10((i-1)*bar_width+1)));
       // Limit max coord
-      y_coord = fmin(y_scale * .8*log10(1+400*fft[i].normsq()), 10.8);
+      level = level_scale * fft[i];
+      y_coord = fmin(y_scale * .8*log10(1+400*level*level), 10.8);
       // The bar
       glBegin(GL_LINES);
-      glVertex3f(x + 20*log10(i*bar_width+1), y, 0);
-      glVertex3f(x + 20*log10(i*bar_width+1), y + y_coord,0);
+      glVertex3f(x + (i + 0.5)*bar_width, y, 0);
+      glVertex3f(x + (i + 0.5)*bar_width, y + y_coord,0);
       glEnd();
     }
   }
@@ -246,10 +255,15 @@ void Menu::prepare_graphics(void){
 }
 
 void Menu::advance_time(double t){
+  if (session_ != NULL) session_->install_loaded();
   if (graph_->is_new_buffer()){
-    graph_->lock_thread(true);
-    graph_->update_graphics_dependencies();
-    graph_->lock_thread(false);
+    graph_->update_meters();
+    // The spectrum and the orbs follow the graph itself. Rather than wait
+    // for the audio thread, they skip a frame while it holds the lock
+    if (graph_->try_lock_thread()){
+      graph_->update_graphics_dependencies();
+      graph_->lock_thread(false);
+    }
   }
 }
 
@@ -525,142 +539,161 @@ void Menu::delete_spotlight(){
     graph_->lock_thread(true);
     graph_->remove_disc(Disc::spotlight_disc_);
     graph_->rebuild();
-    graph_->lock_thread(false);
+    // Cleared before unlocking so the audio thread never reads a deleted disc
     Disc::spotlight_disc_ = NULL;
+    graph_->lock_thread(false);
   }
 }
 
-// Creates a new disc whenever a disc button is pressed.
-void Menu::make_disc(int button){
+// Creates a ghost disc of the given type. The types are the codes of the
+// disc buttons. Returns NULL for an unknown type
+Disc *Menu::create_disc(int type){
   double rad = 1.15;
-  switch (button){
+  Disc *disc = NULL;
+  switch (type){
     // Input
     case 100: {
           Input *u_input = new Input();
-          new_disc_ = new Disc(u_input, rad, true, 200, 50);
-          new_disc_->set_color(0.5, 0.5, 0.5);
-          new_disc_->set_texture(0);
-          new_disc_->delegate_orb_color_scheme(0);
+          disc = new Disc(u_input, rad, true, 200, 50);
+          disc->set_color(0.5, 0.5, 0.5);
+          disc->set_texture(0);
+          disc->delegate_orb_color_scheme(0);
           break;
           }
     // Sine 
     case 101:{ 
           Sine *u_sine = new Sine();
-          new_disc_ = new Disc(u_sine, rad, true, 200, 50);
-          new_disc_->set_color(0.9, 0.9, 0.3);
-          new_disc_->set_texture(1);
-          new_disc_->delegate_orb_color_scheme(6);
+          disc = new Disc(u_sine, rad, true, 200, 50);
+          disc->set_color(0.9, 0.9, 0.3);
+          disc->set_texture(1);
+          disc->delegate_orb_color_scheme(6);
           break;
     }
     // Square
     case 102: {
           Square *u_square = new Square();
-          new_disc_ = new Disc(u_square, rad, true, 200, 50);
-          new_disc_->set_color(0.3, 0.9, 0.9);
-          new_disc_->set_texture(2);
-          new_disc_->delegate_orb_color_scheme(2);
+          disc = new Disc(u_square, rad, true, 200, 50);
+          disc->set_color(0.3, 0.9, 0.9);
+          disc->set_texture(2);
+          disc->delegate_orb_color_scheme(2);
           break;
     }
     // Tri
     case 103: {
           Tri *u_tri = new Tri();
-          new_disc_ = new Disc(u_tri, rad, true, 200, 50);
-          new_disc_->set_color(0.9, 0.9, 0.3);
-          new_disc_->set_texture(3);
-          new_disc_->delegate_orb_color_scheme(3);
+          disc = new Disc(u_tri, rad, true, 200, 50);
+          disc->set_color(0.9, 0.9, 0.3);
+          disc->set_texture(3);
+          disc->delegate_orb_color_scheme(3);
           break; 
     }
     // Saw
     case 104: {
           Saw *u_saw = new Saw();
-          new_disc_ = new Disc(u_saw, rad, true, 200, 50);
-          new_disc_->set_color(0.9, 0.3, 0.9);
-          new_disc_->set_texture(4);
-          new_disc_->delegate_orb_color_scheme(4);
+          disc = new Disc(u_saw, rad, true, 200, 50);
+          disc->set_color(0.9, 0.3, 0.9);
+          disc->set_texture(4);
+          disc->delegate_orb_color_scheme(4);
           break;
     }
     // BitCrusher
     case 200: {
           BitCrusher *u_bc = new BitCrusher();
-          new_disc_ = new Disc(u_bc, rad, true);
-          new_disc_->set_color(0.3, 0.9, 0.3);
-          new_disc_->set_texture(5);
+          disc = new Disc(u_bc, rad, true);
+          disc->set_color(0.3, 0.9, 0.3);
+          disc->set_texture(5);
           break; 
     }
     // Chorus
     case 201: {
           Chorus *u_chorus = new Chorus();
-          new_disc_ = new Disc(u_chorus, rad, true);
-          new_disc_->set_color(0.3, 0.6, 0.9);
-          new_disc_->set_texture(6);
+          disc = new Disc(u_chorus, rad, true);
+          disc->set_color(0.3, 0.6, 0.9);
+          disc->set_texture(6);
           break; 
     }
     // Delay
     case 202: {
           Delay *u_delay = new Delay();
-          new_disc_ = new Disc(u_delay, rad, true);
-          new_disc_->set_color(0.7, 0.7, 0.3);
-          new_disc_->set_texture(7);
+          disc = new Disc(u_delay, rad, true);
+          disc->set_color(0.7, 0.7, 0.3);
+          disc->set_texture(7);
           break; 
     }
     // Distortion
     case 203: {
           Distortion *u_dist = new Distortion();
-          new_disc_ = new Disc(u_dist, rad, true);
-          new_disc_->set_color(0.9, 0.6, 0.3);
-          new_disc_->set_texture(8);
+          disc = new Disc(u_dist, rad, true);
+          disc->set_color(0.9, 0.6, 0.3);
+          disc->set_texture(8);
           break; 
     }
     // Filter
     case 204: {
           Filter *u_filt = new Filter();
-          new_disc_ = new Disc(u_filt, rad, true);
-          new_disc_->set_color(0.7, 0.7, 0.7);
-          new_disc_->set_texture(9);
+          disc = new Disc(u_filt, rad, true);
+          disc->set_color(0.7, 0.7, 0.7);
+          disc->set_texture(9);
           break; 
     }
     // Granular
     case 205: {
           Granular *u_gn = new Granular();
-          new_disc_ = new Disc(u_gn, rad, true);
-          new_disc_->set_color(0.1, 0.1, 0.8);
-          new_disc_->set_texture(10);
+          disc = new Disc(u_gn, rad, true);
+          disc->set_color(0.1, 0.1, 0.8);
+          disc->set_texture(10);
           break;
     }
     // Looper 
     case 206: {
           Looper *u_loop = new Looper();
-          new_disc_ = new Disc(u_loop, rad, true, 0, 0);
-          new_disc_->set_color(0.9, 0.0, 0.0);
-          new_disc_->set_texture(11);
-          new_disc_->delegate_orb_color_scheme(1);
+          disc = new Disc(u_loop, rad, true, 0, 0);
+          disc->set_color(0.9, 0.0, 0.0);
+          disc->set_texture(11);
+          disc->delegate_orb_color_scheme(1);
           break;
     }
     // RingMod 
     case 207: {
           RingMod *u_rm = new RingMod();
-          new_disc_ = new Disc(u_rm, rad, true);
-          new_disc_->set_color(0.9, 0.0, 0.7);
-          new_disc_->set_texture(12);
+          disc = new Disc(u_rm, rad, true);
+          disc->set_color(0.9, 0.0, 0.7);
+          disc->set_texture(12);
           break; 
     }
-    // Reverb
+    // Reverb, convolution if an impulse response was loaded
     case 208: {
-          Reverb *u_rev = new Reverb();
-          new_disc_ = new Disc(u_rev, rad, true);
-          new_disc_->set_color(0.7, 0.0, 0.9);
-          new_disc_->set_texture(13);
+          UnitGenerator *u_rev;
+          if (ConvolutionReverb::has_impulse_response()) u_rev = new ConvolutionReverb();
+          else u_rev = new Reverb();
+          disc = new Disc(u_rev, rad, true);
+          disc->set_color(0.7, 0.0, 0.9);
+          disc->set_texture(13);
           break; 
     }
     // Tremolo
     case 209: {
           Tremolo *u_trem = new Tremolo();
-          new_disc_ = new Disc(u_trem, rad, true);
-          new_disc_->set_color(0.0, 0.6, 0.6);
-          new_disc_->set_texture(14);
+          disc = new Disc(u_trem, rad, true);
+          disc->set_color(0.0, 0.6, 0.6);
+          disc->set_texture(14);
+          break; }
+    // Preset chain, placed from the command line
+    case kPresetChainType: {
+          PresetChain *u_preset = new PresetChain();
+          disc = new Disc(u_preset, rad, true);
+          disc->set_color(0.9, 0.9, 0.9);
+          disc->set_texture(8);
           break; }
     }
-  
+  if (disc != NULL) disc->set_type(type);
+  return disc;
+}
+
+// Creates a new disc whenever a disc button is pressed.
+void Menu::make_disc(int button){
+  new_disc_ = create_disc(button);
+  if (new_disc_ == NULL) return;
   valid_disc_ = true;
   // Add the disc to the front of the list. It will speed deletion times
   // Chances are, it will be deleted anyhow.
@@ -669,6 +702,26 @@ void Menu::make_disc(int button){
   Physics::give_physics(new_disc_);
 }
 
+// Puts a new disc of the given type straight onto the table, the same way
+// one dropped from the menu arrives
+bool Menu::place_disc(int type, double x, double y){
+  Disc *d = create_disc(type);
+  if (d == NULL) return false;
+  if (!Physics::is_clear_area(x, y, d->get_radius())){
+    delete d;
+    return false;
+  }
+  d->set_location(x, y);
+  Graphics::add_drawable(d, 10);
+  Graphics::add_moveable(d);
+  Physics::give_physics(d);
+  d->unclicked();
+  if (graph_->add_effect(d)){}
+  else if (graph_->add_midi_ugen(d)){}
+  else graph_->add_input(d);
+  return true;
+}
+
 void spectrum(double w, double &R, double &G, double &B){
   if (w>1)w=1;
   if (w<0)w=0;
@@ -13,10 +13,13 @@
 #include "math.h"
 #include "Disc.h"
 #include "Drawable.h"
+#include "FrozenChain.h"
 #include "Moveable.h"
 #include "RgbImage.h"
 #include "UGenGraphBuilder.h"
 
+class Session;
+
 class Menu : public Drawable, public Moveable {
 public:
   const float kXShift = -16;
@@ -30,6 +33,20 @@ public:
 
   // Links the menu to the audio module
   void link_ugen_graph(UGenGraphBuilder *u);
+
+  // Links the menu to the scenes, so that loaded scenes are swapped in
+  void link_session(Session *s);
+
+  // Creates a ghost disc of the given type. The types are the codes of the
+  // disc buttons. Returns NULL for an unknown type
+  static Disc *create_disc(int type);
+
+  // The type of the preset chain disc, which has no button
+  static const int kPresetChainType = 210;
+
+  // Puts a new disc of the given type straight onto the table. Returns
+  // false if the type is unknown or the spot is taken
+  bool place_disc(int type, double x, double y);
   
   // Allows MIDI discs to be created
   void enable_midi();
@@ -108,6 +125,8 @@ private:
 
   // The signal graph that we are linked with
   UGenGraphBuilder *graph_;
+  // The scenes, if any
+  Session *session_;
 
   // The newly created disc.
   bool valid_disc_;
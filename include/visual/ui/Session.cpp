@@ -0,0 +1,199 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  Session.cpp
+  Saves the discs on the table to numbered scene files and recalls them.
+*/
+
+#include "Session.h"
+
+const char *Session::directory_ = "scenes";
+
+Session::Session(UGenGraphBuilder *graph){
+  graph_ = graph;
+  requested_ = 0;
+  loaded_ = 0;
+  pending_length_ = 0;
+  pending_rate_ = 0;
+  running_ = true;
+  stopped_ = false;
+  if (!loader_.start(&Session::load_thread, this)){
+    printf("Could not start the scene loader\n");
+    running_ = false;
+    stopped_ = true;
+  }
+}
+
+Session::~Session(){
+  // Thread::wait cancels the thread, so we wait for it to finish on its own
+  running_ = false;
+  while (!stopped_) usleep(kPollInterval);
+  for (int i = 0; i < pending_.size(); ++i) delete pending_[i];
+}
+
+// Listens to the number keys. Holding alt saves the scene instead
+void Session::scene_key(void *data, unsigned char key){
+  Session *s = static_cast<Session *>(data);
+  int scene = key - '0';
+  if (scene < 1 || scene > kNumScenes) return;
+  if (glutGetModifiers() & GLUT_ACTIVE_ALT) s->save(scene);
+  else s->recall(scene);
+}
+
+// Writes the discs on the table to the scene's file
+bool Session::save(int scene){
+  SessionWriter w(UnitGenerator::sample_rate);
+  std::vector<Disc *> discs;
+  // The audio thread waits while the delay lines and loops are copied out
+  // of memory. The parts of streamed loops that are only on the disk are
+  // read once it is running again, then the file is written
+  graph_->lock_thread(true);
+  graph_->get_discs(discs);
+  write_discs(w, discs);
+  graph_->lock_thread(false);
+  w.finish_blocks();
+
+  char path[1024];
+  scene_path(scene, path, sizeof(path));
+  mkdir(directory_, 0755);
+  if (!w.save(path)) return false;
+  printf("Saved scene %d\n", scene);
+  return true;
+}
+
+// Starts reading the scene's file in the background
+void Session::recall(int scene){
+  if (!running_){
+    printf("The scene loader is not running\n");
+    return;
+  }
+  __atomic_store_n(&requested_, scene, __ATOMIC_RELEASE);
+}
+
+// Swaps in a scene that has finished loading. The old discs leave the
+// same way a deleted disc does and the new ones arrive the same way a
+// disc dropped from the menu does
+void Session::install_loaded(){
+  if (!__atomic_load_n(&loaded_, __ATOMIC_ACQUIRE)) return;
+
+  std::vector<Disc *> old_discs;
+  graph_->get_discs(old_discs);
+  for (int i = 0; i < old_discs.size(); ++i){
+    while (old_discs[i]->orb_abandon()){}
+    Graphics::remove_drawable(old_discs[i]);
+    Graphics::remove_moveable(old_discs[i]);
+    Physics::take_physics(old_discs[i]);
+  }
+
+  // The audio settings may have changed while the scene was loading
+  bool stale = pending_length_ != UnitGenerator::buffer_length
+               || pending_rate_ != UnitGenerator::sample_rate;
+  for (int i = 0; i < pending_.size(); ++i){
+    Disc *d = pending_[i];
+    if (stale) d->get_ugen()->prepare(UnitGenerator::buffer_length, UnitGenerator::sample_rate);
+    Graphics::add_drawable(d, 10);
+    Graphics::add_moveable(d);
+    Physics::give_physics(d);
+    d->unclicked();
+    if (d->get_ugen()->is_looper()) d->attach_looper();
+  }
+
+  // Both sets of discs are swapped between two buffers
+  graph_->lock_thread(true);
+  for (int i = 0; i < old_discs.size(); ++i) graph_->remove_disc(old_discs[i]);
+  for (int i = 0; i < pending_.size(); ++i){
+    if (graph_->add_effect(pending_[i])){}
+    else if (graph_->add_midi_ugen(pending_[i])){}
+    else graph_->add_input(pending_[i]);
+  }
+  graph_->rebuild();
+  // Cleared before unlocking so the audio thread never reads a deleted disc
+  Disc::spotlight_disc_ = NULL;
+  graph_->lock_thread(false);
+
+  pending_.clear();
+  __atomic_store_n(&loaded_, 0, __ATOMIC_RELEASE);
+}
+
+// Writes the discs, their motion and their unit generators
+void Session::write_discs(SessionWriter &w, std::vector<Disc *> &discs){
+  w.write_int(discs.size());
+  for (int i = 0; i < discs.size(); ++i){
+    Disc *d = discs[i];
+    w.write_int(d->get_type());
+    w.write_double(d->pos_.x);
+    w.write_double(d->pos_.y);
+    w.write_double(d->vel_.x);
+    w.write_double(d->vel_.y);
+    d->get_ugen()->write_session(w);
+  }
+}
+
+// Makes ghost discs from a session. Returns false if the session could
+// not be read
+bool Session::read_discs(SessionReader &r, std::vector<Disc *> &discs){
+  int count = r.read_int();
+  for (int i = 0; i < count && !r.failed(); ++i){
+    int type = r.read_int();
+    Disc *d = Menu::create_disc(type);
+    // The rest of the session can't be found without knowing this disc
+    if (d == NULL){
+      printf("Unknown disc type %d in session\n", type);
+      break;
+    }
+    double x = r.read_double();
+    double y = r.read_double();
+    double vx = r.read_double();
+    double vy = r.read_double();
+    d->set_location(x, y);
+    d->set_velocity(vx, vy);
+    d->get_ugen()->read_session(r);
+    discs.push_back(d);
+  }
+  if (r.failed() || discs.size() != count){
+    for (int i = 0; i < discs.size(); ++i) delete discs[i];
+    discs.clear();
+    return false;
+  }
+  return true;
+}
+
+// #------------- Private --------------#
+
+// The body of the loader thread
+THREAD_RETURN THREAD_TYPE Session::load_thread(void *ptr){
+  Session *s = static_cast<Session *>(ptr);
+  while (s->running_){
+    // A loaded scene has to be installed before the next one is read
+    int scene = 0;
+    if (!__atomic_load_n(&s->loaded_, __ATOMIC_ACQUIRE)){
+      scene = __atomic_exchange_n(&s->requested_, 0, __ATOMIC_ACQ_REL);
+    }
+    if (scene == 0) usleep(kPollInterval);
+    else s->load(scene);
+  }
+  s->stopped_ = true;
+  return NULL;
+}
+
+// The file that a scene is kept in
+void Session::scene_path(int scene, char *path, int length){
+  snprintf(path, length, "%s/scene%d.cfx", directory_, scene);
+}
+
+// Reads a scene into the pending discs
+void Session::load(int scene){
+  char path[1024];
+  scene_path(scene, path, sizeof(path));
+  SessionReader r(path);
+  if (!r.is_open()) return;
+
+  pending_length_ = UnitGenerator::buffer_length;
+  pending_rate_ = UnitGenerator::sample_rate;
+  if (!read_discs(r, pending_)){
+    printf("Could not read scene %d\n", scene);
+    return;
+  }
+  __atomic_store_n(&loaded_, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,87 @@
+/*
+  Author: Chet Gnegy
+  chetgnegy@gmail.com
+
+  Session.h
+  Saves the discs on the table to numbered scene files and recalls them.
+  A scene is read on a background thread and swapped in between two audio
+  buffers, after which the graph crossfades from the old discs to the new
+  ones.
+*/
+
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <cstdio>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Disc.h"
+#include "Menu.h"
+#include "SessionFile.h"
+#include "Thread.h"
+#include "UGenGraphBuilder.h"
+
+class Session {
+public:
+  // The number keys recall scenes 1 to 9, alt and a number key saves one
+  static const int kNumScenes = 9;
+  // Time the loader sleeps when it has nothing to do
+  static const int kPollInterval = 10000; // us
+
+  Session(UGenGraphBuilder *graph);
+  ~Session();
+
+  // Scenes are kept in this directory
+  static void set_directory(const char *path){ directory_ = path; }
+
+  // Listens to the number keys. The data is the Session
+  static void scene_key(void *data, unsigned char key);
+
+  // Writes the discs on the table to the scene's file
+  bool save(int scene);
+
+  // Starts reading the scene's file in the background
+  void recall(int scene);
+
+  // Swaps in a scene that has finished loading. Called from the graphics
+  // thread
+  void install_loaded();
+
+  // Writes the discs, their motion and their unit generators. The graph
+  // must be locked. Anything that would wait on the disk is deferred, w's
+  // blocks are finished after the graph is unlocked
+  static void write_discs(SessionWriter &w, std::vector<Disc *> &discs);
+
+  // Makes ghost discs from a session. They aren't given to the graph, the
+  // graphics or the physics, so this may be called from any thread.
+  // Returns false if the session could not be read
+  static bool read_discs(SessionReader &r, std::vector<Disc *> &discs);
+
+private:
+  // The body of the loader thread
+  static THREAD_RETURN THREAD_TYPE load_thread(void *ptr);
+
+  // The file that a scene is kept in
+  void scene_path(int scene, char *path, int length);
+
+  // Reads a scene into the pending discs. Called from the loader thread
+  void load(int scene);
+
+  static const char *directory_;
+  UGenGraphBuilder *graph_;
+
+  // The scene the loader should read next, or zero
+  int requested_;
+  // Set by the loader once the pending discs are ready to install
+  int loaded_;
+  std::vector<Disc *> pending_;
+  // The audio settings the pending discs were made with
+  int pending_length_, pending_rate_;
+
+  // Destroying a Thread cancels it, so it lives as long as we do
+  Thread loader_;
+  volatile bool running_, stopped_;
+};
+
+#endif